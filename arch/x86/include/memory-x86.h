@@ -16,8 +16,8 @@
 #define KMALLOC_ADDR_START 0xC0000000
 #define KMALLOC_ADDR_END   0xE0000000
 
-#define PM_STACK_ADDR      0xE0000000
-#define PM_STACK_ADDR_TOP  0xF0000000
+#define PM_FRAMES_ADDR     0xE0000000
+#define PM_FRAMES_ADDR_TOP 0xF0000000
 
 #define PDIR_INFO_START    0xF0000000
 
@@ -32,8 +32,9 @@
 
 #define DEVICE_MAP_START   0xB8000000
 #define DEVICE_MAP_END     0xC0000000
-#define MMF_PRIV_START     0xA0000000
-#define MMF_PRIV_END       0xB0000000
+/* mmap'd files and anonymous memory */
+#define MMF_START          0xA0000000
+#define MMF_END            0xB0000000
 
 /* where the signal injector code goes */
 #define SIGNAL_INJECT      0xB0001000
@@ -71,6 +72,12 @@
 #define flush_pd() \
  __asm__ __volatile__("movl %%cr3,%%eax\n\tmovl %%eax,%%cr3": : :"ax", "eax")
 
+/* tlb flushes aren't batched on x86. Each unmap does its own */
+struct tlb_batch { int unused; };
+#define tlb_batch_init(b) do {} while(0)
+#define tlb_batch_flush(b) do {} while(0)
+#define vm_unmap_batch(v, b) vm_unmap(v)
+
 #define current_task ((kernel_state_flags&KSF_MMU) ? ((task_t *)page_directory[PAGE_DIR_IDX(SMP_CUR_TASK/PAGE_SIZE)]) : 0)
  
 #endif
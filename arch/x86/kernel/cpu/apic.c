@@ -86,6 +86,34 @@ void set_lapic_timer(unsigned tmp)
 	LAPIC_WRITE(LAPIC_TICR, tmp);
 }
 
+#if CONFIG_NOHZ
+/* program the timer to fire once, nticks ticks from now. Returns the
+ * count that was loaded so the caller can work out how long it ran */
+unsigned set_lapic_timer_oneshot(unsigned nticks)
+{
+	unsigned long long count = (unsigned long long)lapic_timer_start * nticks;
+	if(count > 0xFFFFFFFF)
+		count = 0xFFFFFFFF;
+	LAPIC_WRITE(LAPIC_LVTT, 32);
+	LAPIC_WRITE(LAPIC_TDCR, 3);
+	LAPIC_WRITE(LAPIC_TICR, (unsigned)count);
+	return (unsigned)count;
+}
+
+unsigned read_lapic_timer()
+{
+	return LAPIC_READ(LAPIC_TCCR);
+}
+
+/* go back to the periodic tick after being tickless */
+void restore_lapic_timer()
+{
+	LAPIC_WRITE(LAPIC_LVTT, 32 | 0x20000);
+	LAPIC_WRITE(LAPIC_TDCR, 3);
+	LAPIC_WRITE(LAPIC_TICR, lapic_timer_start);
+}
+#endif
+
 void calibrate_lapic_timer(unsigned freq)
 {
 	if(!(kernel_state_flags & KSF_CPUS_RUNNING))
@@ -188,4 +188,7 @@ void init_main_cpu_1()
 void init_main_cpu_2()
 {
 	init_acpi();
+	/* this has to wait until the memory manager has set up the kernel's
+	 * mappings */
+	init_write_protect(primary_cpu);
 }
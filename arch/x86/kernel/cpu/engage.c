@@ -61,6 +61,7 @@ __attribute__ ((noinline)) void cpu_stage1_init(unsigned apicid)
 		vm_map(i, pm_alloc_page(), PAGE_PRESENT | PAGE_WRITE | PAGE_USER, MAP_CRIT);
 		memset((void *)i, 0, 0x1000);
 	}
+	init_write_protect(cpu);
 	
 	printk(0, "[cpu%d]: waiting for tasking...\n", apicid);
 	while(!kernel_task) asm("cli");
@@ -72,11 +73,12 @@ __attribute__ ((noinline)) void cpu_stage1_init(unsigned apicid)
 	task->stack_end=STACK_LOCATION;
 	task->priority = 1;
 	
-	cpu->active_queue = tqueue_create(0, 0);
+	cpu->active_queue = runqueue_create(0, cpu, 0);
+	task->cpu = cpu;
 	tqueue_insert(primary_queue, (void *)task, task->listnode);
-	tqueue_insert(cpu->active_queue, (void *)task, task->activenode);
+	task_index_add(task);
+	runqueue_insert(cpu->active_queue, task);
 	cpu->cur = cpu->ktask = task;
-	task->cpu = cpu;
 	mutex_create(&cpu->lock, MT_NOSCHED);
 	cpu->numtasks=1;
 	task->thread = thread_data_create();
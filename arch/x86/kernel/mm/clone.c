@@ -5,6 +5,8 @@
 #include <task.h>
 #include <swap.h>
 #include <cpu.h>
+#include <exec.h>
+#include <mmfile.h>
 
 /* Accepts virtual, returns virtual */
 int vm_do_copy_table(int i, page_dir_t *new, page_dir_t *from, char cow)
@@ -24,9 +26,24 @@ int vm_do_copy_table(int i, page_dir_t *new, page_dir_t *from, char cow)
 	{
 		if(vm_do_getmap(virt, &phyz, 1) && vm_do_getattrib(virt, &attrib, 1))
 		{
-			/* OK, this page exists, we have the physical address of it too */
+			/* OK, this page exists, we have the physical address of it too.
+			 * Writable user pages are shared read-only with the parent, and
+			 * get copied the first time either side writes to them */
+			if(cow && (attrib & PAGE_USER) && pm_page_share(phyz)) {
+				/* read-only pages (like program text) and MAP_SHARED
+				 * pages are simply shared */
+				if((attrib & (PAGE_WRITE | PAGE_COW)) && !(attrib & PAGE_SHARED)) {
+					attrib = (attrib & ~PAGE_WRITE) | PAGE_COW;
+					page_tables[virt / PAGE_SIZE] = phyz | attrib;
+				}
+				table[q] = (addr_t)(phyz | attrib);
+				continue;
+			}
 			addr_t page = pm_alloc_page();
 			copy_page_physical((addr_t)phyz /* Source */, (addr_t)page /* Destination*/);
+			/* the copy is private, so it doesn't need to fault on write */
+			if(attrib & PAGE_COW)
+				attrib = (attrib & ~PAGE_COW) | PAGE_WRITE;
 			table[q] = (addr_t)(page | attrib);
 		}
 	}
@@ -36,6 +53,7 @@ int vm_do_copy_table(int i, page_dir_t *new, page_dir_t *from, char cow)
 }
 
 /* If is it normal task memory or the stack, we copy the tables. Otherwise we simply link them.
+ * With flags & 2, task memory below the stack is shared copy-on-write.
  */
 int vm_copy_dir(page_dir_t *from, page_dir_t *new, char flags)
 {
@@ -56,7 +74,15 @@ int vm_copy_dir(page_dir_t *from, page_dir_t *new, char flags)
 		if(((i < id_tables) || (i >= D) || (flags & 1)) && !(i < D && i >= stack))
 			new[i] = from[i];
 		else
-			vm_do_copy_table(i, new, from, flags);
+			vm_do_copy_table(i, new, from, (flags & 2) && i < stack);
+	}
+	if(flags & 2) {
+		/* the parent's entries were made read-only */
+		flush_pd();
+#if CONFIG_SMP
+		if(kernel_task && pd_cur_data->count > 1)
+			send_ipi(LAPIC_ICR_SHORT_OTHERS, 0, LAPIC_ICR_LEVELASSERT | LAPIC_ICR_TM_LEVEL | IPI_TLB);
+#endif
 	}
 	return 0;
 }
@@ -71,6 +97,8 @@ page_dir_t *vm_clone(page_dir_t *pd, char cow)
 #endif
 	addr_t new_p;
 	page_dir_t *new = (page_dir_t *)kmalloc_ap(PAGE_SIZE, &new_p);
+	/* the child gets a copy of our mmap'd regions */
+	struct mmap_space *mm = (kernel_task && cow) ? mmf_fork_begin() : 0;
 	if(kernel_task)
 		mutex_acquire(&pd_cur_data->lock);
 	vm_copy_dir(pd, new, cow ? 2 : 0);
@@ -108,10 +136,16 @@ page_dir_t *vm_clone(page_dir_t *pd, char cow)
 	 * calling schedule() may be problematic inside code that is locked by
 	 * this, but it may not be an issue. We'll see. */
 	mutex_create(&info->lock, MT_NOSCHED);
+	/* pages of the program that haven't been touched yet are read in
+	 * from the same file by the child */
+	if(kernel_task)
+		info->image = exec_image_get(pd_cur_data->image);
+	info->mmap = mm;
 	vm_do_unmap_only((unsigned)tmp, 1);
 	new[PAGE_DIR_IDX(PDIR_DATA/PAGE_SIZE)] = tmp_p | PAGE_PRESENT | PAGE_WRITE;
 	if(kernel_task)
 		mutex_release(&pd_cur_data->lock);
+	mmf_fork_end(mm);
 	return new;
 }
 
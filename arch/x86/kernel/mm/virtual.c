@@ -35,16 +35,17 @@ void vm_init(addr_t id_map_to)
 	/* Identity map the kernel */
 	unsigned mapper=0, i;
 	while(mapper <= PAGE_DIR_IDX(((id_map_to&PAGE_MASK)+0x1000)/0x1000)) {
-		pd[mapper] = pm_alloc_page() | PAGE_PRESENT | PAGE_USER;
+		pd[mapper] = pm_alloc_page() | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
 		pt = (unsigned int *)(pd[mapper] & PAGE_MASK);
 		memset(pt, 0, 0x1000);
 		/* we map as user for now, since the init() function runs in
 		 * ring0 for a short amount of time and needs read access to the
 		 * kernel code. This is later re-mapped by the kernel idle 
-		 * process with proper protection flags */
+		 * process with proper protection flags. It has to be writable
+		 * for the kernel once write protection is enabled */
 		for(i=0;i<1024;i++)
 			pt[i] = (mapper*1024*0x1000 + 0x1000*i) | PAGE_PRESENT 
-						| PAGE_USER;
+						| PAGE_WRITE | PAGE_USER;
 		mapper++;
 	}
 	id_tables=mapper;
@@ -56,7 +57,7 @@ void vm_init(addr_t id_map_to)
 	unsigned sig_pdi = PAGE_DIR_IDX(SIGNAL_INJECT / PAGE_SIZE);
 	unsigned sig_tbi = PAGE_TABLE_IDX(SIGNAL_INJECT / PAGE_SIZE);
 	assert(!pd[sig_pdi]);
-	pd[sig_pdi] = ((unsigned)(pt=(unsigned *)pm_alloc_page()) | PAGE_PRESENT | PAGE_USER);
+	pd[sig_pdi] = ((unsigned)(pt=(unsigned *)pm_alloc_page()) | PAGE_PRESENT | PAGE_WRITE | PAGE_USER);
 	memset(pt, 0, 0x1000);
 	pt[sig_tbi] = (unsigned)pm_alloc_page() | PAGE_PRESENT | PAGE_USER;
 	memcpy((void *)(pt[sig_tbi] & PAGE_MASK), (void *)signal_return_injector, SIGNAL_INJECT_SIZE);
@@ -69,8 +70,8 @@ void vm_init(addr_t id_map_to)
 		memset(pt, 0, 0x1000);
 	}
 	/* Pre-map the PMM's tables */
-	unsigned pm_pd_idx = PAGE_DIR_IDX(PM_STACK_ADDR / 0x1000);
-	for(i=pm_pd_idx;i<(int)PAGE_DIR_IDX(PM_STACK_ADDR_TOP / 0x1000);i++)
+	unsigned pm_pd_idx = PAGE_DIR_IDX(PM_FRAMES_ADDR / 0x1000);
+	for(i=pm_pd_idx;i<(int)PAGE_DIR_IDX(PM_FRAMES_ADDR_TOP / 0x1000);i++)
 	{
 		pd[i] = pm_alloc_page() | PAGE_PRESENT | PAGE_WRITE;
 		pt = (unsigned int *)(pd[i] & PAGE_MASK);
@@ -154,6 +155,9 @@ unsigned int vm_setattrib(addr_t v, short attr)
 		return 0;
 	if(kernel_task)
 		mutex_acquire(&pd_cur_data->lock);
+	/* a copy-on-write page stays read-only until it is written to */
+	if(page_tables[vp] & PAGE_COW)
+		attr = (attr & ~PAGE_WRITE) | PAGE_COW;
 	(page_tables[vp] &= PAGE_MASK);
 	(page_tables[vp] |= attr);
 	asm("invlpg (%0)"::"r" (v));
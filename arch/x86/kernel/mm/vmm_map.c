@@ -16,9 +16,11 @@ int vm_map(addr_t virt, addr_t phys, unsigned attr, unsigned opt)
 	{
 		p = pm_alloc_page();
 		zero_page_physical(p);
-		pd[vdir] = p | PAGE_WRITE | PAGE_PRESENT | (attr & PAGE_USER);
+		pd[vdir] = p | PAGE_WRITE | PAGE_PRESENT;
 		flush_pd();
 	}
+	/* the table may have been created for kernel-only pages */
+	pd[vdir] |= attr & PAGE_USER;
 	page_tables[vpage] = (phys & PAGE_MASK) | attr;
 	asm("invlpg (%0)"::"r" (virt));
 	if(!(opt & MAP_NOCLEAR))
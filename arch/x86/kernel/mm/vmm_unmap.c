@@ -60,7 +60,7 @@ int vm_do_unmap(addr_t virt, unsigned locked)
 #endif
 	if(kernel_task && (virt&PAGE_MASK) != PDIR_DATA && !locked)
 		mutex_release(&pd_cur_data->lock);
-	if(p && !(p & PAGE_COW))
+	if(p)
 		pm_free_page(p & PAGE_MASK);
 	return 0;
 }
@@ -61,19 +61,23 @@ __attribute__((always_inline)) inline static void restore_context(task_t *n)
 {
 	/* Update some last-minute things. The stack. */
 	set_kernel_stack(current_tss, (n->kernel_stack + (KERN_STACK_SIZE-STACK_ELEMENT_SIZE)) & ~0xF);
+	((cpu_t *)n->cpu)->tlb_cr3 = tlb_switch_space(n);
 	if(((cpu_t *)n->cpu)->flags & CPU_SSE || ((cpu_t *)n->cpu)->flags & CPU_FPU)
 		__asm__ __volatile__("fxrstor64 (%0)"
 		:: "r" (ALIGN(current_task->fpu_save_data, 16)));
 }
 
+/* cr3 is only loaded if restore_context found that the directory
+ * changes, since loading it flushes the tlb (or the pcid's part of it) */
 __attribute__((always_inline)) inline static void context_switch(task_t *n)
 {
 	asm("         \
 	mov %1, %%rsp;       \
 	mov %2, %%rbp;       \
-	mov %3, %%cr3; nop;"
+	test %3, %3; jz 1f;  \
+	mov %3, %%cr3; 1: nop;"
 	: : "r"(0), "r"(n->esp), "r"(n->ebp), 
-		"r"(n->pd[PML4_IDX(PHYSICAL_PML4_INDEX/0x1000)]&PAGE_MASK) : "rax");
+		"r"(((cpu_t *)n->cpu)->tlb_cr3) : "rax", "cc");
 	
 	asm("mov %0, %%rbx" :: "r"(current_task->preserved[0]));
 	asm("mov %0, %%r12" :: "r"(current_task->preserved[1]));
@@ -2,6 +2,8 @@
 #define _CPU_X86_64_H
 #include <types.h>
 #define CPU_EXT_FEATURES_GBPAGE (1 << 26)
+#define CPU_FEATURES_ECX_PCID (1 << 17)
+#define CR4_PCIDE (1 << 17)
 
 typedef struct {
 	char manufacturer_string[13];
@@ -13,7 +13,7 @@
  */
 #define TOP_TASK_MEM              0x00007FFFFFFFFFFF
 #define TOP_TASK_MEM_EXEC         0x0000700000000000
-#define TOP_USER_HEAP             0x0000700000000000
+#define TOP_USER_HEAP             0x0000600000000000
 #define TOP_LOWER_KERNEL                  0x40000000
 
 #define STACK_LOCATION     (0x0000700000002000 + ((CONFIG_STACK_PAGES+1) * 0x1000)*2)
@@ -22,6 +22,10 @@
 
 #define EXEC_MINIMUM	                  0x50000000
 
+/* mmap'd files and anonymous memory */
+#define MMF_START                 0x0000600000000000
+#define MMF_END                   0x0000700000000000
+
 #define START_FREE_LOCATION               0x40000000
 
 #define KMALLOC_ADDR_START        0xFFFF820000000000
@@ -30,8 +34,8 @@
 #define DEVICE_MAP_END            0xFFFFFF7FC0000000
 #define DEVICE_MAP_START          0xFFFFFF0000000000
 
-#define PM_STACK_ADDR             0xFFFFFF7FC0000000
-#define PM_STACK_ADDR_TOP         0xFFFFFF8000000000
+#define PM_FRAMES_ADDR            0xFFFFFF7FC0000000
+#define PM_FRAMES_ADDR_TOP        0xFFFFFF8000000000
 
 #define PHYS_PAGE_MAP             0xFFFFFF8000000000
 
@@ -55,6 +59,10 @@
 
 #define PAGE_MASK      0xFFFFFFFFFFFFF000
 #define PAGE_LARGE (1 << 7)
+/* a page directory entry with PAGE_LARGE maps this much, backed by a
+ * buddy block of LARGE_PAGE_ORDER */
+#define LARGE_PAGE_SIZE 0x200000
+#define LARGE_PAGE_ORDER 9
 #define PML4_IDX(x) ((x/0x8000000) % 512)
 #define PDPT_IDX(x) ((x / 0x40000) % 512)
 #define PAGE_DIR_IDX(x) ((x / 0x200) % 512)
@@ -69,5 +77,48 @@ __asm__ __volatile__("mov %%cr3,%%rax\n\tmov %%rax,%%cr3": : :"ax", "eax", "rax"
 addr_t pm_alloc_page_zero();
 addr_t get_next_mm_device_page();
 int vm_early_map(addr_t *, addr_t virt, addr_t phys, unsigned attr, unsigned opt);
+int vm_map_large(addr_t virt, addr_t phys, unsigned attr, unsigned opt);
+int vm_unmap_large(addr_t virt);
+void vm_split_large(addr_t *pde);
 extern addr_t *kernel_dir_phys;
+
+/* unmaps that are done together collect their addresses in a tlb_batch
+ * and are flushed once, at the end. The pages they free are held until
+ * then, so that nothing can reuse them while a stale tlb entry might
+ * still point at them */
+#define TLB_FLUSH_MAX 32 /* above this many pages, flush the whole tlb */
+#define TLB_BATCH_FREE 64
+struct tlb_batch {
+	addr_t start, end;
+	unsigned count, nr_free;
+	/* which other cpus need to hear about it (TLB_REMOTE_*) */
+	unsigned remote;
+	addr_t free[TLB_BATCH_FREE];
+};
+#define TLB_REMOTE_NONE 0
+#define TLB_REMOTE_SPACE 1 /* the ones running this address space */
+#define TLB_REMOTE_ALL 2
+void tlb_batch_init(struct tlb_batch *b);
+void tlb_batch_add(struct tlb_batch *b, addr_t virt, addr_t phys);
+void tlb_batch_flush(struct tlb_batch *b);
+int vm_unmap_batch(addr_t virt, struct tlb_batch *b);
+void tlb_flush_page(addr_t virt);
+void tlb_flush_space();
+void tlb_note_change(addr_t virt);
+struct pd_data;
+void tlb_new_space(struct pd_data *pd);
+struct task_struct;
+addr_t tlb_switch_space(volatile struct task_struct *next);
+void tlb_handle_ipi();
+extern int tlb_pcid_enabled;
+
+/* with CR4_PCIDE, the low bits of cr3 are the pcid. Each cpu gives the
+ * directories it runs one of a few pcids, and remembers how up to date
+ * what's cached under it is (see tlb.c). Pcid 0 isn't handed out */
+#define TLB_NUM_PCIDS 8
+#define CR3_NOFLUSH (1UL << 63)
+struct tlb_pcid {
+	addr_t pml4;
+	unsigned long gen, kernel_gen;
+};
 #endif
@@ -194,6 +194,8 @@ void init_main_cpu_2()
 	parse_cpuid(primary_cpu);
 	setup_fpu(primary_cpu);
 	init_sse(primary_cpu);
+	init_write_protect(primary_cpu);
+	init_pcid(primary_cpu);
 	primary_cpu->flags |= CPU_RUNNING;
 	printk(KERN_EVERY, "done\n");
 	mutex_create((mutex_t *)&primary_cpu->lock, MT_NOSCHED);
@@ -46,6 +46,8 @@ __attribute__ ((noinline)) void cpu_stage1_init(unsigned apicid)
 	pml4_t *new_pml4 = vm_clone((addr_t *)kernel_dir, 0);
 	vm_switch(new_pml4);
 	cpu->kd = new_pml4;
+	init_write_protect(cpu);
+	init_pcid(cpu);
 	
 	/* initialize tasking for this CPU */
 	task_t *task = task_create();
@@ -73,9 +75,10 @@ __attribute__ ((noinline)) void cpu_stage1_init(unsigned apicid)
 	
 	task->pid = add_atomic(&next_pid, 1)-1;
 	tqueue_insert(primary_queue, (void *)task, task->listnode);
+	task_index_add(task);
 	
-	cpu->active_queue = tqueue_create(0, 0);
-	tqueue_insert(cpu->active_queue, (void *)task, task->activenode);
+	cpu->active_queue = runqueue_create(0, cpu, 0);
+	runqueue_insert(cpu->active_queue, task);
 	asm("mov %0, %%rsp" : : "r" (STACK_LOCATION + STACK_SIZE - STACK_ELEMENT_SIZE));
 	asm("mov %0, %%rbp" : : "r" (STACK_LOCATION + STACK_SIZE - STACK_ELEMENT_SIZE));
 	cpu_k_task_entry(current_task);
@@ -3,42 +3,41 @@
 #include <elf.h>
 #include <symbol.h>
 #include <file.h>
+#include <memory.h>
+#include <exec.h>
 int process_elf64_phdr(char *mem, int fp, addr_t *start, addr_t *end)
 {
-	uint32_t i, x;
-	addr_t entry;
+	uint32_t i;
 	elf_header_t *eh = (elf_header_t *)mem;
 	char buffer[(eh->phnum+1)*eh->phsize];
 	read_data(fp, buffer, eh->phoff, eh->phsize * eh->phnum);
-	uint64_t vaddr=0, length=0, offset=0, stop, tmp;
-	uint64_t max=0, min=~0;
+	uint64_t vaddr=0, stop;
+	uint64_t max=0;
 	struct file *file = get_file_pointer((task_t *)current_task, fp);
+	/* nothing is read in here, the segments are paged in from the file
+	 * as they are touched (see loader/image.c) */
+	struct exec_image *img = exec_image_create(file->inode, eh->phnum);
 	for(i=0;i < eh->phnum;i++)
 	{
 		elf64_program_header_t *ph = (elf64_program_header_t *)(buffer + (i*eh->phsize));
 		vaddr = ph->p_addr;
-		if(vaddr < min)
-			min = vaddr;
-		offset = ph->p_offset;
-		length = ph->p_filesz;
 		stop = vaddr+ph->p_memsz;
-		tmp = vaddr&PAGE_MASK;
 		if(ph->p_type == PH_LOAD) {
 			if(stop > max) max = stop;
-			while(tmp <= stop + PAGE_SIZE)
-			{
-				user_map_if_not_mapped(tmp);
-				tmp += PAGE_SIZE;
-			}
-			if((unsigned)do_sys_read_flags(file, offset, (char *)vaddr, length) != length) {
+			if(exec_image_add(img, vaddr, ph->p_memsz, ph->p_offset, ph->p_filesz,
+						(ph->p_flags & PH_FLAG_W) ? ES_WRITE : 0) < 0) {
+				exec_image_put(img);
 				fput((task_t *)current_task, fp, 0);
 				return 0;
 			}
 		}
 	}
 	fput((task_t *)current_task, fp, 0);
-	if(!max)
+	if(!max) {
+		exec_image_put(img);
 		return 0;
+	}
+	pd_cur_data->image = img;
 	*start = eh->entry;
 	*end = max;
 	return 1;
@@ -5,11 +5,30 @@
 #include <task.h>
 #include <swap.h>
 #include <cpu.h>
+#include <exec.h>
+#include <mmfile.h>
 
-void copy_pde(page_dir_t *pd, page_dir_t *parent_pd, int idx)
+/* If cow is set, writable user pages are shared with the parent instead
+ * of copied: both entries are made read-only and marked PAGE_COW, and the
+ * first write to the page from either side gets its own copy (see
+ * page_fault). */
+void copy_pde(page_dir_t *pd, page_dir_t *parent_pd, int idx, int cow)
 {
 	if(!parent_pd[idx])
 		return;
+	if(parent_pd[idx] & PAGE_LARGE) {
+		/* large pages are private, so the child gets its own copy. If
+		 * there isn't a free 2MB block, the parent's mapping is split up
+		 * and copied one page at a time */
+		addr_t phys = parent_pd[idx] & PAGE_MASK & ~((addr_t)LARGE_PAGE_SIZE-1);
+		addr_t block = pm_alloc_pages(LARGE_PAGE_ORDER, PM_TRY);
+		if(block) {
+			memcpy((void *)(block + PHYS_PAGE_MAP), (void *)(phys + PHYS_PAGE_MAP), LARGE_PAGE_SIZE);
+			pd[idx] = block | (parent_pd[idx] & ATTRIB_MASK);
+			return;
+		}
+		vm_split_large(&parent_pd[idx]);
+	}
 	page_table_t *parent = (addr_t *)((parent_pd[idx] & PAGE_MASK) + PHYS_PAGE_MAP);
 	page_table_t table = pm_alloc_page(), *entries;
 	entries = (addr_t *)(table+PHYS_PAGE_MAP);
@@ -19,9 +38,20 @@ void copy_pde(page_dir_t *pd, page_dir_t *parent_pd, int idx)
 		if(parent[i])
 		{
 			unsigned attr = parent[i] & ATTRIB_MASK;
-			addr_t new_page = pm_alloc_page();
 			addr_t parent_page = parent[i] & PAGE_MASK;
+			if(cow && (attr & PAGE_USER) && pm_page_share(parent_page)) {
+				/* read-only pages (like program text) and MAP_SHARED
+				 * pages are simply shared */
+				if((attr & (PAGE_WRITE | PAGE_COW)) && !(attr & PAGE_SHARED))
+					parent[i] = (parent[i] & ~PAGE_WRITE) | PAGE_COW;
+				entries[i] = parent[i];
+				continue;
+			}
+			addr_t new_page = pm_alloc_page();
 			memcpy((void *)(new_page + PHYS_PAGE_MAP), (void *)(parent_page + PHYS_PAGE_MAP), PAGE_SIZE);
+			/* the copy is private, so it doesn't need to fault on write */
+			if(attr & PAGE_COW)
+				attr = (attr & ~PAGE_COW) | PAGE_WRITE;
 			entries[i] = new_page | attr;
 		} else
 			entries[i]=0;
@@ -30,7 +60,7 @@ void copy_pde(page_dir_t *pd, page_dir_t *parent_pd, int idx)
 	pd[idx] = table | attr;
 }
 
-void copy_pdpte(pdpt_t *pdpt, pdpt_t *parent_pdpt, int idx)
+void copy_pdpte(pdpt_t *pdpt, pdpt_t *parent_pdpt, int idx, int cow)
 {
 	if(!parent_pdpt[idx])
 		return;
@@ -39,12 +69,12 @@ void copy_pdpte(pdpt_t *pdpt, pdpt_t *parent_pdpt, int idx)
 	memset((void *)(pd + PHYS_PAGE_MAP), 0, PAGE_SIZE);
 	int i;
 	for(i=0;i<512;i++)
-		copy_pde((addr_t *)(pd+PHYS_PAGE_MAP), parent_pd, i);
+		copy_pde((addr_t *)(pd+PHYS_PAGE_MAP), parent_pd, i, cow);
 	unsigned attr = parent_pdpt[idx] & ATTRIB_MASK;
 	pdpt[idx] = pd | attr;
 }
 
-void copy_pml4e(pml4_t *pml4, pml4_t *parent_pml4, int idx)
+void copy_pml4e(pml4_t *pml4, pml4_t *parent_pml4, int idx, int cow)
 {
 	if(!parent_pml4[idx])
 		return;
@@ -53,7 +83,7 @@ void copy_pml4e(pml4_t *pml4, pml4_t *parent_pml4, int idx)
 	memset((void *)(pdpt + PHYS_PAGE_MAP), 0, PAGE_SIZE);
 	int i;
 	for(i=0;i<512;i++)
-		copy_pdpte((addr_t *)(pdpt+PHYS_PAGE_MAP), parent_pdpt, i);
+		copy_pdpte((addr_t *)(pdpt+PHYS_PAGE_MAP), parent_pdpt, i, cow);
 	unsigned attr = parent_pml4[idx] & ATTRIB_MASK;
 	pml4[idx] = pdpt | attr;
 }
@@ -67,6 +97,8 @@ pml4_t *vm_clone(pml4_t *parent_pml4, char cow)
 #endif
 	addr_t pml4_phys;
 	pml4_t *pml4 = kmalloc_ap(0x1000, &pml4_phys);
+	/* the child gets a copy of our mmap'd regions */
+	struct mmap_space *mm = (kernel_task && cow) ? mmf_fork_begin() : 0;
 	
 	if(kernel_task)
 		mutex_acquire(&pd_cur_data->lock);
@@ -78,16 +110,21 @@ pml4_t *vm_clone(pml4_t *parent_pml4, char cow)
 	pdpt_t *parent_pdpt = (addr_t *)((parent_pml4[0] & PAGE_MASK) + PHYS_PAGE_MAP);
 	pdpt[0] = parent_pdpt[0];
 	for(i=1;i<512;i++)
-		copy_pdpte(pdpt, parent_pdpt, i);
+		copy_pdpte(pdpt, parent_pdpt, i, cow);
 	
+	/* only task memory is shared. The stacks and the accounting page
+	 * are always copied */
 	for(i=1;i<512;i++)
 	{
 		if(i >= PML4_IDX(BOTTOM_HIGHER_KERNEL/0x1000) || parent_pml4[i] == 0)
 			pml4[i] = parent_pml4[i];
 		else
-			copy_pml4e(pml4, parent_pml4, i);
+			copy_pml4e(pml4, parent_pml4, i, cow && i < PML4_IDX(TOP_TASK_MEM_EXEC/0x1000));
 	}
 	pml4[PML4_IDX(PHYSICAL_PML4_INDEX/0x1000)] = pml4_phys;
+	/* the parent's entries were made read-only */
+	if(cow)
+		tlb_flush_space();
 	
 	/* get the physical address of the page_dir_info for the new task, which is automatically
 	 * copied in the copy loop above */
@@ -101,14 +138,21 @@ pml4_t *vm_clone(pml4_t *parent_pml4, char cow)
 	struct pd_data *info = (struct pd_data *)(info_phys + PHYS_PAGE_MAP);
 	memset(info, 0, 0x1000);
 	info->count=1;
+	tlb_new_space(info);
 	/* create the lock. We assume that the only time that two threads
 	 * may be trying to access this lock at the same time is when they're
 	 * running on different processors, thus we get away with NOSCHED. Also, 
 	 * calling schedule() may be problematic inside code that is locked by
 	 * this, but it may not be an issue. We'll see. */
 	mutex_create(&info->lock, MT_NOSCHED);
-	if(kernel_task)
+	if(kernel_task) {
+		/* pages of the program that haven't been touched yet are read
+		 * in from the same file by the child */
+		info->image = exec_image_get(pd_cur_data->image);
+		info->mmap = mm;
 		mutex_release(&pd_cur_data->lock);
+		mmf_fork_end(mm);
+	}
 	return pml4;
 }
 
@@ -136,10 +180,13 @@ pml4_t *vm_copy(pml4_t *parent_pml4)
 		{
 			pml4[i] = parent_pml4[i];
 		} else {
-			copy_pml4e(pml4, parent_pml4, i);
+			copy_pml4e(pml4, parent_pml4, i, 0);
 		}
 	}
 	pml4[PML4_IDX(PHYSICAL_PML4_INDEX/0x1000)] = pml4_phys;
+	/* the new directory may be in a page that a thread of ours that has
+	 * since exited used for its own */
+	tlb_new_space(pd_cur_data);
 	if(kernel_task)
 		mutex_release(&pd_cur_data->lock);
 	return pml4;
@@ -8,7 +8,11 @@ void free_pde(page_dir_t *pd, unsigned idx)
 	if(!pd[idx]) 
 		return;
 	addr_t physical = pd[idx]&PAGE_MASK;
-	assert(!(pd[idx] & (1 << 7)));
+	if(pd[idx] & PAGE_LARGE) {
+		pd[idx]=0;
+		pm_free_pages(physical & ~((addr_t)LARGE_PAGE_SIZE-1), LARGE_PAGE_ORDER);
+		return;
+	}
 	page_table_t *table = (addr_t *)(physical + PHYS_PAGE_MAP);
 	for(unsigned i=0;i<512;i++)
 	{
@@ -59,6 +63,7 @@ void free_thread_shared_directory()
 	pdpt_t *pdpt = (addr_t *)((pml4[0] & PAGE_MASK) + PHYS_PAGE_MAP);
 	for(unsigned i=1;i<512;i++)
 		free_pdpte(pdpt, i);
+	tlb_flush_space();
 }
 
 /* free the pml4, not the entries */
@@ -111,4 +116,5 @@ void free_thread_specific_directory()
 	unsigned int E = PML4_IDX((TOP_TASK_MEM+1)/0x1000);
 	for(unsigned i=S;i<E;i++)
 		free_pml4e(current_task->pd, i);
+	tlb_flush_space();
 }
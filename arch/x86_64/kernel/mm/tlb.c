@@ -0,0 +1,267 @@
+/* tlb.c - keeping the tlbs of other cpus up to date
+ * Kernel memory is mapped in every address space, so a change to it has
+ * to be flushed on every cpu. User memory can only be cached by the cpus
+ * that have its address space loaded, which are kept track of in its
+ * pd_data's cpu_mask. A request is added to the target cpu's pending
+ * range before it is sent IPI_TLB, so requests that pile up before it
+ * gets to them are handled together. As before, the sender doesn't wait
+ * for the other cpus to finish.
+ *
+ * If the cpu supports pcids, each cpu tags the directories it runs with
+ * one of a few pcids, and loading cr3 doesn't throw away what's cached
+ * under the others. Flushes only reach the pcid that is loaded, so every
+ * change also gives the address space (or, for kernel memory, all of
+ * them) a new generation. A directory is loaded without a flush only if
+ * nothing has changed since it was last flushed on this cpu.
+ */
+#include <kernel.h>
+#include <memory.h>
+#include <task.h>
+#include <cpu.h>
+#include <atomic.h>
+
+static unsigned __tlb_remote(addr_t virt)
+{
+	if(IS_KERN_MEM(virt))
+		return TLB_REMOTE_ALL;
+	/* thread specific memory is only mapped in our own directory */
+	return IS_THREAD_SHARED_MEM(virt) ? TLB_REMOTE_SPACE : TLB_REMOTE_NONE;
+}
+
+int tlb_pcid_enabled = 0;
+static unsigned long tlb_gen_next = 0, tlb_kernel_gen = 0;
+
+/* called after a mapping changes, before anyone is told to flush it */
+static void __tlb_changed(unsigned remote)
+{
+	if(!tlb_pcid_enabled)
+		return;
+	if(remote == TLB_REMOTE_ALL)
+		add_atomic(&tlb_kernel_gen, 1);
+	else
+		pd_cur_data->tlb_gen = add_atomic(&tlb_gen_next, 1);
+}
+
+/* a new address space, or one with a new directory in it. Whatever this
+ * cpu or others have cached for a directory that used the same page
+ * before is no good anymore */
+void tlb_new_space(struct pd_data *pd)
+{
+	pd->tlb_gen = add_atomic(&tlb_gen_next, 1);
+}
+
+/* for changes that are only flushed on this cpu */
+void tlb_note_change(addr_t virt)
+{
+	__tlb_changed(__tlb_remote(virt));
+}
+
+static void __tlb_flush_local(addr_t start, addr_t end)
+{
+	if(end - start > TLB_FLUSH_MAX * PAGE_SIZE) {
+		flush_pd();
+		return;
+	}
+	for(addr_t a = start; a < end; a += PAGE_SIZE) {
+		asm("invlpg (%0)"::"r" (a));
+	}
+}
+
+#if CONFIG_SMP
+static void __tlb_lock(cpu_t *cpu)
+{
+	while(bts_atomic(&cpu->tlb_lock, 0)) {
+		asm("pause");
+	}
+}
+
+static void __tlb_post(cpu_t *cpu, addr_t start, addr_t end)
+{
+	__tlb_lock(cpu);
+	if(cpu->tlb_start == cpu->tlb_end) {
+		cpu->tlb_start = start;
+		cpu->tlb_end = end;
+	} else {
+		if(start < cpu->tlb_start)
+			cpu->tlb_start = start;
+		if(end > cpu->tlb_end)
+			cpu->tlb_end = end;
+	}
+	btr_atomic(&cpu->tlb_lock, 0);
+}
+
+static void __tlb_flush_remote(addr_t start, addr_t end, unsigned remote)
+{
+	if(!kernel_task || remote == TLB_REMOTE_NONE)
+		return;
+	int old = set_int(0);
+	cpu_t *me = current_task->cpu;
+	unsigned i;
+	if(remote == TLB_REMOTE_ALL) {
+		for(i=0;i<cpu_array_num;i++) {
+			if(&cpu_array[i] != me && (cpu_array[i].flags & CPU_RUNNING))
+				__tlb_post(&cpu_array[i], start, end);
+		}
+		send_ipi(LAPIC_ICR_SHORT_OTHERS, 0, LAPIC_ICR_LEVELASSERT | LAPIC_ICR_TM_LEVEL | IPI_TLB);
+	} else {
+		for(i=0;i<cpu_array_num;i++) {
+			cpu_t *cpu = &cpu_array[i];
+			if(cpu == me || !cpu_mask_test(pd_cur_data->cpu_mask, i))
+				continue;
+			__tlb_post(cpu, start, end);
+			send_ipi(LAPIC_ICR_SHORT_DEST, cpu->apicid, 
+					LAPIC_ICR_LEVELASSERT | LAPIC_ICR_TM_LEVEL | IPI_TLB);
+		}
+	}
+	set_int(old);
+}
+
+/* handle IPI_TLB by flushing whatever has been asked of us */
+void tlb_handle_ipi()
+{
+	cpu_t *cpu = current_task ? current_task->cpu : 0;
+	if(!cpu) {
+		flush_pd();
+		return;
+	}
+	__tlb_lock(cpu);
+	addr_t start = cpu->tlb_start, end = cpu->tlb_end;
+	cpu->tlb_start = cpu->tlb_end = 0;
+	btr_atomic(&cpu->tlb_lock, 0);
+	/* an empty range means an earlier IPI already took care of it */
+	if(start != end)
+		__tlb_flush_local(start, end);
+}
+
+#else
+#define __tlb_flush_remote(start, end, remote) do {} while(0)
+#endif
+
+static struct pd_data *__pd_data(page_dir_t *pml4)
+{
+	addr_t vpage = PDIR_DATA/0x1000;
+	addr_t e = pml4[PML4_IDX(vpage)];
+	if(!e)
+		return 0;
+	e = ((addr_t *)((e & PAGE_MASK) + PHYS_PAGE_MAP))[PDPT_IDX(vpage)];
+	if(!e)
+		return 0;
+	e = ((addr_t *)((e & PAGE_MASK) + PHYS_PAGE_MAP))[PAGE_DIR_IDX(vpage)];
+	if(!e)
+		return 0;
+	e = ((addr_t *)((e & PAGE_MASK) + PHYS_PAGE_MAP))[PAGE_TABLE_IDX(vpage)];
+	if(!e)
+		return 0;
+	return (struct pd_data *)((e & PAGE_MASK) + PHYS_PAGE_MAP);
+}
+
+/* pick the pcid that next's directory is tagged with on this cpu, and
+ * whether what's cached under it can be kept */
+static addr_t __tlb_pcid(cpu_t *cpu, addr_t pml4, struct pd_data *pd)
+{
+	unsigned long gen = pd ? pd->tlb_gen : 0;
+	unsigned i;
+	for(i=0;i<TLB_NUM_PCIDS;i++) {
+		if(cpu->tlb_pcids[i].pml4 == pml4)
+			break;
+	}
+	if(i == TLB_NUM_PCIDS) {
+		i = cpu->tlb_pcid_next++ % TLB_NUM_PCIDS;
+		cpu->tlb_pcids[i].pml4 = pml4;
+	} else if(cpu->tlb_pcids[i].gen == gen 
+			&& cpu->tlb_pcids[i].kernel_gen == tlb_kernel_gen) {
+		return pml4 | (i+1) | CR3_NOFLUSH;
+	}
+	cpu->tlb_pcids[i].gen = gen;
+	cpu->tlb_pcids[i].kernel_gen = tlb_kernel_gen;
+	return pml4 | (i+1);
+}
+
+/* called by the scheduler before it switches to next. Returns what to
+ * load into cr3, or 0 if next's directory is already loaded. Loading it
+ * flushes the tlb, so we only need to hear about flushes for next's
+ * address space from now on */
+addr_t tlb_switch_space(task_t *next)
+{
+	cpu_t *cpu = next->cpu;
+	addr_t pml4 = next->pd[PML4_IDX(PHYSICAL_PML4_INDEX/0x1000)] & PAGE_MASK;
+	struct pd_data *to = __pd_data(next->pd);
+#if CONFIG_SMP
+	if(to != cpu->tlb_space) {
+		/* a dying task's directory may be freed as soon as it's buried */
+		if(cpu->tlb_space && !(current_task->flags & TF_DYING))
+			cpu_mask_clear(cpu->tlb_space->cpu_mask, cpu_index(cpu));
+		if(to)
+			cpu_mask_set(to->cpu_mask, cpu_index(cpu));
+	}
+#endif
+	cpu->tlb_space = to;
+	if(!(cpu->flags & CPU_PCID)) {
+		if(pml4 == cpu->tlb_pml4)
+			return 0;
+		cpu->tlb_pml4 = pml4;
+		return pml4;
+	}
+	addr_t cr3 = __tlb_pcid(cpu, pml4, to);
+	if(pml4 == cpu->tlb_pml4 && (cr3 & CR3_NOFLUSH))
+		return 0;
+	cpu->tlb_pml4 = pml4;
+	return cr3;
+}
+
+/* flush a single page that was just remapped or unmapped */
+void tlb_flush_page(addr_t virt)
+{
+	virt &= PAGE_MASK;
+	asm("invlpg (%0)"::"r" (virt));
+	unsigned remote = __tlb_remote(virt);
+	__tlb_changed(remote);
+	__tlb_flush_remote(virt, virt + PAGE_SIZE, remote);
+}
+
+/* flush all of the current address space, everywhere it's loaded */
+void tlb_flush_space()
+{
+	flush_pd();
+	__tlb_changed(TLB_REMOTE_SPACE);
+	__tlb_flush_remote(0, ~(addr_t)0, TLB_REMOTE_SPACE);
+}
+
+void tlb_batch_init(struct tlb_batch *b)
+{
+	b->start = b->end = 0;
+	b->count = b->nr_free = 0;
+	b->remote = TLB_REMOTE_NONE;
+}
+
+/* note that virt was unmapped. phys (if not 0) is the page that was
+ * mapped there, which is freed once the flush is done */
+void tlb_batch_add(struct tlb_batch *b, addr_t virt, addr_t phys)
+{
+	virt &= PAGE_MASK;
+	if(!b->count || virt < b->start)
+		b->start = virt;
+	if(!b->count || virt + PAGE_SIZE > b->end)
+		b->end = virt + PAGE_SIZE;
+	b->count++;
+	unsigned remote = __tlb_remote(virt);
+	if(remote > b->remote)
+		b->remote = remote;
+	if(!phys)
+		return;
+	if(b->nr_free == TLB_BATCH_FREE)
+		tlb_batch_flush(b);
+	b->free[b->nr_free++] = phys;
+}
+
+void tlb_batch_flush(struct tlb_batch *b)
+{
+	if(b->count) {
+		__tlb_flush_local(b->start, b->end);
+		__tlb_changed(b->remote);
+		__tlb_flush_remote(b->start, b->end, b->remote);
+	}
+	for(unsigned i=0;i<b->nr_free;i++)
+		pm_free_page(b->free[i]);
+	tlb_batch_init(b);
+}
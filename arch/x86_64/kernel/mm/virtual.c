@@ -38,15 +38,20 @@ pml4_t *create_initial_directory()
 	pml4_t *pml4 = (addr_t *)pm_alloc_page_zero();
 	memset(pml4, 0, 0x1000);
 	/* Identity map the kernel */
-	pml4[0] = pm_alloc_page_zero() | PAGE_PRESENT | PAGE_USER;
+	pml4[0] = pm_alloc_page_zero() | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
 	pdpt_t *pdpt = (addr_t *)(pml4[0] & PAGE_MASK);
-	pdpt[0] = pm_alloc_page_zero() | PAGE_PRESENT | PAGE_USER;
+	pdpt[0] = pm_alloc_page_zero() | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
 	page_dir_t *pd = (addr_t *)(pdpt[0] & PAGE_MASK);
 	
+	/* the kernel needs write access here once write protection is
+	 * enabled (see init_write_protect), except for the page that
+	 * the signal injector lives in */
 	addr_t address = 0;
 	for(int pdi = 0; pdi < 512; pdi++)
 	{
 		pd[pdi] = address | PAGE_PRESENT | PAGE_USER | (1 << 7);
+		if(!(SIGNAL_INJECT >= address && SIGNAL_INJECT < address + 0x200000))
+			pd[pdi] |= PAGE_WRITE;
 		address += 0x200000;
 	}
 
@@ -107,6 +112,11 @@ void vm_switch(addr_t *n/*VIRTUAL ADDRESS*/)
 	asm ("mov %0, %%cr3" : : "r" (n[PML4_IDX((PHYSICAL_PML4_INDEX/0x1000))]));
 }
 
+void copy_page_physical(addr_t src, addr_t dest)
+{
+	memcpy((void *)(dest + PHYS_PAGE_MAP), (void *)(src + PHYS_PAGE_MAP), PAGE_SIZE);
+}
+
 addr_t vm_do_getmap(addr_t v, addr_t *p, unsigned locked)
 {
 	addr_t vpage = (v&PAGE_MASK)/0x1000;
@@ -130,7 +140,7 @@ addr_t vm_do_getmap(addr_t v, addr_t *p, unsigned locked)
 		goto out;
 	if(pdpt[vpdpt] & PAGE_LARGE)
 	{
-		ret = pdpt[vpdpt] & PAGE_MASK;
+		ret = (pdpt[vpdpt] & PAGE_MASK & ~0x3FFFFFFFUL) + (v & 0x3FFFFFFF & PAGE_MASK);
 		goto out;
 	}
 	pd = (addr_t *)((pdpt[vpdpt]&PAGE_MASK) + PHYS_PAGE_MAP);
@@ -138,7 +148,7 @@ addr_t vm_do_getmap(addr_t v, addr_t *p, unsigned locked)
 		goto out;
 	if(pd[vdir] & PAGE_LARGE)
 	{
-		ret = pd[vdir] & PAGE_MASK;
+		ret = (pd[vdir] & PAGE_MASK & ~((addr_t)LARGE_PAGE_SIZE-1)) + (v & (LARGE_PAGE_SIZE-1) & PAGE_MASK);
 		goto out;
 	}
 	pt = (addr_t *)((pd[vdir]&PAGE_MASK) + PHYS_PAGE_MAP);
@@ -178,6 +188,15 @@ unsigned int vm_setattrib(addr_t v, short attr)
 	if(!pdpt[vpdpt])
 		pdpt[vpdpt] = pm_alloc_page_zero() | PAGE_PRESENT | PAGE_WRITE | (attr & PAGE_USER);
 	pd = (addr_t *)((pdpt[vpdpt]&PAGE_MASK) + PHYS_PAGE_MAP);
+	/* user large pages are split, so that single pages can be made
+	 * copy-on-write or read-only. Setting the same attributes again
+	 * (ignoring accessed and dirty) leaves them alone */
+	if((pd[vdir] & PAGE_LARGE) && !IS_KERN_MEM(v)) {
+		if(!((pd[vdir] ^ attr) & ATTRIB_MASK & ~(PAGE_LARGE | PAGE_DIRTY | 0x20)))
+			goto out;
+		vm_split_large(&pd[vdir]);
+		asm("invlpg (%0)"::"r" (v & ~((addr_t)LARGE_PAGE_SIZE-1)));
+	}
 	if(pd[vdir] & PAGE_LARGE)
 	{
 		pd[vdir] &= PAGE_MASK;
@@ -188,10 +207,14 @@ unsigned int vm_setattrib(addr_t v, short attr)
 		pd[vdir] = pm_alloc_page_zero() | PAGE_PRESENT | PAGE_WRITE | (attr & PAGE_USER);
 	pt = (addr_t *)((pd[vdir]&PAGE_MASK) + PHYS_PAGE_MAP);
 	
+	/* a copy-on-write page stays read-only until it is written to */
+	if(pt[vtbl] & PAGE_COW)
+		attr = (attr & ~PAGE_WRITE) | PAGE_COW;
 	pt[vtbl] &= PAGE_MASK;
 	pt[vtbl] |= attr;
 	out:
 	asm("invlpg (%0)"::"r" (v));
+	tlb_note_change(v);
 #if CONFIG_SMP && 0
 	if(kernel_task) {
 		if(IS_KERN_MEM(v))
@@ -4,6 +4,21 @@
 #include <isr.h>
 #include <task.h>
 #include <cpu.h>
+
+/* replace a 2MB mapping with a page table that maps the same pages, so
+ * that single pages in it can be changed. The caller must invalidate the
+ * old mapping */
+void vm_split_large(addr_t *pde)
+{
+	addr_t phys = *pde & PAGE_MASK & ~((addr_t)LARGE_PAGE_SIZE - 1);
+	unsigned attr = (*pde & ATTRIB_MASK) & ~PAGE_LARGE;
+	addr_t table = pm_alloc_page();
+	addr_t *entries = (addr_t *)(table + PHYS_PAGE_MAP);
+	for(int i=0;i<512;i++)
+		entries[i] = (phys + i * PAGE_SIZE) | attr;
+	*pde = table | PAGE_PRESENT | PAGE_WRITE | (attr & PAGE_USER);
+}
+
 int vm_map(addr_t virt, addr_t phys, unsigned attr, unsigned opt)
 {
 	addr_t vpage = (virt&PAGE_MASK)/0x1000;
@@ -19,34 +34,83 @@ int vm_map(addr_t virt, addr_t phys, unsigned attr, unsigned opt)
 	pml4_t *pml4;
 	
 	pml4 = (pml4_t *)((kernel_task && current_task) ? current_task->pd : kernel_dir);
+	/* the tables may have been created for kernel-only pages, in which
+	 * case a user page needs them opened up */
 	if(!pml4[vp4])
-		pml4[vp4] = pm_alloc_page_zero() | PAGE_PRESENT | PAGE_WRITE | (attr & PAGE_USER);
+		pml4[vp4] = pm_alloc_page_zero() | PAGE_PRESENT | PAGE_WRITE;
+	pml4[vp4] |= attr & PAGE_USER;
 	pdpt = (addr_t *)((pml4[vp4]&PAGE_MASK) + PHYS_PAGE_MAP);
 	if(!pdpt[vpdpt])
-		pdpt[vpdpt] = pm_alloc_page_zero() | PAGE_PRESENT | PAGE_WRITE | (attr & PAGE_USER);
+		pdpt[vpdpt] = pm_alloc_page_zero() | PAGE_PRESENT | PAGE_WRITE;
+	pdpt[vpdpt] |= attr & PAGE_USER;
 	pd = (addr_t *)((pdpt[vpdpt]&PAGE_MASK) + PHYS_PAGE_MAP);
 	if(!pd[vdir])
-		pd[vdir] = pm_alloc_page_zero() | PAGE_PRESENT | PAGE_WRITE | (attr & PAGE_USER);
+		pd[vdir] = pm_alloc_page_zero() | PAGE_PRESENT | PAGE_WRITE;
+	else if(pd[vdir] & PAGE_LARGE)
+		vm_split_large(&pd[vdir]);
+	pd[vdir] |= attr & PAGE_USER;
 	pt = (addr_t *)((pd[vdir]&PAGE_MASK) + PHYS_PAGE_MAP);
 	
+	/* entries that weren't present can't be in any tlb */
+	addr_t old = pt[vtbl];
 	pt[vtbl] = (phys & PAGE_MASK) | attr;
-	asm("invlpg (%0)"::"r" (virt));
+	if(old)
+		tlb_flush_page(virt);
 	if(!(opt & MAP_NOCLEAR)) 
 		memset((void *)(virt&PAGE_MASK), 0, 0x1000);
 	
-	#if CONFIG_SMP
-	if(kernel_task) {
-		if(IS_KERN_MEM(virt))
-			send_ipi(LAPIC_ICR_SHORT_OTHERS, 0, LAPIC_ICR_LEVELASSERT | LAPIC_ICR_TM_LEVEL | IPI_TLB);
-		else if((IS_THREAD_SHARED_MEM(virt) && pd_cur_data->count > 1))
-			send_ipi(LAPIC_ICR_SHORT_OTHERS, 0, LAPIC_ICR_LEVELASSERT | LAPIC_ICR_TM_LEVEL | IPI_TLB);
-	}
-	#endif
 	if(kernel_task && !(opt & MAP_PDLOCKED))
 		mutex_release(&pd_cur_data->lock);
 	return 0;
 }
 
+/* map a 2MB page. Both addresses must be aligned to LARGE_PAGE_SIZE.
+ * Returns -EEXIST if any page in the range is mapped already */
+int vm_map_large(addr_t virt, addr_t phys, unsigned attr, unsigned opt)
+{
+	assert(!(virt & (LARGE_PAGE_SIZE-1)) && !(phys & (LARGE_PAGE_SIZE-1)));
+	addr_t vpage = virt/0x1000;
+	unsigned vp4 = PML4_IDX(vpage);
+	unsigned vpdpt = PDPT_IDX(vpage);
+	unsigned vdir = PAGE_DIR_IDX(vpage);
+	int ret = 0;
+	addr_t table = 0;
+	if(kernel_task && !(opt & MAP_PDLOCKED))
+		mutex_acquire(&pd_cur_data->lock);
+	pml4_t *pml4 = (pml4_t *)((kernel_task && current_task) ? current_task->pd : kernel_dir);
+	if(!pml4[vp4])
+		pml4[vp4] = pm_alloc_page_zero() | PAGE_PRESENT | PAGE_WRITE;
+	pml4[vp4] |= attr & PAGE_USER;
+	pdpt_t *pdpt = (addr_t *)((pml4[vp4]&PAGE_MASK) + PHYS_PAGE_MAP);
+	if(!pdpt[vpdpt])
+		pdpt[vpdpt] = pm_alloc_page_zero() | PAGE_PRESENT | PAGE_WRITE;
+	pdpt[vpdpt] |= attr & PAGE_USER;
+	page_dir_t *pd = (addr_t *)((pdpt[vpdpt]&PAGE_MASK) + PHYS_PAGE_MAP);
+	if(pd[vdir] & PAGE_LARGE)
+		ret = -EEXIST;
+	else if(pd[vdir]) {
+		/* a page table that's left over from pages that have since
+		 * been unmapped can go, once it's out of the tlb */
+		table = pd[vdir] & PAGE_MASK;
+		page_table_t *pt = (addr_t *)(table + PHYS_PAGE_MAP);
+		for(int i=0;i<512 && !ret;i++) {
+			if(pt[i])
+				ret = -EEXIST;
+		}
+	}
+	if(!ret) {
+		pd[vdir] = phys | attr | PAGE_LARGE;
+		tlb_flush_page(virt);
+		if(!(opt & MAP_NOCLEAR))
+			memset((void *)virt, 0, LARGE_PAGE_SIZE);
+	}
+	if(kernel_task && !(opt & MAP_PDLOCKED))
+		mutex_release(&pd_cur_data->lock);
+	if(!ret && table)
+		pm_free_page(table);
+	return ret;
+}
+
 int vm_early_map(pml4_t *pml4, addr_t virt, addr_t phys, unsigned attr, unsigned opt)
 {
 	addr_t vpage = (virt&PAGE_MASK)/0x1000;
@@ -59,14 +123,19 @@ int vm_early_map(pml4_t *pml4, addr_t virt, addr_t phys, unsigned attr, unsigned
 	page_table_t *pt;
 	pdpt_t *pdpt;
 
+	/* the tables may have been created for kernel-only pages, in which
+	 * case a user page needs them opened up */
 	if(!pml4[vp4])
-		pml4[vp4] = pm_alloc_page_zero() | PAGE_PRESENT | PAGE_WRITE | (attr & PAGE_USER);
+		pml4[vp4] = pm_alloc_page_zero() | PAGE_PRESENT | PAGE_WRITE;
+	pml4[vp4] |= attr & PAGE_USER;
 	pdpt = (addr_t *)((pml4[vp4]&PAGE_MASK) + PHYS_PAGE_MAP);
 	if(!pdpt[vpdpt])
-		pdpt[vpdpt] = pm_alloc_page_zero() | PAGE_PRESENT | PAGE_WRITE | (attr & PAGE_USER);
+		pdpt[vpdpt] = pm_alloc_page_zero() | PAGE_PRESENT | PAGE_WRITE;
+	pdpt[vpdpt] |= attr & PAGE_USER;
 	pd = (addr_t *)((pdpt[vpdpt]&PAGE_MASK) + PHYS_PAGE_MAP);
 	if(!pd[vdir])
-		pd[vdir] = pm_alloc_page_zero() | PAGE_PRESENT | PAGE_WRITE | (attr & PAGE_USER);
+		pd[vdir] = pm_alloc_page_zero() | PAGE_PRESENT | PAGE_WRITE;
+	pd[vdir] |= attr & PAGE_USER;
 	pt = (addr_t *)((pd[vdir]&PAGE_MASK) + PHYS_PAGE_MAP);
 	
 	pt[vtbl] = (phys & PAGE_MASK) | attr;
@@ -6,13 +6,8 @@
 #include <swap.h>
 #include <cpu.h>
 
-/* send the TBL shootdown to cpus if:
- *  - tasking is enabled
- *  - either:
- * 	  - this is kernel memory
- *    - OR this is shared threading memory, and there is another thread
- *  - BUT NOT if we are unmapping the pd_cur_data page
- */
+/* the tlb is flushed by tlb_flush_page (see tlb.c), except for the
+ * pd_cur_data page, which is different in every directory */
 
 int vm_do_unmap_only(addr_t virt, unsigned locked)
 {
@@ -41,18 +36,15 @@ int vm_do_unmap_only(addr_t virt, unsigned locked)
 	pd = (addr_t *)((pdpt[vpdpt]&PAGE_MASK) + PHYS_PAGE_MAP);
 	if(!pd[vdir])
 		pd[vdir] = pm_alloc_page() | PAGE_PRESENT | PAGE_WRITE;
+	else if(pd[vdir] & PAGE_LARGE)
+		vm_split_large(&pd[vdir]);
 	pt = (addr_t *)((pd[vdir]&PAGE_MASK) + PHYS_PAGE_MAP);
 	
 	pt[vtbl] = 0;
-	asm("invlpg (%0)"::"r" (virt));
-	#if CONFIG_SMP
-	if(kernel_task && (virt&PAGE_MASK) != PDIR_DATA) {
-		if(IS_KERN_MEM(virt))
-			send_ipi(LAPIC_ICR_SHORT_OTHERS, 0, LAPIC_ICR_LEVELASSERT | LAPIC_ICR_TM_LEVEL | IPI_TLB);
-		else if((IS_THREAD_SHARED_MEM(virt) && pd_cur_data->count > 1))
-			send_ipi(LAPIC_ICR_SHORT_OTHERS, 0, LAPIC_ICR_LEVELASSERT | LAPIC_ICR_TM_LEVEL | IPI_TLB);
-	}
-	#endif
+	if((virt&PAGE_MASK) == PDIR_DATA) {
+		asm("invlpg (%0)"::"r" (virt));
+	} else
+		tlb_flush_page(virt);
 	if(kernel_task && (virt&PAGE_MASK) != PDIR_DATA && !locked)
 		mutex_release(&pd_cur_data->lock);
 	return 0;
@@ -87,22 +79,90 @@ int vm_do_unmap(addr_t virt, unsigned locked)
 	pd = (addr_t *)((pdpt[vpdpt]&PAGE_MASK) + PHYS_PAGE_MAP);
 	if(!pd[vdir])
 		pd[vdir] = pm_alloc_page() | PAGE_PRESENT | PAGE_WRITE;
+	else if(pd[vdir] & PAGE_LARGE)
+		vm_split_large(&pd[vdir]);
 	pt = (addr_t *)((pd[vdir]&PAGE_MASK) + PHYS_PAGE_MAP);
 	
 	addr_t p = pt[vtbl];
 	pt[vtbl] = 0;
-	asm("invlpg (%0)"::"r" (virt));
-	#if CONFIG_SMP
-	if(kernel_task && (virt&PAGE_MASK) != PDIR_DATA) {
-		if(IS_KERN_MEM(virt))
-			send_ipi(LAPIC_ICR_SHORT_OTHERS, 0, LAPIC_ICR_LEVELASSERT | LAPIC_ICR_TM_LEVEL | IPI_TLB);
-		else if((IS_THREAD_SHARED_MEM(virt) && pd_cur_data->count > 1))
-			send_ipi(LAPIC_ICR_SHORT_OTHERS, 0, LAPIC_ICR_LEVELASSERT | LAPIC_ICR_TM_LEVEL | IPI_TLB);
-	}
-	#endif
+	if((virt&PAGE_MASK) == PDIR_DATA) {
+		asm("invlpg (%0)"::"r" (virt));
+	} else
+		tlb_flush_page(virt);
 	if(kernel_task && (virt&PAGE_MASK) != PDIR_DATA && !locked)
 		mutex_release(&pd_cur_data->lock);
-	if(p && !(p & PAGE_COW))
+	if(p)
 		pm_free_page(p & PAGE_MASK);
 	return 0;
 }
+
+/* unmap and free a 2MB page mapped by vm_map_large. Returns 0 if virt
+ * isn't mapped by one */
+int vm_unmap_large(addr_t virt)
+{
+	addr_t vpage = virt/0x1000;
+	unsigned vp4 = PML4_IDX(vpage);
+	unsigned vpdpt = PDPT_IDX(vpage);
+	unsigned vdir = PAGE_DIR_IDX(vpage);
+	addr_t p = 0;
+	if(kernel_task)
+		mutex_acquire(&pd_cur_data->lock);
+	pml4_t *pml4 = (pml4_t *)((kernel_task && current_task) ? current_task->pd : kernel_dir);
+	if(!pml4[vp4])
+		goto out;
+	pdpt_t *pdpt = (addr_t *)((pml4[vp4]&PAGE_MASK) + PHYS_PAGE_MAP);
+	if(!pdpt[vpdpt] || (pdpt[vpdpt] & PAGE_LARGE))
+		goto out;
+	page_dir_t *pd = (addr_t *)((pdpt[vpdpt]&PAGE_MASK) + PHYS_PAGE_MAP);
+	if(!(pd[vdir] & PAGE_LARGE))
+		goto out;
+	p = pd[vdir] & PAGE_MASK & ~((addr_t)LARGE_PAGE_SIZE-1);
+	pd[vdir] = 0;
+	tlb_flush_page(virt);
+	out:
+	if(kernel_task)
+		mutex_release(&pd_cur_data->lock);
+	if(p)
+		pm_free_pages(p, LARGE_PAGE_ORDER);
+	return p ? 1 : 0;
+}
+
+/* like vm_unmap, but the flush and the freeing of the page are left to
+ * tlb_batch_flush. Returns 0 if nothing was mapped at virt */
+int vm_unmap_batch(addr_t virt, struct tlb_batch *b)
+{
+	#if CONFIG_SWAP
+	if(current_task && num_swapdev && current_task->num_swapped)
+		swap_in_page((task_t *)current_task, virt & PAGE_MASK);
+	#endif
+	addr_t vpage = (virt&PAGE_MASK)/0x1000;
+	unsigned vp4 = PML4_IDX(vpage);
+	unsigned vpdpt = PDPT_IDX(vpage);
+	unsigned vdir = PAGE_DIR_IDX(vpage);
+	unsigned vtbl = PAGE_TABLE_IDX(vpage);
+	addr_t p = 0;
+	assert((virt&PAGE_MASK) != PDIR_DATA);
+	if(kernel_task)
+		mutex_acquire(&pd_cur_data->lock);
+	pml4_t *pml4 = (pml4_t *)((kernel_task && current_task) ? current_task->pd : kernel_dir);
+	if(!pml4[vp4])
+		goto out;
+	pdpt_t *pdpt = (addr_t *)((pml4[vp4]&PAGE_MASK) + PHYS_PAGE_MAP);
+	if(!pdpt[vpdpt] || (pdpt[vpdpt] & PAGE_LARGE))
+		goto out;
+	page_dir_t *pd = (addr_t *)((pdpt[vpdpt]&PAGE_MASK) + PHYS_PAGE_MAP);
+	if(!pd[vdir])
+		goto out;
+	if(pd[vdir] & PAGE_LARGE)
+		vm_split_large(&pd[vdir]);
+	page_table_t *pt = (addr_t *)((pd[vdir]&PAGE_MASK) + PHYS_PAGE_MAP);
+	p = pt[vtbl];
+	pt[vtbl] = 0;
+	out:
+	if(kernel_task)
+		mutex_release(&pd_cur_data->lock);
+	if(!p)
+		return 0;
+	tlb_batch_add(b, virt, p & PAGE_MASK);
+	return 1;
+}
@@ -13,6 +13,13 @@ static void write_msr(unsigned msr, unsigned lo, unsigned hi)
    asm ("wrmsr"::"a"(lo),"d"(hi),"c"(msr));
 }
 
+static inline unsigned long long read_tsc()
+{
+	unsigned lo, hi;
+	__asm__ __volatile__("rdtsc":"=a"(lo),"=d"(hi));
+	return ((unsigned long long)hi << 32) | lo;
+}
+
 #define nop() __sync_synchronize();__asm__ __volatile__ ("nop")
 int set_int(unsigned new);
 extern char tables;
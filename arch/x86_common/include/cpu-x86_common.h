@@ -71,6 +71,7 @@
 
 #define CR0_EM          (1 << 2)
 #define CR0_MP          (1 << 1)
+#define CR0_WP          (1 << 16)
 #define CR4_OSFXSR      (1 << 9)
 #define CR4_OSXMMEXCPT  (1 << 10)
 
@@ -79,6 +80,9 @@
    (*((volatile unsigned *) (lapic_addr+(x))) = (y))
 extern addr_t lapic_addr;
 extern unsigned lapic_timer_start;
+unsigned set_lapic_timer_oneshot(unsigned nticks);
+unsigned read_lapic_timer();
+void restore_lapic_timer();
 extern mutex_t ipi_mutex;
 
 #define current_tss (&((cpu_t *)current_task->cpu)->tss)
@@ -90,6 +90,11 @@ typedef struct
 #define PH_DYNAMIC 2
 #define PH_INTERP  3
 
+/* program header flags */
+#define PH_FLAG_X 1
+#define PH_FLAG_W 2
+#define PH_FLAG_R 4
+
 
 #define EDT_NEEDED   1
 #define EDT_PLTRELSZ 2
@@ -7,7 +7,10 @@
 #define PAGE_USER      0x4
 #define PAGE_WRITECACHE 0x8
 #define PAGE_NOCACHE   0x10
+#define PAGE_DIRTY     0x40
 #define PAGE_COW       512
+/* MAP_SHARED pages stay shared (and writable) across fork */
+#define PAGE_SHARED    1024
 #define PAGE_SIZE 	   0x1000
 
 #define MAP_NOIPI     0x8
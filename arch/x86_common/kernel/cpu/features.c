@@ -33,3 +33,31 @@ void init_sse(cpu_t *me)
 	if(me->cpuid.features_edx & (1 << 24))
 		me->flags |= CPU_FXSAVE;
 }
+
+/* make the kernel respect read-only pages too. Copy-on-write depends on
+ * this, since the kernel writes to user memory on behalf of tasks. This
+ * must only be called once the kernel's own mappings are writable */
+void init_write_protect(cpu_t *me)
+{
+	unsigned long cr0;
+	asm("mov %%cr0, %0;":"=r"(cr0));
+	cr0 |= CR0_WP;
+	asm("mov %0, %%cr0;"::"r"(cr0));
+}
+
+#if CONFIG_ARCH == TYPE_ARCH_X86_64
+/* tag tlb entries with the address space they belong to, so that they
+ * survive switches between tasks (see tlb.c). cr3 must not have a pcid
+ * in it yet */
+void init_pcid(cpu_t *me)
+{
+	if(!(me->cpuid.features_ecx & CPU_FEATURES_ECX_PCID))
+		return;
+	unsigned long cr4;
+	asm("mov %%cr4, %0;":"=r"(cr4));
+	cr4 |= CR4_PCIDE;
+	asm("mov %0, %%cr4;"::"r"(cr4));
+	me->flags |= CPU_PCID;
+	tlb_pcid_enabled = 1;
+}
+#endif
@@ -61,8 +61,13 @@ void handle_ipi_reschedule(volatile registers_t regs)
 
 void handle_ipi_tlb(volatile registers_t regs)
 {
+#if CONFIG_ARCH == TYPE_ARCH_X86_64
+	/* flush what the sender asked for (see tlb.c) */
+	tlb_handle_ipi();
+#else
 	/* flush the TLB */
 	flush_pd();
+#endif
 }
 
 void handle_ipi_tlb_ack(volatile registers_t regs)
@@ -267,6 +267,8 @@ void entry_syscall_handler(volatile registers_t regs)
 			mutex_release(&s2_lock);
 		}
 		assert(!get_cpu_interrupt_flag());
+		/* a task we woke up may need to run before we go back */
+		resched_if_needed();
 	}
 	assert(!set_int(0));
 	current_task->sysregs=0;
@@ -405,6 +407,10 @@ void irq_handler(volatile registers_t regs)
 		mutex_release(&s2_lock);
 		assert(!get_cpu_interrupt_flag());
 	}
+	/* if the handler woke up a task that should run before the one we
+	 * interrupted, switch to it now */
+	if(!already_in_interrupt)
+		resched_if_needed();
 	/* ok, now lets clean up */
 	assert(!set_int(0));
 	/* clear the registers if we saved the ones from this interrupt */
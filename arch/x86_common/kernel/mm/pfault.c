@@ -4,6 +4,7 @@
 #include <task.h>
 #include <swap.h>
 #include <elf.h>
+#include <exec.h>
 void print_pfe(int x, registers_t *regs, addr_t cr2)
 {
 	assert(regs);
@@ -50,6 +51,32 @@ int map_in_page(unsigned long cr2, unsigned err_code)
 	return 0;
 }
 
+/* a write to a page that is shared copy-on-write (see vm_clone). If the
+ * other address spaces have let go of the page already we can just make
+ * it writable again, otherwise the writer gets its own copy */
+int pfault_cow(addr_t cr2, unsigned err_code)
+{
+	if((err_code & 3) != 3)
+		return 0;
+	addr_t addr = cr2 & PAGE_MASK, phys;
+	unsigned attr;
+	mutex_acquire(&pd_cur_data->lock);
+	if(!vm_do_getmap(addr, &phys, 1) || !(vm_do_getattrib(addr, &attr, 1) & PAGE_COW)) {
+		mutex_release(&pd_cur_data->lock);
+		return 0;
+	}
+	attr = (attr & ~PAGE_COW) | PAGE_WRITE;
+	if(pm_page_is_shared(phys)) {
+		addr_t page = pm_alloc_page();
+		copy_page_physical(phys, page);
+		vm_map(addr, page, attr, MAP_CRIT | MAP_PDLOCKED | MAP_NOCLEAR);
+		pm_free_page(phys);
+	} else
+		vm_map(addr, phys, attr, MAP_CRIT | MAP_PDLOCKED | MAP_NOCLEAR);
+	mutex_release(&pd_cur_data->lock);
+	return 1;
+}
+
 void page_fault(registers_t *regs)
 {
 	current_task->regs=0;
@@ -68,7 +95,11 @@ void page_fault(registers_t *regs)
 		}
 		#endif
 		
-		if(pfault_mmf_check(err_code, cr2))
+		if(pfault_cow(cr2, err_code))
+			return;
+		if(exec_image_fault(cr2, err_code, 1))
+			return;
+		if(pfault_mmf_check(err_code, cr2, 1))
 			return;
 		print_pfe(0, regs, cr2);
 		mutex_acquire(&pd_cur_data->lock);
@@ -85,6 +116,13 @@ void page_fault(registers_t *regs)
 		kill_task(current_task->pid);
 		return;
 	}
+	/* the kernel accessing user memory on behalf of a task */
+	if(current_task && pfault_cow(cr2, err_code))
+		return;
+	if(current_task && exec_image_fault(cr2, err_code, regs->eflags & 0x200))
+		return;
+	if(current_task && pfault_mmf_check(err_code, cr2, regs->eflags & 0x200))
+		return;
 	print_pfe(5, regs, cr2);
 	if(!current_task) {
 		if(kernel_task)
@@ -8,8 +8,12 @@
 #include <atomic.h>
 #include <types.h>
 #include <mount.h>
+#include <rcu.h>
 
-struct llist *fslist;
+/* get_fs is called for every operation, so it doesn't take fslist_lock.
+ * The list is protected by rcu instead */
+ext2_fs_t *fslist=0;
+mutex_t fslist_lock;
 unsigned fs_num=0;
 
 ext2_fs_t *get_new_fsvol()
@@ -27,31 +31,34 @@ ext2_fs_t *get_new_fsvol()
 	char tm[32];
 	sprintf(tm, "ext2-%d", fs_num);
 	fs->cache = get_empty_cache(0, tm);
-	fs->llnode = ll_insert(fslist, fs);
+	mutex_acquire(&fslist_lock);
+	fs->next = fslist;
+	rcu_assign_pointer(fslist, fs);
+	mutex_release(&fslist_lock);
 	return fs;
 }
 
 ext2_fs_t *get_fs(int v)
 {
-	rwlock_acquire(&fslist->rwl, RWL_READER);
-	struct llistnode *cur;
-	ext2_fs_t *f;
-	ll_for_each_entry(fslist, cur, ext2_fs_t *, f)
-	{
-		if(f->flag == v)
-		{
-			rwlock_release(&fslist->rwl, RWL_READER);
-			return f;
-		}
-	}
-	rwlock_release(&fslist->rwl, RWL_READER);
-	return 0;
+	int old = rcu_read_lock();
+	ext2_fs_t *f = rcu_dereference(fslist);
+	while(f && f->flag != v)
+		f = rcu_dereference(f->next);
+	rcu_read_unlock(old);
+	return f;
 }
 
 void release_fsvol(ext2_fs_t *fs)
 {
 	if(!fs) return;
-	ll_remove_entry(fslist, fs);
+	mutex_acquire(&fslist_lock);
+	ext2_fs_t **p = &fslist;
+	while(*p && *p != fs)
+		p = &(*p)->next;
+	if(*p)
+		*p = fs->next;
+	mutex_release(&fslist_lock);
+	synchronize_rcu();
 	kfree(fs->sb);
 	fs->m_node->pid=-1;
 	fs->m_block->pid=-1;
@@ -148,7 +155,7 @@ int ext2_unmount(struct inode *i, int v)
 int module_install()
 {
 	printk(1, "[ext2]: Registering filesystem\n");
-	fslist = ll_create(0);
+	mutex_create(&fslist_lock, 0);
 	register_sbt("ext2", 2, (int (*)(dev_t,u64,char*))ext2_mount);
 	return 0;
 }
@@ -156,19 +163,10 @@ int module_install()
 int module_exit()
 {
 	printk(1, "[ext2]: Unmounting all ext2 filesystems\n");
-	int i=0;
 	unregister_sbt("ext2");
-	if(ll_is_active(fslist)) 
-	{
-		struct llistnode *cur, *next;
-		ext2_fs_t *f=0;
-		ll_for_each_entry_safe(fslist, cur, next, ext2_fs_t *, f);
-		{
-			if(f)
-				ext2_unmount(0, f->flag);
-		}
-	}
-	ll_destroy(fslist);
+	while(fslist)
+		ext2_unmount(0, fslist->flag);
+	mutex_destroy(&fslist_lock);
 	return 0;
 }
 
@@ -0,0 +1,110 @@
+/* lockbench.c - stress test for spinning (MT_NOSCHED) mutexes
+ * Loading this module runs a number of rounds with an increasing number
+ * of tasks that all hammer the same mutex, and prints how long it took
+ * on average (and at worst) to acquire it, in cycles. The tasks are
+ * forked onto different cpus, so with n tasks up to n cpus contend for
+ * the lock.
+ */
+#include <kernel.h>
+#include <task.h>
+#include <cpu.h>
+#include <mutex.h>
+#include <atomic.h>
+
+#define LB_MAX_TASKS 16
+#define LB_ITER_SHIFT 14
+#define LB_ITERS (1 << LB_ITER_SHIFT)
+
+static mutex_t lb_lock;
+static volatile int lb_go, lb_ready;
+static volatile unsigned long lb_shared;
+static unsigned lb_avg[LB_MAX_TASKS], lb_worst[LB_MAX_TASKS];
+static void *lb_cpu[LB_MAX_TASKS];
+
+static inline unsigned long long lb_rdtsc()
+{
+	unsigned lo, hi;
+	__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((unsigned long long)hi << 32) | lo;
+}
+
+static void lb_worker(int id)
+{
+	unsigned long long total=0;
+	unsigned worst=0;
+	lb_cpu[id] = current_task->cpu;
+	add_atomic(&lb_ready, 1);
+	while(!lb_go)
+		schedule();
+	for(int i=0;i<LB_ITERS;i++) {
+		/* holders of these locks always have interrupts off, and we
+		 * don't want to measure the timer handler */
+		int old = set_int(0);
+		unsigned long long start = lb_rdtsc();
+		mutex_acquire(&lb_lock);
+		unsigned t = (unsigned)(lb_rdtsc() - start);
+		lb_shared++;
+		mutex_release(&lb_lock);
+		set_int(old);
+		total += t;
+		if(t > worst)
+			worst = t;
+	}
+	lb_avg[id] = (unsigned)(total >> LB_ITER_SHIFT);
+	lb_worst[id] = worst;
+	exit(0);
+}
+
+static void lb_round(int n)
+{
+	int pids[LB_MAX_TASKS];
+	int i, j, cpus=0;
+	lb_go = lb_ready = 0;
+	lb_shared = 0;
+	for(i=0;i<n;i++) {
+		pids[i] = do_fork(0);
+		if(!pids[i])
+			lb_worker(i);
+		if(pids[i] < 0)
+			break;
+	}
+	if(!(n = i))
+		return;
+	while(lb_ready < n)
+		schedule();
+	lb_go = 1;
+	unsigned avg=0, worst=0;
+	for(i=0;i<n;i++) {
+		sys_waitpid(pids[i], 0, 0);
+		avg += lb_avg[i];
+		if(lb_worst[i] > worst)
+			worst = lb_worst[i];
+		for(j=0;j<i && lb_cpu[j] != lb_cpu[i];j++);
+		if(j == i)
+			cpus++;
+	}
+	if(lb_shared != (unsigned long)n * LB_ITERS)
+		printk(0, "[lockbench]: lost updates (%d of %d)!\n", lb_shared, n * LB_ITERS);
+	printk(0, "[lockbench]: %d tasks on %d cpus: avg %d cycles, worst %d cycles\n",
+			n, cpus, avg / n, worst);
+}
+
+int module_install()
+{
+	mutex_create(&lb_lock, MT_NOSCHED);
+	printk(0, "[lockbench]: %d acquisitions per task\n", LB_ITERS);
+	for(int n=1;n<=LB_MAX_TASKS;n*=2)
+		lb_round(n);
+	mutex_destroy(&lb_lock);
+	return 0;
+}
+
+int module_exit()
+{
+	return 0;
+}
+
+int module_deps(char *b)
+{
+	return KVERSION;
+}
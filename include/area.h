@@ -3,21 +3,31 @@
 #include <mutex.h>
 #include <types.h>
 
+/* the allocated regions are kept in an AVL tree sorted by address. Each
+ * node also knows how many free pages there are between it and the
+ * region before it, and the largest such gap in its subtree, so that a
+ * free range can be found without looking at every region */
 typedef struct vmem_node {
 	addr_t addr;
 	unsigned num_pages;
-	struct vmem_node *next;
+	unsigned gap, max_gap;
+	int height;
+	struct vmem_node *left, *right, *parent;
 } vnode_t;
 
-/* {[Index][...data...]}*/
+/* {[Index][...data...]}
+ * The nodes live in the index pages, which are mapped as they're needed.
+ * Since they are inside the area itself, a copy of the area's address
+ * space (fork) gets a working copy of the tree */
 typedef struct vmem_area {
 	addr_t addr;
 	unsigned num_ipages;
 	mutex_t lock;
 	addr_t max;
-	/* This is the last PHYSICAL node */
-	vnode_t *first;
-	unsigned char nodes[MAX_NODES];
+	vnode_t *root;
+	/* freed node slots, and the number of slots ever handed out */
+	vnode_t *free_nodes;
+	unsigned num_nodes;
 	unsigned used_nodes;
 } vma_t;
 
@@ -8,5 +8,7 @@
 
 #define and_atomic(ptr, v) (__sync_and_and_fetch(ptr, v))
 #define or_atomic(ptr, v) (__sync_or_and_fetch(ptr, v))
+/* set *ptr to n if it is o. Returns true if it was */
+#define cas_atomic(ptr, o, n) (__sync_bool_compare_and_swap(ptr, o, n))
 
 #endif
@@ -0,0 +1,57 @@
+#ifndef _BUDDY_H
+#define _BUDDY_H
+
+#include <types.h>
+
+/* blocks of up to 2^(PM_MAX_ORDER-1) pages are handed out */
+#define PM_MAX_ORDER 11
+
+/* memory below this is kept for things that need low addresses (ISA DMA) */
+#define PM_DMA_LIMIT 0x1000000
+
+#define PM_ZONE_DMA    0
+#define PM_ZONE_NORMAL 1
+#define PM_NUM_ZONES   2
+
+/* flags for pm_alloc_pages */
+#define PM_DMA 1
+#define PM_TRY 2 /* just return 0 if there isn't a free block */
+
+#define PFN_NONE (~0U)
+
+/* one of these exists for every physical page, in an array at
+ * PM_FRAMES_ADDR indexed by page frame number */
+#define PF_RAM  1 /* usable memory, managed by the buddy allocator */
+#define PF_FREE 2 /* first page of a free block of 2^order pages */
+struct page_frame {
+	u32 next, prev;
+	unsigned char order;
+	unsigned char flags;
+	/* how many more address spaces map this page copy-on-write */
+	int count;
+};
+
+struct pm_zone {
+	u32 free_list[PM_MAX_ORDER];
+	unsigned num_free[PM_MAX_ORDER];
+	unsigned long free_pages;
+};
+
+/* each cpu keeps a few free pages so that allocating and freeing single
+ * pages usually doesn't need pm_mutex */
+#define PM_CPU_PAGES 64
+#define PM_CPU_BATCH 16
+struct pm_cpu_pages {
+	unsigned num;
+	addr_t pages[PM_CPU_PAGES];
+};
+
+#define pm_alloc_pages(order, flags) __pm_alloc_pages(order, flags, __FILE__, __LINE__)
+
+void pm_init_frames(addr_t highest);
+addr_t __pm_alloc_pages(unsigned order, unsigned flags, char *file, int line);
+void pm_free_pages(addr_t addr, unsigned order);
+int pm_page_share(addr_t addr);
+int pm_page_is_shared(addr_t addr);
+
+#endif
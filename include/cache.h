@@ -3,6 +3,7 @@
 
 #include <rwlock.h>
 #include <ll.h>
+#include <shrink.h>
 
 typedef struct chash_chain_s {
 	void *ptr;
@@ -35,6 +36,7 @@ typedef struct cache_t_s {
 	rwlock_t *rwl;
 	char name[32];
 	struct llist dirty_ll, primary_ll;
+	struct shrinker shrinker;
 	struct cache_t_s *next, *prev;
 } cache_t;
 
@@ -30,10 +30,11 @@
 #define KMALLOC_INIT slab_init
 #define KMALLOC_ALLOC do_kmalloc_slab
 #define KMALLOC_FREE  do_kfree_slab
+#define KMALLOC_CPU_ALLOC slab_cpu_alloc
+#define KMALLOC_CPU_FREE  slab_cpu_free
 #define KMALLOC_NAME ((char *)"slab")
 
 /* MM */
-#define MAX_NODES 4096*4
 //#define SLAB_DEBUG
 #define RANGE_MUL 2
 #define STACK_SIZE (CONFIG_STACK_PAGES * 0x1000)
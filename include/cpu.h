@@ -3,6 +3,7 @@
 #include <types.h>
 #include <memory.h>
 #include <tqueue.h>
+#include <runqueue.h>
 #include <task.h>
 #include <mutex.h>
 #include <config.h>
@@ -26,6 +27,9 @@
 #define CPU_TASK   0x80
 #define CPU_LOCK  0x100
 #define CPU_FXSAVE 0x200
+#define CPU_NOHZ   0x400 /* halted with the periodic tick stopped */
+#define CPU_RESCHED 0x800 /* a task that should preempt cur was woken up */
+#define CPU_PCID  0x1000 /* tlb entries are tagged with their address space */
 
 typedef struct __cpu_t__ {
 	unsigned num;
@@ -34,8 +38,10 @@ typedef struct __cpu_t__ {
 	int apicid;
 	volatile page_dir_t *kd;
 	addr_t kd_phys;
-	tqueue_t *active_queue;
+	runqueue_t *active_queue;
 	task_t *ktask, *cur;
+	/* the task we're switching away from, until we're off of its stack */
+	task_t *volatile prev_task;
 	mutex_t lock;
 #if CONFIG_ARCH == TYPE_ARCH_X86 || CONFIG_ARCH == TYPE_ARCH_X86_64
 	gdt_entry_t gdt[NUM_GDT_ENTRIES];
@@ -43,6 +49,27 @@ typedef struct __cpu_t__ {
 	tss_entry_t tss;
 #endif
 	unsigned numtasks;
+	/* load balancing (see balance.c) */
+	unsigned long next_balance, last_idle_balance;
+	unsigned migrations_in, migrations_out;
+	unsigned nohz_count;
+	/* wakeup statistics (see sched_wakeup). Latencies are in cycles */
+	unsigned wakeups, wakeup_ipis;
+	unsigned long long wakeup_lat_total, wakeup_lat_max;
+	/* rcu readers running on this cpu (see rcu.h) */
+	volatile unsigned rcu_readers;
+	/* tlb flushes that other cpus have asked of this one, and the
+	 * address space and directory it has loaded (see tlb.c) */
+	volatile unsigned tlb_lock;
+	addr_t tlb_start, tlb_end;
+	struct pd_data *tlb_space;
+	addr_t tlb_pml4, tlb_cr3;
+#if CONFIG_ARCH == TYPE_ARCH_X86_64
+	struct tlb_pcid tlb_pcids[TLB_NUM_PCIDS];
+	unsigned tlb_pcid_next;
+#endif
+	struct slab_cpu_cache slab_cache[SLAB_NUM_MAGS];
+	struct pm_cpu_pages pm_pages;
 	unsigned stack[CPU_STACK_TEMP_SIZE];
 	struct __cpu_t__ *next, *prev;
 } cpu_t;
@@ -52,10 +79,18 @@ cpu_t *add_cpu(cpu_t *c);
 extern cpu_t *primary_cpu;
 extern cpu_t cpu_array[CONFIG_MAX_CPUS];
 extern unsigned cpu_array_num;
+#if CONFIG_SMP
+#define cpu_index(c) ((unsigned)((cpu_t *)(c) - cpu_array))
+#define task_cpu_allowed(t,c) cpu_mask_test((t)->cpu_mask, cpu_index(c))
+#endif
 extern volatile unsigned num_halted_cpus;
 void parse_cpuid(cpu_t *);
 void init_sse(cpu_t *);
 void setup_fpu(cpu_t *);
+void init_write_protect(cpu_t *);
+#if CONFIG_ARCH == TYPE_ARCH_X86_64
+void init_pcid(cpu_t *);
+#endif
 void set_cpu_interrupt_flag(int flag);
 int set_int(unsigned);
 int get_cpu_interrupt_flag();
@@ -72,8 +107,20 @@ int send_ipi(unsigned char dest_shorthand, unsigned int dst, unsigned int v);
 extern unsigned bootstrap;
 cpu_t *get_cpu(int id);
 void init_ioapic();
-void move_task_cpu(task_t *t, cpu_t *cpu);
+int move_task_cpu(task_t *t, cpu_t *cpu);
+void finish_migration(task_t *t);
+cpu_t *sched_pick_cpu(task_t *t, cpu_t *pref);
+int balance_cpu(cpu_t *me, int idle);
+void balance_tick(cpu_t *me);
 
 #endif /* CONFIG_SMP */
 
+#if CONFIG_SMP && CONFIG_NOHZ
+void nohz_idle(cpu_t *cpu);
+void nohz_exit(cpu_t *cpu);
+void nohz_kick(cpu_t *cpu);
+#else
+#define nohz_kick(cpu) do {} while(0)
+#endif
+
 #endif
@@ -0,0 +1,34 @@
+#ifndef _EXEC_H
+#define _EXEC_H
+
+#include <types.h>
+#include <fs.h>
+
+/* a loadable segment of an executable. Nothing is mapped at exec time;
+ * pages are read in from the file the first time they are touched */
+#define ES_WRITE 1
+struct exec_segment {
+	addr_t vaddr;
+	size_t memsz, filesz;
+	off_t offset;
+	unsigned flags;
+};
+
+/* the segments of the program an address space is running. This never
+ * changes after exec, so it is shared by forked children */
+struct exec_image {
+	int count;
+	struct inode *inode;
+	unsigned num, max;
+	struct exec_segment segs[];
+};
+
+struct exec_image *exec_image_create(struct inode *inode, unsigned max);
+int exec_image_add(struct exec_image *img, addr_t vaddr, size_t memsz,
+		off_t offset, size_t filesz, unsigned flags);
+struct exec_image *exec_image_get(struct exec_image *img);
+void exec_image_put(struct exec_image *img);
+void exec_release_image();
+int exec_image_fault(addr_t addr, unsigned err_code, int can_sleep);
+
+#endif
@@ -16,6 +16,8 @@ struct file_ptr {
 	struct file *fi;
 };
 
+extern kmem_cache_t *file_cache;
+
 struct file *d_sys_open(char *name, int flags, mode_t mode, int *, int *);
 int do_sys_write_flags(struct file *f, off_t off, char *buf, size_t count);
 int do_sys_read_flags(struct file *f, off_t off, char *buf, size_t count);
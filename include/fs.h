@@ -24,6 +24,8 @@ typedef struct {
 	struct inode *parent;
 } mount_pt_t;
 
+struct page_cache;
+
 struct inode {
 	/* Attributes */
 	mode_t mode;
@@ -56,6 +58,8 @@ struct inode {
 	rwlock_t rwl;
 	struct flock *flocks;
 	mutex_t *flm;
+	/* pages of the file mapped by executables */
+	struct page_cache *pcache;
 };
 
 #define inode_has_children(i) (i->children.head && ll_is_active((&i->children)))
@@ -210,5 +214,6 @@ extern struct inode *devfs_root, *procfs_root;
 extern struct inode *procfs_kprocdir;
 extern struct inode *ramfs_root;
 extern struct inode *kproclist;
+extern kmem_cache_t *inode_cache;
 
 #endif
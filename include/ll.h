@@ -2,6 +2,7 @@
 #define K_LL_H
 #include <types.h>
 #include <rwlock.h>
+#include <slab.h>
 
 #define LLISTNODE_MAGIC 0x77755533
 #define LLIST_MAGIC     0x33355577
@@ -43,6 +44,8 @@ struct llist {
 #define ll_create(a) ll_do_create(a, 0)
 #define ll_create_lockless(a) ll_do_create(a, LL_LOCKLESS)
 
+extern kmem_cache_t *llistnode_cache;
+void ll_init_cache();
 struct llistnode *ll_do_insert(struct llist *list, struct llistnode *, void *entry);
 struct llist *ll_do_create(struct llist *list, char flags);
 void ll_destroy(struct llist *list);
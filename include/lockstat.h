@@ -0,0 +1,29 @@
+#ifndef LOCKSTAT_H
+#define LOCKSTAT_H
+
+#include <config.h>
+#include <types.h>
+
+/* when CONFIG_LOCKSTAT is enabled, every place that acquires a mutex or
+ * rwlock gets one of these, and it can be read from /proc/lockstat. All
+ * times are in cycles */
+#define LS_MUTEX  1
+#define LS_RWLOCK 2
+
+struct lockstat_site {
+	char * volatile file;
+	int line, type;
+	volatile unsigned lock, ready;
+	unsigned long acquired, contended;
+	unsigned long long wait_total, wait_max;
+	unsigned long long hold_total, hold_max;
+};
+
+#define LOCKSTAT_SITES 1024
+
+struct lockstat_site *lockstat_site(char *file, int line, int type);
+void lockstat_acquired(struct lockstat_site *s, unsigned long long wait, int contended);
+void lockstat_released(struct lockstat_site *s, unsigned long long hold);
+int proc_read_mutex(char *buf, int off, int len);
+
+#endif
@@ -5,6 +5,7 @@
 #include <multiboot.h>
 #include <sys/stat.h>
 #include <slab.h>
+#include <buddy.h>
 #include <config.h>
 #if CONFIG_ARCH == TYPE_ARCH_X86
 #include <memory-x86.h>
@@ -14,16 +15,33 @@
 
 typedef addr_t page_dir_t, page_table_t, pml4_t, pdpt_t;
 
+#if CONFIG_SMP
+#define CPU_MASK_BITS (sizeof(unsigned long) * 8)
+#define CPU_MASK_WORDS ((CONFIG_MAX_CPUS + CPU_MASK_BITS - 1) / CPU_MASK_BITS)
+#define cpu_mask_test(m,i) (((m)[(i) / CPU_MASK_BITS] >> ((i) % CPU_MASK_BITS)) & 1)
+#define cpu_mask_set(m,i) or_atomic(&(m)[(i) / CPU_MASK_BITS], 1UL << ((i) % CPU_MASK_BITS))
+#define cpu_mask_clear(m,i) and_atomic(&(m)[(i) / CPU_MASK_BITS], ~(1UL << ((i) % CPU_MASK_BITS)))
+#endif
+
 struct pd_data {
 	unsigned count;
 	mutex_t lock;
+#if CONFIG_SMP
+	/* the cpus that have this address space loaded, which are the only
+	 * ones that tlb flushes for its user memory need to reach */
+	volatile unsigned long cpu_mask[CPU_MASK_WORDS];
+#endif
+	/* changes whenever a mapping does (see tlb.c) */
+	volatile unsigned long tlb_gen;
+	/* the program this address space is running (see exec.h) */
+	struct exec_image *image;
+	/* mmap'd regions (see mmfile.h) */
+	struct mmap_space *mmap;
 };
 
 extern struct pd_data *pd_cur_data;
 
 extern volatile addr_t pm_location;
-extern volatile addr_t pm_stack;
-extern volatile addr_t pm_stack_max;
 extern volatile unsigned long pm_num_pages, pm_used_pages;
 extern volatile addr_t highest_page;
 extern volatile addr_t lowest_page;
@@ -55,9 +73,12 @@ void process_memorymap(struct multiboot *mboot);
 void pm_init(addr_t start, struct multiboot *);
 addr_t __pm_alloc_page(char *, int);
 void install_kmalloc(char *name, unsigned (*init)(addr_t, addr_t), 
-	addr_t (*alloc)(size_t, char), void (*free)(void *));
+	addr_t (*alloc)(size_t, char), void (*free)(void *), 
+	addr_t (*cpu_alloc)(size_t, char), int (*cpu_free)(void *));
 addr_t do_kmalloc_slab(size_t sz, char align);
 void do_kfree_slab(void *ptr);
+addr_t slab_cpu_alloc(size_t sz, char align);
+int slab_cpu_free(void *ptr);
 unsigned slab_init(addr_t start, addr_t end);
 void pm_free_page(addr_t addr);
 unsigned int vm_do_getattrib(addr_t v, unsigned *p, unsigned);
@@ -79,6 +100,8 @@ void vm_init_2();
 extern addr_t i_stack;
 void vm_init_tracking();
 unsigned int vm_setattrib(addr_t v, short attr);
+int vm_try_map_large(addr_t virt, addr_t lo, addr_t hi, unsigned attr);
+void vm_unmap_range(addr_t start, addr_t end);
 void setup_kernelstack();
 extern void zero_page_physical(addr_t);
 #define kmalloc(a) __kmalloc(a, __FILE__, __LINE__)
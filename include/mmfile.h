@@ -2,6 +2,9 @@
 #define __MMF_H
 
 #include <area.h>
+#include <types.h>
+
+struct inode;
 /*
  * Prots to 'mmap'.
  */
@@ -38,19 +41,40 @@
 #define MS_SYNC         4
 #define MS_INVALIDATE   2
 
-#define A_NI 4
+#define A_NI 16
+
+/* one mapping. File mappings hold a reference to the inode, so they
+ * stay valid after the descriptor is closed */
 typedef struct mmapfile_s {
-	unsigned fd;
+	struct inode *inode;
 	int flags;
 	int prot;
-	unsigned sz, off;
-	unsigned *count; /* For shared mappings */
+	size_t sz;
+	off_t off;
 	vnode_t *node;
 	struct mmapfile_s *next, *prev;
 } mmf_t;
 
-int pfault_mmf_check(unsigned err, unsigned addr);
-void mmf_sync();
-unsigned sys_mmap(void *addr, void *str, int prot, int flags, int fildes);
-int sys_munmap(void *ptr, unsigned sz);
+/* the mappings of an address space (see pd_data). Threads share it, and
+ * fork gives the child a copy */
+struct mmap_space {
+	mutex_t lock;
+	mmf_t *files;
+	vma_t vma;
+};
+
+/* the length and file offset of a mapping are passed to mmap in one of
+ * these, since there aren't enough syscall arguments */
+struct mmapblock {
+	size_t len;
+	off_t off;
+};
+
+int pfault_mmf_check(unsigned err, addr_t addr, int can_sleep);
+struct mmap_space *mmf_fork_begin();
+void mmf_fork_end(struct mmap_space *new);
+void mmf_release_space();
+addr_t sys_mmap(void *addr, struct mmapblock *blk, int prot, int flags, int fildes);
+int sys_munmap(void *ptr, size_t sz);
+int sys_msync(void *ptr, size_t sz, int flags);
 #endif
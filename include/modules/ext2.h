@@ -21,7 +21,7 @@ typedef struct e2_vol_data {
 	mutex_t *m_node, *m_block, *m_inode, ac_lock;
 	mutex_t fs_lock, bg_lock;
 	cache_t *cache;
-	struct llistnode *llnode;
+	struct e2_vol_data *next;
 } ext2_fs_t;
 
 typedef char ext2_inode_type_t;
@@ -1,6 +1,7 @@
 #ifndef NEW_MUTEX_H
 #define NEW_MUTEX_H
 
+#include <config.h>
 #include <types.h>
 
 #define MUTEX_MAGIC 0xDEADBEEF
@@ -11,20 +12,40 @@
  * handles an interrupt, and inside that interrupt it locks the same
  * mutex again. This is legal, but it's handled in a special way */
 #define MT_LCK_INT 2
+/* these protect and flag the list of tasks sleeping on the mutex */
+#define MT_LCK_WAIT 4
+#define MT_LCK_WAITERS 8
 
+struct mutex_waiter;
+
+/* a task that finds the mutex locked spins for a short while if the
+ * owner is running on another cpu, and otherwise goes to sleep on the
+ * wait list. On release, the lock is handed straight to the first
+ * waiter. MT_NOSCHED mutexes are ticket locks: each cpu takes a ticket
+ * and spins until it is being served, so they are handed out in FIFO
+ * order. */
 typedef struct {
 	unsigned magic;
-	unsigned lock;
+	volatile unsigned lock;
 	unsigned flags;
-	long pid;
+	volatile long pid;
+	void * volatile owner;
+	struct mutex_waiter *wait_head, *wait_tail;
+	volatile unsigned next_ticket, now_serving;
+#if CONFIG_LOCKSTAT
+	struct lockstat_site *ls_site;
+	unsigned long long ls_acquired;
+#endif
 } mutex_t;
 
 void __mutex_acquire(mutex_t *m,char*,int);
 void __mutex_release(mutex_t *m,char*,int);
+int __mutex_trylock(mutex_t *m,char*,int);
 mutex_t *mutex_create(mutex_t *m, unsigned);
 void mutex_destroy(mutex_t *m);
 
 #define mutex_acquire(m) __mutex_acquire(m, __FILE__, __LINE__)
 #define mutex_release(m) __mutex_release(m, __FILE__, __LINE__)
+#define mutex_trylock(m) __mutex_trylock(m, __FILE__, __LINE__)
 
 #endif
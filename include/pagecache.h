@@ -0,0 +1,23 @@
+#ifndef _PAGECACHE_H
+#define _PAGECACHE_H
+
+#include <types.h>
+#include <cache.h>
+#include <fs.h>
+
+/* physical pages holding the contents of a file, indexed by page number
+ * within the file. Every page in the cache holds a reference of its own
+ * (see pm_page_share), so it stays around while no one has it mapped */
+struct page_cache {
+	chash_t *hash;
+	unsigned num;
+};
+
+#define PCACHE_HASH_LEN 64
+
+addr_t pcache_find(struct inode *i, u64 index);
+addr_t pcache_insert(struct inode *i, u64 index, addr_t phys);
+void pcache_release(struct inode *i);
+void init_pcache();
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef RCU_H
+#define RCU_H
+
+#include <config.h>
+#include <cpu.h>
+#include <atomic.h>
+
+/* read-copy-update, for tables that are read far more often than they
+ * change. Readers don't write to anything shared: they run with
+ * interrupts off, and count themselves in their own cpu so that a
+ * writer can tell when every reader that might have seen an old entry
+ * is done. Readers may not sleep.
+ *
+ * Writers still serialize with each other with a normal lock. They
+ * publish new entries with rcu_assign_pointer, and after unlinking an
+ * entry they call synchronize_rcu before freeing it. */
+
+static inline int rcu_read_lock()
+{
+	int old = set_int(0);
+	cpu_t *cpu = current_task ? current_task->cpu : 0;
+	/* this is a locked instruction, so our reads can't be done before
+	 * a writer can see that we're here */
+	if(cpu)
+		add_atomic(&cpu->rcu_readers, 1);
+	return old;
+}
+
+static inline void rcu_read_unlock(int old)
+{
+	cpu_t *cpu = current_task ? current_task->cpu : 0;
+	if(cpu)
+		sub_atomic(&cpu->rcu_readers, 1);
+	set_int(old);
+}
+
+#define rcu_dereference(p) (*(typeof(p) volatile *)&(p))
+#define rcu_assign_pointer(p, v) do { __sync_synchronize(); (p) = (v); } while(0)
+
+void synchronize_rcu();
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef _RUNQUEUE_H
+#define _RUNQUEUE_H
+
+#include <mutex.h>
+#include <task.h>
+
+#define RQ_ALLOC     1
+#define RQ_THROTTLED 2 /* real-time tasks used up their share of the period */
+
+#define RQ_MAGIC 0xFEEDCAFE
+
+/* tasks are placed on one of RQ_NUM_LEVELS lists depending on their
+ * priority (see GET_MAX_TS). Higher levels are run first. */
+#define RQ_NUM_LEVELS    64
+#define RQ_PRIO_BIAS     32
+#define RQ_BITS_PER_WORD (sizeof(unsigned long) * 8)
+#define RQ_BITMAP_WORDS  (RQ_NUM_LEVELS / RQ_BITS_PER_WORD)
+
+/* real-time tasks (see sched_setscheduler) are kept in an array of
+ * their own, which is always run before the normal ones. Their rq_level
+ * is above every normal level, so that levels may still be compared */
+#define RQ_RT_LEVEL(prio) (RQ_NUM_LEVELS + (prio))
+/* real-time tasks may only use RQ_RT_SHARE percent of each RQ_RT_PERIOD
+ * ticks on a cpu, so that a runaway one can't lock everything else out */
+#define RQ_RT_PERIOD current_hz
+#define RQ_RT_SHARE  95
+
+/* how many tasks runqueue_steal will look at before giving up */
+#define RQ_STEAL_SCAN 32
+
+struct rq_list {
+	task_t *head, *tail;
+};
+
+struct rq_array {
+	unsigned num;
+	unsigned long bitmap[RQ_BITMAP_WORDS];
+	struct rq_list levels[RQ_NUM_LEVELS];
+};
+
+/* a per-cpu run queue. Only runable tasks are kept in the priority
+ * arrays. When a task uses up its timeslice it is moved to the expired
+ * array, and once the active array runs dry the two are swapped.
+ * Real-time tasks are never expired. */
+typedef struct {
+	unsigned magic;
+	unsigned flags;
+	mutex_t lock;
+	void *cpu;
+	volatile unsigned num;
+	struct rq_array arrays[3];
+	struct rq_array *active, *expired, *rt;
+	/* real-time throttling */
+	unsigned rt_used, rt_throttled;
+	unsigned long rt_period;
+} runqueue_t;
+
+runqueue_t *runqueue_create(runqueue_t *rq, void *cpu, unsigned flags);
+void runqueue_destroy(runqueue_t *rq);
+int runqueue_insert(runqueue_t *rq, task_t *t);
+void runqueue_remove(runqueue_t *rq, task_t *t);
+task_t *runqueue_next(runqueue_t *rq, task_t *prev);
+task_t *runqueue_steal(runqueue_t *from, runqueue_t *to, unsigned long hot);
+int runqueue_set_policy(runqueue_t *rq, task_t *t, int policy, int prio);
+int runqueue_rt_tick(runqueue_t *rq, task_t *cur);
+
+#endif
@@ -1,9 +1,26 @@
 #ifndef RWLOCK_H
 #define RWLOCK_H
 
+#include <config.h>
+
+struct rwlock_waiter;
+
+/* locks is 1 while a writer holds the lock, and otherwise twice the
+ * number of readers. Tasks that can't get the lock sleep on the wait
+ * list and are handed the lock by whoever releases it. Once a writer is
+ * waiting, no new readers are let in (except for tasks that already
+ * hold read locks), so readers can't starve writers. */
 typedef volatile struct {
 	volatile unsigned magic, flags;
 	volatile unsigned long locks;
+	/* bit 0 protects the wait list */
+	volatile unsigned wait;
+	volatile unsigned writers_waiting;
+	struct rwlock_waiter *wait_head, *wait_tail;
+#if CONFIG_LOCKSTAT
+	struct lockstat_site *ls_site;
+	unsigned long long ls_acquired;
+#endif
 } rwlock_t;
 
 #define RWLOCK_MAGIC 0x1AD1E5
@@ -17,6 +34,7 @@ void rwlock_destroy(rwlock_t *lock);
 void __rwlock_acquire(rwlock_t *lock, unsigned flags, char *, int);
 void __rwlock_escalate(rwlock_t *lock, unsigned flags, char *, int);
 void rwlock_release(rwlock_t *lock, unsigned flags);
+int rwlock_trylock(rwlock_t *lock, unsigned flags);
 
 #define rwlock_acquire(a, b) __rwlock_acquire(a, b, __FILE__, __LINE__)
 #define rwlock_escalate(a, b) __rwlock_escalate(a, b, __FILE__, __LINE__)
@@ -0,0 +1,24 @@
+#ifndef SHRINK_H
+#define SHRINK_H
+#include <types.h>
+
+/* anything that holds on to memory it could give back (caches, empty
+ * slabs) registers a shrinker. When physical memory runs out, the page
+ * allocator calls them to get some of it back. shrink is asked to free
+ * about 'pages' pages, and returns roughly how many it did. It must not
+ * allocate memory, and must not wait for locks that the allocating task
+ * may already hold (use the trylock functions) */
+struct shrinker {
+	char name[32];
+	unsigned long (*shrink)(struct shrinker *, unsigned long pages);
+	void *data;
+	struct shrinker *next, *prev;
+};
+
+void shrinker_register(struct shrinker *s, const char *name,
+	unsigned long (*shrink)(struct shrinker *, unsigned long), void *data);
+void shrinker_unregister(struct shrinker *s);
+unsigned long shrink_memory(unsigned long pages);
+void init_shrinkers();
+
+#endif
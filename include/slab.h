@@ -5,6 +5,14 @@
 #include <config.h>
 #define SLAB_MAGIC 0x11235813
 #define S_ALIGN 1
+#define S_NAMED 2 /* belongs to a kmem_cache, not used by kmalloc */
+#define S_KEEP  4 /* never released, even when it has no slabs */
+#define S_EMPTY 8 /* slab is on its cache's empty list */
+
+/* how many empty slabs a cache holds on to. More than this are released
+ * right away, and the ones that are kept are released by the slab
+ * shrinker once memory runs low */
+#define SLAB_MAX_EMPTY 2
 
 extern addr_t slab_start, slab_end;
 extern vma_t slab_area_alloc;
@@ -36,9 +44,48 @@ typedef struct slab_cache_s {
 	short id;
 	unsigned short flags;
 	unsigned obj_size;
-	unsigned slab_count;
+	unsigned slab_count, empty_count;
+	/* which per-cpu magazine freed objects go to, or -1 */
+	short mag;
 } slab_cache_t;
 
+/* kmalloc sizes are rounded up to one of these classes, and freed objects
+ * are kept in per-cpu magazines for their class (see slab.c) */
+#define SLAB_NUM_CLASSES 13
+#define SLAB_MAX_CLASS_SIZE 2048
+/* number of kmem_caches that get per-cpu magazines */
+#define KMEM_MAX_CACHES 16
+#define SLAB_NUM_MAGS (SLAB_NUM_CLASSES + KMEM_MAX_CACHES)
+/* objects held by each magazine */
+#define MAG_ROUNDS 15
+
+struct magazine {
+	unsigned rounds;
+	struct magazine *next;
+	addr_t objs[MAG_ROUNDS];
+};
+
+/* each cpu has a loaded and a previous magazine per size class. They
+ * may only be touched by their own cpu with interrupts disabled */
+struct slab_cpu_cache {
+	struct magazine *loaded, *previous;
+};
+
+/* a cache of objects of one type. If ctor is given, it is called on
+ * every allocation and must initialize the object, otherwise the object
+ * is zeroed. Objects may be freed with either kmem_cache_free or kfree */
+typedef struct kmem_cache_s {
+	char name[32];
+	size_t size, align;
+	void (*ctor)(void *);
+	slab_cache_t *sc;
+} kmem_cache_t;
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align, 
+	void (*ctor)(void *));
+void *kmem_cache_alloc(kmem_cache_t *kc);
+void kmem_cache_free(kmem_cache_t *kc, void *obj);
+
 #define NUM_SCACHES (PAGE_SIZE / sizeof(slab_cache_t))
 #define OBJ_SIZE(s) (((slab_cache_t *)(s->parent))->obj_size)
 #define FIRST_OBJ(s) ((addr_t)((s->flags & S_ALIGN) ? ((addr_t)s+PAGE_SIZE) \
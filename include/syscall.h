@@ -154,6 +154,11 @@ int sys_setup();
 #define SYS_SETSERV		119
 #define SYS_SYSLOG		120
 #define SYS_POSFSSTAT   121
+#define SYS_MSYNC       122
+#define SYS_SETAFFINITY 123
+#define SYS_GETAFFINITY 124
+#define SYS_SETSCHED    125
+#define SYS_GETSCHED    126
 
 #define SYS_WAITAGAIN   	127
 
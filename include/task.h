@@ -11,6 +11,7 @@
 #include <atomic.h>
 #include <config.h>
 #include <file.h>
+#include <timer.h>
 
 #define KERN_STACK_SIZE 0x16000
 
@@ -51,6 +52,9 @@
 #define TF_OTHERBS   0x100000 /* other bit-size. Task is running as different bit-size than the CPU */
 #define TF_SHUTDOWN  0x200000 /* this task called shutdown */
 #define TF_KILLREADY 0x400000 /* task is ready to be killed */
+#define TF_MUTEX     0x800000 /* asleep on a mutex or rwlock, only the owner may wake us */
+#define TF_MIGRATE  0x1000000 /* not allowed on its cpu. It is moved once switched out */
+#define TF_WAITCHILD 0x2000000 /* asleep until a child (or waited-on task) changes state */
 
 
 #define PRIO_PROCESS 1
@@ -84,6 +88,10 @@ struct thread_shared_data {
 	struct file_ptr *filp[FILP_HASH_LEN];
 };
 
+struct task_link {
+	volatile struct task_struct *next, *prev;
+};
+
 struct task_struct
 {
 	volatile unsigned magic;
@@ -106,9 +114,13 @@ struct task_struct
 	addr_t kernel_stack;
 	/* timeslicing */
 	int cur_ts, priority;
+	/* scheduling policy, and priority for the real-time ones */
+	int policy, rt_priority;
 	/* waiting on something? */
 	volatile addr_t waiting_ret;
-	volatile long tick;
+	struct timer *sleep_timer;
+	/* how many rwlocks we hold for reading */
+	unsigned rwl_reads;
 	
 	/* accounting */
 	time_t stime, utime;
@@ -132,25 +144,40 @@ struct task_struct
 	char **argv, **env;
 	int cmask;
 	int tty;
-	unsigned long slice;
-	mmf_t *mm_files;
-	vma_t *mmf_priv_space, *mmf_share_space;
+	unsigned long slice, last_ran;
 	
 	/* signal handling */
 	volatile sigset_t sig_mask;
 	volatile unsigned sigd, cursig, syscall_count;
 	sigset_t old_mask;
-	unsigned alarm_end;
-	struct llistnode *listnode, *blocknode, *activenode;
+	struct timer *alarm_timer;
+	struct llistnode *listnode, *blocknode;
 	struct llist *blocklist;
+	/* run queue linkage (see runqueue.h) */
+	void *rq_array;
+	int rq_level;
+	volatile struct task_struct *rq_next, *rq_prev;
+	/* when we were last woken up, until we get to run */
+	unsigned long long woken_at;
 	void *cpu;
+#if CONFIG_SMP
+	/* which cpus we may run on, indexed like cpu_array */
+	unsigned long cpu_mask[CPU_MASK_WORDS];
+#endif
 	struct thread_shared_data *thread;
-	volatile struct task_struct *parent, *waiting, *alarm_next, *alarm_prev;
+	volatile struct task_struct *parent, *waiting;
+	/* process group and session */
+	unsigned pgid, sid;
+	/* task indexes (see tasklist.c) */
+	struct task_link pid_link, sibling, pgrp_link, tty_link, wait_link, event_link;
+	volatile struct task_struct *children, *waiters;
+	/* children with a state change for waitpid to report, and ours */
+	volatile struct task_struct *child_events;
+	unsigned wait_event;
 };
 typedef volatile struct task_struct task_t;
 
-extern volatile task_t *kernel_task, *tokill, *alarm_list_start;
-extern mutex_t *alarm_mutex;
+extern volatile task_t *kernel_task, *tokill;
 
 #define raise_task_flag(t,f) or_atomic(&(t->flags), f)
 #define lower_task_flag(t,f) and_atomic(&(t->flags), ~f)
@@ -158,7 +185,29 @@ extern mutex_t *alarm_mutex;
 #define raise_flag(f) or_atomic(&(current_task->flags), f)
 #define lower_flag(f) and_atomic(&(current_task->flags), ~f)
 
-#define WNOHANG 1
+#define WNOHANG    1
+#define WUNTRACED  2
+#define WCONTINUED 8
+
+/* state changes that waitpid reports */
+#define WEV_EXIT 1
+#define WEV_STOP 2
+#define WEV_CONT 3
+
+/* scheduling policies. Real-time (FIFO and RR) tasks always run before
+ * normal ones, in order of rt_priority. FIFO tasks run until they
+ * block or something of higher priority wakes up, and RR tasks also
+ * take turns every SCHED_RR_TS ticks */
+#define SCHED_OTHER 0
+#define SCHED_FIFO  1
+#define SCHED_RR    2
+#define SCHED_RT_PRIO_MIN 1
+#define SCHED_RT_PRIO_MAX 63 /* RQ_NUM_LEVELS-1 */
+#define SCHED_RR_TS 10
+
+struct sched_param {
+	int sched_priority;
+};
 
 #define FORK_SHAREDIR 0x1
 #define FORK_SHAREDAT 0x2
@@ -173,6 +222,8 @@ void take_issue_with_current_task();
 void clear_resources(task_t *);
 int times(struct tms *buf);
 void run_scheduler();
+void sched_wakeup(task_t *t);
+void resched_if_needed();
 void arch_specific_set_current_task(page_dir_t *, addr_t);
 int set_gid(int);
 int set_uid(int);
@@ -205,17 +256,35 @@ int sys_alarm(int a);
 int get_mem_usage();
 void take_issue_with_current_task();
 task_t *get_task_pid(int pid);
+void init_tasklist();
+void task_index_add(task_t *t);
+int __task_index_remove(task_t *t);
+int task_index_remove(task_t *t);
+void task_index_exit(task_t *t);
+int task_wait_on(task_t *target);
+void task_stop_waiting(task_t *t);
+void task_child_event(task_t *t, unsigned event);
+task_t *task_take_child_event(int pid, int opt, unsigned *event, int *err);
+void task_set_tty(task_t *t, int tty);
+int task_set_pgid(task_t *t, unsigned pgid);
+int task_set_session(task_t *t);
+int task_for_each_in_pgrp(unsigned pgid, void (*action)(task_t *, void *), void *data);
+int task_for_each_on_tty(int tty, void (*action)(task_t *, void *), void *data);
 void kill_all_tasks();
 void task_unlock_mutexes(task_t *t);
 void do_force_nolock(task_t *t);
 void close_all_files(task_t *);
 int sys_gsetpriority(int set, int which, int id, int val);
+int sys_sched_setaffinity(int pid, size_t size, unsigned long *mask);
+int sys_sched_getaffinity(int pid, size_t size, unsigned long *mask);
+int sys_sched_setscheduler(int pid, int policy, struct sched_param *param);
+int sys_sched_getscheduler(int pid, struct sched_param *param);
 int sys_waitagain();
 void force_nolock(task_t *);
 int get_task_mem_usage(task_t *t);
 int sys_nice(int which, int who, int val, int flags);
 int sys_setsid();
-int sys_setpgid(int a, int b);
+int sys_setpgid(int pid, int pgid);
 void task_suicide();
 void handle_signal(task_t *t);
 int signal_will_be_fatal(task_t *t, int sig);
@@ -231,10 +300,11 @@ void task_pause(task_t *t);
 void task_unblock_all(struct llist *list);
 void task_unblock(struct llist *list, task_t *t);
 void task_resume(task_t *t);
+void task_poke(task_t *t);
+int task_can_sleep();
 struct inode *set_as_kernel_task(char *name);
 void fput(task_t *, int, char);
 extern void do_switch_to_user_mode();
-extern void check_alarms();
 
 #if CONFIG_SMP
 void smp_cpu_task_idle(task_t *me);
@@ -246,6 +316,7 @@ extern unsigned ret_values_size;
 extern unsigned *ret_values;
 extern int current_hz;
 extern struct llist *kill_queue;
+extern kmem_cache_t *task_cache;
 extern unsigned running_processes;
 extern volatile long ticks;
 
@@ -253,7 +324,8 @@ extern volatile long ticks;
 static __attribute__((always_inline)) inline void enter_system(int sys)
 {
 	current_task->system=(!sys ? -1 : sys);
-	current_task->cur_ts/=2;
+	if(current_task->policy == SCHED_OTHER)
+		current_task->cur_ts/=2;
 }
 
 static __attribute__((always_inline)) inline void exit_system()
@@ -266,6 +338,8 @@ static int GET_MAX_TS(task_t *t)
 {
 	if(t->flags & TF_EXITING)
 		return 1;
+	if(t->policy == SCHED_RR)
+		return SCHED_RR_TS;
 	int x = t->priority;
 	if(t->tty == curcons->tty)
 		x += sched_tty;
@@ -0,0 +1,29 @@
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#define TIMER_ALLOC 1
+
+/* a one-shot timer, fired from the timer wheel in tick.c once ticks
+ * reaches 'expires'. The callback is run from the timer interrupt with
+ * the wheel locked, so it may not add or cancel timers itself. */
+struct timer {
+	unsigned flags;
+	long expires;
+	void (*func)(struct timer *);
+	void *data;
+	struct timer *next, **pprev;
+};
+
+struct timer *timer_create(struct timer *t, void (*func)(struct timer *), void *data);
+void timer_destroy(struct timer *t);
+void timer_add(struct timer *t, long expires);
+int timer_cancel(struct timer *t);
+void init_timers();
+void run_timers();
+
+static inline int timer_pending(struct timer *t)
+{
+	return t->pprev != 0;
+}
+
+#endif
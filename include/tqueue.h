@@ -13,8 +13,6 @@
 #define TSEARCH_TTY              0x10
 #define TSEARCH_PARENT           0x20
 #define TSEARCH_ENUM             0x40
-#define TSEARCH_EXIT_WAITING     0x80
-#define TSEARCH_EXIT_PARENT     0x100
 #define TSEARCH_EXCLUSIVE       0x200
 #define TSEARCH_ENUM_ALIVE_ONLY 0x400
 
@@ -9,7 +9,9 @@
 #include <ll.h>
 #include <atomic.h>
 #include <symbol.h>
+#include <pagecache.h>
 struct llist *cache_list;
+kmem_cache_t *ce_cache=0;
 int disconnect_block_cache(int dev);
 int write_block_cache(int dev, u64 blk);
 void accessed_cache(cache_t *c)
@@ -29,6 +31,7 @@ int should_element_be_added(cache_t *c)
 
 int init_cache()
 {
+	ce_cache = kmem_cache_create("ce_t", sizeof(struct ce_t), 0, 0);
 #if CONFIG_MODULES
 	add_kernel_symbol(get_empty_cache);
 	add_kernel_symbol(find_cache_element);
@@ -45,6 +48,7 @@ int init_cache()
 	add_kernel_symbol(kernel_cache_sync);
 #endif
 	cache_list = ll_create(0);
+	init_pcache();
 	return 0;
 }
 
@@ -80,6 +84,29 @@ int set_dirty(cache_t *c, struct ce_t *e, int dirty)
 	return old;
 }
 
+/* drop clean elements when memory runs low. Dirty ones would have to be
+ * written out first, which may need memory, so they are left alone */
+static unsigned long cache_shrink(struct shrinker *s, unsigned long pages)
+{
+	cache_t *c = s->data;
+	if(!rwlock_trylock(c->rwl, RWL_WRITER))
+		return 0;
+	unsigned long bytes = 0;
+	struct llistnode *curnode, *next;
+	struct ce_t *obj;
+	ll_for_each_entry_safe(&c->primary_ll, curnode, next, struct ce_t *, obj)
+	{
+		if(bytes >= pages * PAGE_SIZE)
+			break;
+		if(obj->dirty)
+			continue;
+		bytes += obj->length + sizeof(struct ce_t);
+		remove_element(c, obj, 1);
+	}
+	rwlock_release(c->rwl, RWL_WRITER);
+	return bytes / PAGE_SIZE;
+}
+
 cache_t *get_empty_cache(int (*sync)(struct ce_t *), char *name)
 {
 	cache_t *c = (void *)kmalloc(sizeof(cache_t));
@@ -94,6 +121,7 @@ cache_t *get_empty_cache(int (*sync)(struct ce_t *), char *name)
 	ll_create(&c->dirty_ll);
 	ll_create(&c->primary_ll);
 	ll_insert(cache_list, c);
+	shrinker_register(&c->shrinker, name, cache_shrink, c);
 	
 	printk(0, "[cache]: Allocated new cache '%s'\n", name);
 	return c;
@@ -144,7 +172,7 @@ int do_cache_object(cache_t *c, u64 id, u64 key, int sz, char *buf, int dirty)
 			remove_element(c, q, 1);
 		}
 	}
-	obj = (struct ce_t *)kmalloc(sizeof(struct ce_t));
+	obj = (struct ce_t *)kmem_cache_alloc(ce_cache);
 	obj->data = (char *)kmalloc(sz);
 	obj->length = sz;
 	obj->rwl = rwlock_create(0);
@@ -174,7 +202,7 @@ void remove_element(cache_t *c, struct ce_t *o, int locked)
 	if(o->data)
 		kfree(o->data);
 	rwlock_destroy(o->rwl);
-	kfree(o);
+	kmem_cache_free(ce_cache, o);
 	if(!locked) rwlock_release(c->rwl, RWL_WRITER);
 }
 
@@ -255,6 +283,7 @@ int destroy_all_id(cache_t *c, u64 id)
 int destroy_cache(cache_t *c)
 {
 	printk(1, "[cache]: Destroying cache '%s'...\n", c->name);
+	shrinker_unregister(&c->shrinker);
 	rwlock_acquire(c->rwl, RWL_WRITER);
 	chash_t *h = c->hash;
 	c->hash = 0;
@@ -0,0 +1,79 @@
+/* pagecache.c - per-inode cache of file pages
+ * Pages of executables are read in once and then mapped read-only into
+ * every task that runs the file. The cache is dropped when the file is
+ * written to or the inode is freed; tasks that still have a page mapped
+ * keep it until they unmap it.
+ */
+#include <kernel.h>
+#include <memory.h>
+#include <task.h>
+#include <fs.h>
+#include <cache.h>
+#include <pagecache.h>
+#include <atomic.h>
+
+static mutex_t pcache_lock;
+
+void init_pcache()
+{
+	mutex_create(&pcache_lock, 0);
+}
+
+/* returns the physical page holding page 'index' of the file, with a
+ * reference taken for the caller, or 0 if it isn't cached */
+addr_t pcache_find(struct inode *i, u64 index)
+{
+	addr_t phys = 0;
+	mutex_acquire(&pcache_lock);
+	if(i->pcache) {
+		phys = (addr_t)chash_search(i->pcache->hash, 0, index);
+		if(phys)
+			pm_page_share(phys);
+	}
+	mutex_release(&pcache_lock);
+	return phys;
+}
+
+/* add a page that the caller has just read in. If another task beat us
+ * to it, the page already in the cache is returned instead (with a
+ * reference for the caller), and the caller should use that one. If
+ * memory is tight the page isn't cached at all */
+addr_t pcache_insert(struct inode *i, u64 index, addr_t phys)
+{
+	if((pm_used_pages * 100) / pm_num_pages >= 80)
+		return phys;
+	mutex_acquire(&pcache_lock);
+	if(!i->pcache) {
+		i->pcache = (void *)kmalloc(sizeof(struct page_cache));
+		i->pcache->hash = chash_create(PCACHE_HASH_LEN);
+	}
+	addr_t cur = (addr_t)chash_search(i->pcache->hash, 0, index);
+	if(cur) {
+		pm_page_share(cur);
+		phys = cur;
+	} else if(pm_page_share(phys)) {
+		chash_add(i->pcache->hash, 0, index, (void *)phys);
+		i->pcache->num++;
+	}
+	mutex_release(&pcache_lock);
+	return phys;
+}
+
+/* drop every page in an inode's cache */
+void pcache_release(struct inode *i)
+{
+	mutex_acquire(&pcache_lock);
+	struct page_cache *pc = i->pcache;
+	i->pcache = 0;
+	mutex_release(&pcache_lock);
+	if(!pc)
+		return;
+	u64 id, index;
+	addr_t phys;
+	while((phys = (addr_t)chash_get_any_object(pc->hash, &id, &index))) {
+		chash_delete(pc->hash, id, index);
+		pm_free_page(phys);
+	}
+	chash_destroy(pc->hash);
+	kfree(pc);
+}
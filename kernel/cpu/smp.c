@@ -8,9 +8,15 @@ void smp_cpu_task_idle(task_t *me)
 	((cpu_t *)(me->cpu))->flags |= CPU_TASK;
 	me->system = -1;
 	set_int(1);
-	/* wait until we have tasks to run */
-	for(;;) 
+	/* wait until we have tasks to run, and try to take some from
+	 * other cpus while we're waiting */
+	for(;;) {
+		balance_cpu((cpu_t *)me->cpu, 1);
+#if CONFIG_NOHZ
+		nohz_idle((cpu_t *)me->cpu);
+#endif
 		schedule();
+	}
 }
 
 #endif
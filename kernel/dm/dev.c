@@ -5,6 +5,9 @@
 #include <sys/stat.h>
 #include <block.h>
 #include <symbol.h>
+#include <rcu.h>
+/* lookups don't take the lock, they're protected by rcu. The lock only
+ * keeps changes to the table from racing with each other */
 struct devhash_s devhash[NUM_DT];
 
 void init_dm()
@@ -39,12 +42,12 @@ device_t *get_device(int type, int major)
 		return 0;
 	int alpha = major % DH_SZ;
 	int beta = major / DH_SZ;
-	mutex_acquire(&devhash[type].lock);
-	device_t *dt = devhash[type].devs[alpha];
+	int old = rcu_read_lock();
+	device_t *dt = rcu_dereference(devhash[type].devs[alpha]);
 	while(dt && dt->beta != beta) 
-		dt=dt->next;
-	mutex_release(&devhash[type].lock);
-	if(!dt->ptr) return 0;
+		dt = rcu_dereference(dt->next);
+	rcu_read_unlock(old);
+	if(!dt || !dt->ptr) return 0;
 	return dt;
 }
 
@@ -54,18 +57,18 @@ device_t *get_n_device(int type, int n)
 		return 0;
 	int a=0;
 	device_t *dt=0;
-	mutex_acquire(&devhash[type].lock);
+	int old = rcu_read_lock();
 	while(!dt && a < DH_SZ)
 	{
-		dt = devhash[type].devs[a];
+		dt = rcu_dereference(devhash[type].devs[a]);
 		while(n && dt) {
-			dt=dt->next;
+			dt = rcu_dereference(dt->next);
 			n--;
 		}
 		a++;
 	}
-	mutex_release(&devhash[type].lock);
-	if(!dt->ptr) return 0;
+	rcu_read_unlock(old);
+	if(!dt || !dt->ptr) return 0;
 	return dt;
 }
 
@@ -79,9 +82,8 @@ int add_device(int type, int major, void *str)
 	device_t *new = (device_t *)kmalloc(sizeof(device_t));
 	new->beta = beta;
 	new->ptr = str;
-	device_t *old = devhash[type].devs[alpha];
-	devhash[type].devs[alpha] = new;
-	new->next = old;
+	new->next = devhash[type].devs[alpha];
+	rcu_assign_pointer(devhash[type].devs[alpha], new);
 	mutex_release(&devhash[type].lock);
 	return 0;
 }
@@ -108,9 +110,12 @@ int remove_device(int type, int major)
 			assert(p->next == d);
 			p->next = d->next;
 		}
-		kfree(d);
 	}
 	mutex_release(&devhash[type].lock);
+	if(d) {
+		synchronize_rcu();
+		kfree(d);
+	}
 	return 0;
 }
 
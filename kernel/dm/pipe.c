@@ -19,7 +19,7 @@ static struct inode *create_anon_pipe()
 {
 	struct inode *node;
 	/* create a 'fake' inode */
-	node = (struct inode *)kmalloc(sizeof(struct inode));
+	node = (struct inode *)kmem_cache_alloc(inode_cache);
 	_strcpy(node->name, "~pipe~");
 	node->uid = current_task->thread->uid;
 	node->gid = current_task->thread->gid;
@@ -42,14 +42,14 @@ int sys_pipe(int *files)
 	struct file *f;
 	struct inode *inode = create_anon_pipe();
 	/* this is the reading descriptor */
-	f = (struct file *)kmalloc(sizeof(struct file));
+	f = (struct file *)kmem_cache_alloc(file_cache);
 	f->inode = inode;
 	f->flags = _FREAD;
 	f->pos=0;
 	f->count=1;
 	int read = add_file_pointer((task_t *)current_task, f);
 	/* this is the writing descriptor */
-	f = (struct file *)kmalloc(sizeof(struct file));
+	f = (struct file *)kmem_cache_alloc(file_cache);
 	f->inode = inode;
 	f->flags = _FREAD | _FWRITE;
 	f->count=1;
@@ -24,7 +24,7 @@ int tty_open(int min)
 		create_console(&consoles[min]);
 		init_console(&consoles[min], &crtc_drv);
 	}
-	current_task->tty = min;
+	task_set_tty((task_t *)current_task, min);
 	return 0;
 }
 
@@ -49,13 +49,15 @@ void tty_putch(struct vterm *con, int ch)
 	con->rend.putch(con, ch);
 }
 
-void __tty_found_task_raise_action(task_t *t, int arg)
+void __tty_found_task_raise_action(task_t *t, void *arg)
 {
 	if(t->flags & TF_BGROUND) return;
-	t->sigd = arg;
+	t->sigd = (int)(addr_t)arg;
 	raise_task_flag(t, TF_SCHED);
 	if(t->blocklist)
 		task_unblock(t->blocklist, t);
+	else
+		task_poke(t);
 }
 
 int tty_raise_action(int min, int sig)
@@ -64,7 +66,7 @@ int tty_raise_action(int min, int sig)
 		return 0;
 	if((kernel_state_flags & KSF_SHUTDOWN))
 		return 0;
-	if(search_tqueue(primary_queue, TSEARCH_FINDALL | TSEARCH_TTY, min, __tty_found_task_raise_action, sig, 0))
+	if(task_for_each_on_tty(min, __tty_found_task_raise_action, (void *)(addr_t)sig))
 		consoles[min].inpos=0;
 	return 0;
 }
@@ -191,7 +193,7 @@ int ttyx_ioctl(int min, int cmd, long arg)
 			con->b = arg/16;
 			break;
 		case 2:
-			current_task->tty = min;
+			task_set_tty((task_t *)current_task, min);
 			break;
 		case 3:
 			if(con->rend.clear_cursor)
@@ -38,7 +38,7 @@ int devfs_fsstat(struct inode *i, struct posix_statfs *fs)
 
 void init_dev_fs()
 {
-	devfs_root = (struct inode*)kmalloc(sizeof(struct inode));
+	devfs_root = (struct inode *)kmem_cache_alloc(inode_cache);
 	_strcpy(devfs_root->name, "dev");
 	devfs_root->i_ops = &devfs_inode_ops;
 	devfs_root->parent = current_task->thread->root;
@@ -74,7 +74,7 @@ struct inode *devfs_add(struct inode *q, char *name, mode_t mode, int major, int
 struct inode *devfs_create(struct inode *base, char *name, mode_t mode)
 {
 	struct inode *i;
-	i = (struct inode*)kmalloc(sizeof(struct inode));
+	i = (struct inode *)kmem_cache_alloc(inode_cache);
 	strncpy(i->name, name, INAME_LEN);
 	i->i_ops = &devfs_inode_ops;
 	i->parent = devfs_root;
@@ -47,7 +47,7 @@ struct file *d_sys_open(char *name, int flags, mode_t _mode, int *error, int *nu
 		return 0;
 	}
 	int ret;
-	f = (struct file *)kmalloc(sizeof(struct file));
+	f = (struct file *)kmem_cache_alloc(file_cache);
 	f->inode = inode;
 	f->flags = flags;
 	f->pos=0;
@@ -91,7 +91,7 @@ int duplicate(task_t *t, int fp, int n)
 	struct file *f = get_file_pointer(t, fp);
 	if(!f)
 		return -EBADF;
-	struct file *new=(struct file *)kmalloc(sizeof(struct file));
+	struct file *new=(struct file *)kmem_cache_alloc(file_cache);
 	new->inode = f->inode;
 	assert(new->inode && new->inode->count && new->inode->f_count);
 	new->count=1;
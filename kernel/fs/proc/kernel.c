@@ -51,6 +51,58 @@ int proc_cpu(char rw, struct inode *inode, int m, char *buf, int off, int len)
 }
 #endif
 
+static int proc_wakeup_cpu(cpu_t *c, char *buf, int total_len, int off, int len)
+{
+	char tmp[128];
+	unsigned long avg = c->wakeups ? (unsigned long)(c->wakeup_lat_total / c->wakeups) : 0;
+	sprintf(tmp, "%3d | %7u | %11u | %10u | %u\n", c->apicid, c->wakeups, 
+		c->wakeup_ipis, avg, (unsigned long)c->wakeup_lat_max);
+	return proc_append_buffer(buf, tmp, total_len, -1, off, len);
+}
+
+int proc_sched(char rw, struct inode *inode, int m, char *buf, int off, int len)
+{
+	int total_len=0;
+	if(rw != READ)
+		return 0;
+	switch(m) {
+#if CONFIG_SMP
+		case 2:
+			/* load balancing statistics */
+			total_len += proc_append_buffer(buf, 
+				"CPU | RUNABLE | TASKS | MIGRATED IN | MIGRATED OUT\n", 
+				total_len, -1, off, len);
+			for(unsigned int i=0;i<num_cpus;i++) {
+				cpu_t *c = get_cpu(i);
+				char tmp[128];
+				if(!c->active_queue)
+					continue;
+				sprintf(tmp, "%3d | %7d | %5d | %11d | %d\n", c->apicid, 
+					c->active_queue->num, c->numtasks, c->migrations_in, 
+					c->migrations_out);
+				total_len += proc_append_buffer(buf, tmp, total_len, -1, off, len);
+			}
+			break;
+#endif
+		case 3:
+			/* how long woken tasks waited to run, in cycles */
+			total_len += proc_append_buffer(buf, 
+				"CPU | WAKEUPS | WAKEUP IPIS | AVG CYCLES | MAX CYCLES\n", 
+				total_len, -1, off, len);
+#if CONFIG_SMP
+			for(unsigned int i=0;i<num_cpus;i++) {
+				cpu_t *c = get_cpu(i);
+				if(c->flags & CPU_TASK)
+					total_len += proc_wakeup_cpu(c, buf, total_len, off, len);
+			}
+#else
+			total_len += proc_wakeup_cpu(primary_cpu, buf, total_len, off, len);
+#endif
+			break;
+	}
+	return total_len;
+}
+
 #if CONFIG_MODULES
 
 int proc_mods(char rw, struct inode *n, int min, char *buf, int off, int len)
@@ -116,6 +168,10 @@ int proc_kern_rw(char rw, struct inode *inode, int m, char *buf, int off, int le
 #endif
 			case 4:
 				return proc_read_int(buf, off, len);
+#if CONFIG_LOCKSTAT
+			case 5:
+				return proc_read_mutex(buf, off, len);
+#endif
 #if CONFIG_BLOCK_CACHE
 			case 6:
 				return proc_read_bcache(buf, off, len);
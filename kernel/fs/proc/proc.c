@@ -30,11 +30,12 @@ int proc_mods(char rw, struct inode *n, int min, char *buf, int off, int len);
 int proc_cpu(char rw, struct inode *inode, int m, char *buf, int off, int len);
 int proc_vfs(char rw, struct inode *n, int m, char *buf, int off, int len);
 int proc_kern_rw(char rw, struct inode *inode, int m, char *buf, int off, int len);
+int proc_sched(char rw, struct inode *inode, int m, char *buf, int off, int len);
 int proc_rw_mem(char rw, struct inode *inode, int m, char *buf, int off, int len);
 
 int *pfs_table[64] = {
  (int *)proc_rw_mem, //Memory
- (int *)0, //Tasking
+ (int *)proc_sched, //Tasking
  (int *)proc_vfs, //VFS
  (int *)proc_kern_rw, //Kernel
 #if CONFIG_MODULES
@@ -74,7 +75,7 @@ struct inode *pfs_cn(char *name, mode_t  mode, int major, int minor)
 {
 	if(!name) return 0;
 	struct inode *i;
-	i = (struct inode*)kmalloc(sizeof(struct inode));
+	i = (struct inode *)kmem_cache_alloc(inode_cache);
 	strncpy(i->name, name, INAME_LEN);
 	i->i_ops = &procfs_inode_ops;
 	i->parent = procfs_root;
@@ -89,7 +90,7 @@ struct inode *pfs_cn_node(struct inode *to, char *name, mode_t mode, int major,
 {
 	if(!name) return 0;
 	struct inode *i;
-	i = (struct inode*)kmalloc(sizeof(struct inode));
+	i = (struct inode *)kmem_cache_alloc(inode_cache);
 	strncpy(i->name, name, INAME_LEN);
 	i->i_ops = &procfs_inode_ops;
 	i->parent = procfs_root;
@@ -126,7 +127,7 @@ int proc_append_buffer(char *buffer, char *data, int off, int len, int req_off,
 
 void init_proc_fs()
 {
-	procfs_root = (struct inode*)kmalloc(sizeof(struct inode));
+	procfs_root = (struct inode *)kmem_cache_alloc(inode_cache);
 	_strcpy(procfs_root->name, "proc");
 	procfs_root->i_ops = &procfs_inode_ops;
 	procfs_root->parent = current_task->thread->root;
@@ -137,12 +138,19 @@ void init_proc_fs()
 	pfs_cn("mem", S_IFREG, 0, 0);
 	struct inode *si = pfs_cn("sched", S_IFDIR, 1, 0);
 	pfs_cn_node(si, "pri_tty", S_IFREG, 1, 1);
+#if CONFIG_SMP
+	pfs_cn_node(si, "balance", S_IFREG, 1, 2);
+#endif
+	pfs_cn_node(si, "wakeup", S_IFREG, 1, 3);
 	pfs_cn("vfs", S_IFREG, 2, 0);
 	pfs_cn("kernel", S_IFREG, 3, 0);
 	pfs_cn("klogfile", S_IFREG, 3, 1);
 	pfs_cn("version", S_IFREG, 3, 2);
 	pfs_cn("swap", S_IFREG, 3, 3);
 	pfs_cn("isr", S_IFREG, 3, 4);
+#if CONFIG_LOCKSTAT
+	pfs_cn("lockstat", S_IFREG, 3, 5);
+#endif
 	pfs_cn("bcache", S_IFREG, 3, 6);
 	pfs_cn("modules", S_IFREG, 4, 0);
 	pfs_cn("mounts", S_IFREG, 2, 2);
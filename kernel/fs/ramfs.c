@@ -37,7 +37,7 @@ struct inode_operations rfs_inode_ops = {
 
 struct inode *init_ramfs()
 {
-	struct inode *i = (struct inode *)kmalloc(sizeof(struct inode));
+	struct inode *i = (struct inode *)kmem_cache_alloc(inode_cache);
 	i->mode = S_IFDIR | 0x1FF;
 	rwlock_create(&i->rwl);
 	_strcpy(i->name, "rfs");
@@ -48,7 +48,7 @@ struct inode *init_ramfs()
 
 struct inode *init_tmpfs()
 {
-	struct inode *i = (struct inode *)kmalloc(sizeof(struct inode));
+	struct inode *i = (struct inode *)kmem_cache_alloc(inode_cache);
 	i->mode = S_IFDIR | 0x1FF;
 	rwlock_create(&i->rwl);
 	_strcpy(i->name, "rfs");
@@ -103,7 +103,7 @@ struct inode *rfs_create(struct inode *__p, char *name, mode_t mode)
 	if(!__p)
 		p = ramfs_root;
 	struct inode *node;
-	node = (struct inode *)kmalloc(sizeof(struct inode));
+	node = (struct inode *)kmem_cache_alloc(inode_cache);
 	strncpy(node->name, name, INAME_LEN);
 	node->uid = current_task->thread->uid;
 	node->gid = current_task->thread->gid;
@@ -13,6 +13,7 @@
 #include <file.h>
 
 int system_setup=0;
+kmem_cache_t *inode_cache=0, *file_cache=0;
 /* This function is called once at the start of the init process initialization.
  * It sets the task fs values to possible and useful things, allowing VFS access.
  * It then starts the device and proc filesystems, and opens up /dev/tty1 on
@@ -39,7 +40,7 @@ int sys_setup(int a)
 	sys_open("/dev/tty1", O_RDWR);   /* stdin  */
 	sys_open("/dev/tty1", O_WRONLY); /* stdout */
 	sys_open("/dev/tty1", O_WRONLY); /* stderr */
-	current_task->tty=1;
+	task_set_tty((task_t *)current_task, 1);
 	system_setup=1;
 	printk(KERN_MILE, "done (i/o/e=%x [tty1]: ok)\n", 3*256+1);
 	return 12;
@@ -47,6 +48,8 @@ int sys_setup(int a)
 
 void init_vfs()
 {
+	inode_cache = kmem_cache_create("inode", sizeof(struct inode), 0, 0);
+	file_cache = kmem_cache_create("file", sizeof(struct file), 0, 0);
 	load_superblocktable();
 #if CONFIG_MODULES
 	add_kernel_symbol(do_iremove);
@@ -7,6 +7,7 @@
 #include <fcntl.h>
 #include <atomic.h>
 #include <rwlock.h>
+#include <pagecache.h>
 
 int is_directory(struct inode *i)
 {
@@ -67,6 +68,8 @@ int free_inode(struct inode *i, int recur)
 	assert(i && !i->parent);
 	assert(recur || !i->children.head);
 	destroy_flocks(i);
+	if(i->pcache)
+		pcache_release(i);
 	if(i->pipe)
 		free_pipe(i);
 	if(i->start)
@@ -4,6 +4,7 @@
 #include <asm/system.h>
 #include <dev.h>
 #include <fs.h>
+#include <pagecache.h>
 
 int write_fs(struct inode *i, off_t off, size_t len, char *b)
 {
@@ -13,6 +14,10 @@ int write_fs(struct inode *i, off_t off, size_t len, char *b)
 		return -EISDIR;
 	if(!permissions(i, MAY_WRITE))
 		return -EACCES;
+	/* tasks that already have pages of the file mapped keep the old
+	 * contents, but nothing new should be mapped from the cache */
+	if(i->pcache)
+		pcache_release(i);
 	return vfs_callback_write(i, off, len, b);
 }
 
@@ -17,6 +17,7 @@
 #include <symbol.h>
 #include <cache.h>
 #include <swap.h>
+#include <cpu.h>
 void get_timed(struct tm *now);
 int __KT_try_releasing_tasks();
 void __KT_try_handle_stage2_interrupts();
@@ -42,7 +43,7 @@ static inline int __KT_clear_args()
 
 struct inode *set_as_kernel_task(char *name)
 {
-	struct inode *i = (struct inode *)kmalloc(sizeof(struct inode));
+	struct inode *i = (struct inode *)kmem_cache_alloc(inode_cache);
 	rwlock_create(&i->rwl);
 	strncpy(i->name, name, INAME_LEN);
 	add_inode(kproclist, i);
@@ -54,7 +55,7 @@ struct inode *set_as_kernel_task(char *name)
 
 int init_kern_task()
 {
-	kproclist = (struct inode *)kmalloc(sizeof(struct inode));
+	kproclist = (struct inode *)kmem_cache_alloc(inode_cache);
 	_strcpy(kproclist->name, "kproclist");
 	kproclist->mode = S_IFDIR | 0xFFF;
 	kproclist->count=1;
@@ -102,6 +103,9 @@ int kernel_idle_task()
 	for(;;) {
 		task=__KT_try_releasing_tasks();
 		__KT_try_handle_stage2_interrupts();
+#if CONFIG_SMP
+		balance_cpu((cpu_t *)current_task->cpu, 1);
+#endif
 		schedule();
 		set_int(1);
 	}
@@ -9,6 +9,8 @@
 #include <cpu.h>
 #include <elf.h>
 #include <file.h>
+#include <exec.h>
+#include <mmfile.h>
 
 /* Prepares a process to recieve a new executable. Desc is the descriptor of 
  * the executable. We keep it open through here so that we dont have to 
@@ -19,6 +21,8 @@ task_t *preexec(task_t *t, int desc)
 {
 	if(t->magic != TASK_MAGIC)
 		panic(0, "Invalid task in exec (%d)", t->pid);
+	mmf_release_space();
+	exec_release_image();
 	free_thread_shared_directory();
 	t->sigd=0;
 	memset((void *)t->thread->signal_act, 0, sizeof(struct sigaction) * 128);
@@ -141,10 +145,10 @@ int do_exec(task_t *t, char *path, char **argv, char **env)
 	
 	if(EXEC_LOG == 2) 
 		printk(0, "[%d]: Updating task values\n", t->pid);
-	/* Setup the task with the proper values (libc malloc stack) */
-	addr_t end_l = end;
+	/* Setup the task with the proper values (libc malloc stack). The
+	 * program itself is read in as it is used, and the end of its last
+	 * page is zeroed when that happens */
 	end = (end&PAGE_MASK);
-	user_map_if_not_mapped_noclear(end);
 	/* now we need to copy back the args and env into userspace
 	 * writeable memory...yippie. */
 	addr_t args_start = end + PAGE_SIZE;
@@ -206,7 +210,6 @@ int do_exec(task_t *t, char *path, char **argv, char **env)
 		raise_task_flag(t, TF_OTHERBS);
 	user_map_if_not_mapped_noclear(t->heap_start);
 	/* Zero the heap and stack */
-	memset((void *)end_l, 0, PAGE_SIZE-(end_l%PAGE_SIZE));
 	memset((void *)(end+PAGE_SIZE), 0, PAGE_SIZE);
 	memset((void *)(STACK_LOCATION - STACK_SIZE), 0, STACK_SIZE);
 	/* Release everything */
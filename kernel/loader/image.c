@@ -0,0 +1,176 @@
+/* image.c - demand paging of executables
+ * exec only records the loadable segments of a program. The first time a
+ * task touches one of its pages, the page is read in from the file. Pages
+ * of read-only segments go through the inode's page cache and are mapped
+ * read-only, so every task running the same file shares them. Writable
+ * pages, and pages that more than one segment lands in, are private.
+ */
+#include <kernel.h>
+#include <memory.h>
+#include <task.h>
+#include <fs.h>
+#include <cpu.h>
+#include <atomic.h>
+#include <exec.h>
+#include <pagecache.h>
+
+struct exec_image *exec_image_create(struct inode *inode, unsigned max)
+{
+	struct exec_image *img = (void *)kmalloc(sizeof(struct exec_image)
+			+ max * sizeof(struct exec_segment));
+	img->count = 1;
+	img->max = max;
+	img->inode = inode;
+	add_atomic(&inode->count, 1);
+	return img;
+}
+
+int exec_image_add(struct exec_image *img, addr_t vaddr, size_t memsz,
+		off_t offset, size_t filesz, unsigned flags)
+{
+	if(img->num == img->max)
+		return -ENOEXEC;
+	if(filesz > memsz || offset < 0 || offset + filesz > (size_t)img->inode->len)
+		return -ENOEXEC;
+	if(vaddr < TOP_LOWER_KERNEL || vaddr + memsz > TOP_TASK_MEM_EXEC || vaddr + memsz < vaddr)
+		return -ENOEXEC;
+	struct exec_segment *s = &img->segs[img->num++];
+	s->vaddr = vaddr;
+	s->memsz = memsz;
+	s->offset = offset;
+	s->filesz = filesz;
+	s->flags = flags;
+	return 0;
+}
+
+struct exec_image *exec_image_get(struct exec_image *img)
+{
+	if(img)
+		add_atomic(&img->count, 1);
+	return img;
+}
+
+void exec_image_put(struct exec_image *img)
+{
+	if(!img || sub_atomic(&img->count, 1))
+		return;
+	iput(img->inode);
+	kfree(img);
+}
+
+/* called when the current address space is thrown away by exec or exit */
+void exec_release_image()
+{
+	struct exec_image *img = pd_cur_data->image;
+	pd_cur_data->image = 0;
+	exec_image_put(img);
+}
+
+/* map phys at addr unless another thread has mapped something there
+ * while we weren't holding the lock */
+static int exec_map_page(addr_t addr, addr_t phys, unsigned attr, unsigned opt)
+{
+	int ret = 0;
+	mutex_acquire(&pd_cur_data->lock);
+	if(!vm_do_getmap(addr, 0, 1)) {
+		vm_map(addr, phys, attr, opt | MAP_CRIT | MAP_PDLOCKED);
+		ret = 1;
+	}
+	mutex_release(&pd_cur_data->lock);
+	return ret;
+}
+
+/* a page can come from the page cache if it belongs to a single read-only
+ * segment, its file offset is page aligned, and it doesn't need any part
+ * of it zeroed */
+static int exec_page_shareable(struct exec_segment *s, addr_t addr)
+{
+	if(s->flags & ES_WRITE)
+		return 0;
+	if((s->vaddr - s->offset) & ~PAGE_MASK)
+		return 0;
+	return s->filesz == s->memsz || addr + PAGE_SIZE <= s->vaddr + s->filesz;
+}
+
+static int exec_map_shared(struct exec_image *img, struct exec_segment *s, addr_t addr)
+{
+	off_t off = s->offset - (s->vaddr - addr);
+	u64 index = off / PAGE_SIZE;
+	addr_t phys = pcache_find(img->inode, index);
+	if(phys) {
+		if(!exec_map_page(addr, phys, PAGE_PRESENT | PAGE_USER, MAP_NOCLEAR))
+			pm_free_page(phys);
+		return 1;
+	}
+	phys = pm_alloc_page();
+	if(!exec_map_page(addr, phys, PAGE_PRESENT | PAGE_WRITE | PAGE_USER, 0)) {
+		pm_free_page(phys);
+		return 1;
+	}
+	/* the end of the file may fall inside the page, the rest stays zero */
+	size_t len = PAGE_SIZE;
+	if(off + len > (size_t)img->inode->len)
+		len = img->inode->len - off;
+	if(read_fs(img->inode, off, len, (char *)addr) < 0) {
+		vm_unmap(addr);
+		return 0;
+	}
+	addr_t cached = pcache_insert(img->inode, index, phys);
+	vm_map(addr, cached, PAGE_PRESENT | PAGE_USER, MAP_CRIT | MAP_NOCLEAR);
+	if(cached != phys)
+		pm_free_page(phys);
+	return 1;
+}
+
+static int exec_map_private(struct exec_image *img, addr_t addr)
+{
+	addr_t phys = pm_alloc_page();
+	if(!exec_map_page(addr, phys, PAGE_PRESENT | PAGE_WRITE | PAGE_USER, 0)) {
+		pm_free_page(phys);
+		return 1;
+	}
+	for(unsigned i=0;i<img->num;i++) {
+		struct exec_segment *s = &img->segs[i];
+		addr_t lo = s->vaddr > addr ? s->vaddr : addr;
+		addr_t hi = s->vaddr + s->filesz;
+		if(hi > addr + PAGE_SIZE)
+			hi = addr + PAGE_SIZE;
+		if(lo >= hi)
+			continue;
+		if(read_fs(img->inode, s->offset + (lo - s->vaddr), hi - lo, (char *)lo) < 0) {
+			vm_unmap(addr);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* handle a fault on a page of the running program that hasn't been read
+ * in yet. Reading the file may have to wait for the disk, so interrupts
+ * are enabled if the faulting code had them enabled */
+int exec_image_fault(addr_t addr, unsigned err_code, int can_sleep)
+{
+	struct exec_image *img = pd_cur_data->image;
+	if(!img || (err_code & 1))
+		return 0;
+	addr &= PAGE_MASK;
+	struct exec_segment *seg = 0;
+	unsigned n = 0;
+	for(unsigned i=0;i<img->num;i++) {
+		struct exec_segment *s = &img->segs[i];
+		if(addr + PAGE_SIZE > s->vaddr && addr < s->vaddr + s->memsz) {
+			if(!n++)
+				seg = s;
+		}
+	}
+	if(!n)
+		return 0;
+	int old = set_int(can_sleep ? 1 : 0);
+	int ret;
+	if(n == 1 && exec_page_shareable(seg, addr))
+		ret = exec_map_shared(img, seg, addr);
+	else
+		ret = exec_map_private(img, addr);
+	set_int(old);
+	return ret;
+}
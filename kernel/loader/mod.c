@@ -7,6 +7,7 @@
 #include <module.h>
 #include <elf.h>
 #include <symbol.h>
+#include <rcu.h>
 module_t *modules=0;
 int load_deps(char *);
 mutex_t mod_mutex;
@@ -47,6 +48,7 @@ void init_kernel_symbols(void)
 	add_kernel_symbol(__rwlock_escalate);
 	add_kernel_symbol(rwlock_create);
 	add_kernel_symbol(rwlock_destroy);
+	add_kernel_symbol(synchronize_rcu);
 	
 	/* these systems export these, but have no initialization function */
 	add_kernel_symbol(get_epoch_time);
@@ -67,26 +69,31 @@ void _add_kernel_symbol(const intptr_t func, const char * funcstr)
 	if(i >= MAX_SYMS)
 		panic(0, "ran out of space on symbol table");
 	export_syms[i].name = funcstr;
-	export_syms[i].ptr = func;
+	/* a non-zero ptr is what makes the entry visible to lookups */
+	rcu_assign_pointer(export_syms[i].ptr, func);
 	mutex_release(&sym_mutex);
 }
 
+/* lookups don't take sym_mutex. Entries are only reused after an rcu
+ * grace period (see remove_kernel_symbol) */
 intptr_t find_kernel_function(char * unres)
 {
 	uint32_t i;
-	mutex_acquire(&sym_mutex);
+	intptr_t ptr = 0;
+	int len = strlen(unres);
+	int old = rcu_read_lock();
 	for(i = 0; i < MAX_SYMS; i++)
 	{
-		if(export_syms[i].ptr && 
-			strlen(export_syms[i].name) == strlen(unres) &&
-			!memcmp((uint8_t*)export_syms[i].name, (uint8_t*)unres, 
-					(int)strlen(unres))) {
-			mutex_release(&sym_mutex);
-			return export_syms[i].ptr;
+		addr_t p = rcu_dereference(export_syms[i].ptr);
+		if(p && 
+			strlen(export_syms[i].name) == (size_t)len &&
+			!memcmp((uint8_t*)export_syms[i].name, (uint8_t*)unres, len)) {
+			ptr = p;
+			break;
 		}
 	}
-	mutex_release(&sym_mutex);
-	return 0;
+	rcu_read_unlock(old);
+	return ptr;
 }
 
 int remove_kernel_symbol(char * unres)
@@ -101,6 +108,9 @@ int remove_kernel_symbol(char * unres)
 					(int)strlen(unres)))
 		{
 			export_syms[i].ptr=0;
+			/* don't let the entry be reused while someone might
+			 * still be looking at it */
+			synchronize_rcu();
 			mutex_release(&sym_mutex);
 			return 1;
 		}
@@ -0,0 +1,120 @@
+/* lockstat.c - per call-site lock contention statistics
+ * Sites are kept in a fixed-size hash table, keyed by the file and line
+ * that the lock was acquired from. Nothing here may allocate memory or
+ * take a lock, since it's called from inside the lock code.
+ */
+#include <config.h>
+#if CONFIG_LOCKSTAT
+#include <kernel.h>
+#include <atomic.h>
+#include <lockstat.h>
+#include <asm/system.h>
+
+static struct lockstat_site lockstat_sites[LOCKSTAT_SITES];
+static unsigned long lockstat_dropped=0;
+
+static unsigned __ls_hash(char *file, int line)
+{
+	return (unsigned)(((addr_t)file >> 2) ^ (line * 31)) & (LOCKSTAT_SITES - 1);
+}
+
+/* returns null if the table is full */
+struct lockstat_site *lockstat_site(char *file, int line, int type)
+{
+	unsigned h = __ls_hash(file, line);
+	for(unsigned i=0;i<LOCKSTAT_SITES;i++) {
+		struct lockstat_site *s = &lockstat_sites[(h + i) & (LOCKSTAT_SITES - 1)];
+		if(!s->file && cas_atomic(&s->file, 0, file)) {
+			s->line = line;
+			s->type = type;
+			s->ready = 1;
+			return s;
+		}
+		if(s->file != file)
+			continue;
+		/* someone else may be filling in this entry right now */
+		while(!s->ready) {
+			asm("pause");
+		}
+		if(s->line == line)
+			return s;
+	}
+	add_atomic(&lockstat_dropped, 1);
+	return 0;
+}
+
+static int __ls_lock(struct lockstat_site *s)
+{
+	int old = set_int(0);
+	while(bts_atomic(&s->lock, 0)) {
+		asm("pause");
+	}
+	return old;
+}
+
+static void __ls_unlock(struct lockstat_site *s, int old)
+{
+	btr_atomic(&s->lock, 0);
+	set_int(old);
+}
+
+void lockstat_acquired(struct lockstat_site *s, unsigned long long wait, int contended)
+{
+	if(!s)
+		return;
+	int old = __ls_lock(s);
+	s->acquired++;
+	if(contended)
+		s->contended++;
+	s->wait_total += wait;
+	if(wait > s->wait_max)
+		s->wait_max = wait;
+	__ls_unlock(s, old);
+}
+
+void lockstat_released(struct lockstat_site *s, unsigned long long hold)
+{
+	if(!s)
+		return;
+	int old = __ls_lock(s);
+	s->hold_total += hold;
+	if(hold > s->hold_max)
+		s->hold_max = hold;
+	__ls_unlock(s, old);
+}
+
+int proc_append_buffer(char *buffer, char *data, int off, int len, 
+		int req_off, int req_len);
+
+/* vsprintf can't print 64 bit numbers on x86, so totals are printed in
+ * units of 1024 cycles */
+int proc_read_mutex(char *buf, int off, int len)
+{
+	int total_len=0;
+	char tmp[256];
+	total_len += proc_append_buffer(buf, 
+		"SITE                                | ACQUIRED | CONTENDED | WAIT KCYC | WAIT MAX | HOLD KCYC | HOLD MAX\n",
+		total_len, -1, off, len);
+	for(int i=0;i<LOCKSTAT_SITES;i++) {
+		struct lockstat_site *s = &lockstat_sites[i];
+		if(!s->ready || !s->acquired)
+			continue;
+		char site[64];
+		int fl = strlen(s->file);
+		/* keep the end of long paths */
+		sprintf(site, "%s%s:%d", s->type == LS_RWLOCK ? "rw " : "", 
+			fl > 40 ? s->file + fl - 40 : s->file, s->line);
+		sprintf(tmp, "%-35s | %8u | %9u | %9u | %8u | %9u | %u\n", site, 
+			s->acquired, s->contended, (unsigned long)(s->wait_total >> 10), 
+			(unsigned long)s->wait_max, (unsigned long)(s->hold_total >> 10), 
+			(unsigned long)s->hold_max);
+		total_len += proc_append_buffer(buf, tmp, total_len, -1, off, len);
+	}
+	if(lockstat_dropped) {
+		sprintf(tmp, "%d acquisitions not recorded (table full)\n", lockstat_dropped);
+		total_len += proc_append_buffer(buf, tmp, total_len, -1, off, len);
+	}
+	return total_len;
+}
+
+#endif
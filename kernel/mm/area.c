@@ -1,81 +1,210 @@
-/* Allocates sections of vmem. This allows us to allocate sections 
- * of any range of virtual memory, effectively allowing better 
- * management of those allocations. Copyright (c) 2010 Daniel Bittman. 
- * Written to allow easier implementation of slab allocation. 
+/* Allocates sections of vmem. This allows us to allocate sections
+ * of any range of virtual memory, effectively allowing better
+ * management of those allocations. Copyright (c) 2010 Daniel Bittman.
+ * Written to allow easier implementation of slab allocation.
+ *
+ * Regions are kept in an AVL tree sorted by address, where each node
+ * also tracks the free gap before it and the largest gap in its subtree.
+ * Allocation takes the lowest gap that fits (or the space after the last
+ * region), so insert, remove and lookup are all O(log n).
  */
 #include <kernel.h>
 #include <memory.h>
 #include <task.h>
-#define NUM_NODES(v) ((((v->num_ipages*PAGE_SIZE)/sizeof(vnode_t)) > \
-			MAX_NODES) ? MAX_NODES : ((v->num_ipages*PAGE_SIZE)/sizeof(vnode_t)))
-static vnode_t *get_node_insert_location(vma_t *v, unsigned num_p)
-{
-	vnode_t *n = (vnode_t *)v->first;
-	while(n && (addr_t)n < (v->addr + v->num_ipages*PAGE_SIZE))
-	{
-		if((n->addr + n->num_pages*PAGE_SIZE) + num_p*PAGE_SIZE >= v->max)
+
+#define NUM_NODES(v) ((v->num_ipages*PAGE_SIZE)/sizeof(vnode_t))
+#define DATA_START(v) (v->addr + v->num_ipages*PAGE_SIZE)
+#define NODE_END(n) ((n)->addr + (n)->num_pages*PAGE_SIZE)
+#define height(n) ((n) ? (n)->height : 0)
+#define max_gap(n) ((n) ? (n)->max_gap : 0)
+
+/* node slots are taken from the index in order, and mapped as the index
+ * grows. Freed ones are reused first */
+static vnode_t *vnode_alloc(vma_t *v)
+{
+	vnode_t *n = v->free_nodes;
+	if(n)
+		v->free_nodes = n->right;
+	else {
+		if(v->num_nodes >= NUM_NODES(v))
 			return 0;
-		if(n->next)
-		{
-			if(n->next->addr <= n->addr)
-				panic(PANIC_MEM | PANIC_NOSYNC, "vmem alloc index not sorted "
-												"(virtual memory corrupted)!");
-			if(((n->next->addr - 
-					(n->addr + n->num_pages*PAGE_SIZE)) / PAGE_SIZE) >= num_p)
-				break;
-		} else
-		{
-			/* Do we have room for one more? */
-			if((((addr_t)n + sizeof(vnode_t)) > 
-					(v->addr+v->num_ipages*PAGE_SIZE)))
-				return 0;
-			break;
+		n = (vnode_t *)(v->addr + v->num_nodes*sizeof(vnode_t));
+		map_if_not_mapped((addr_t)n);
+		map_if_not_mapped((addr_t)(n + 1) - 1);
+		v->num_nodes++;
+	}
+	memset(n, 0, sizeof(vnode_t));
+	n->height = 1;
+	return n;
+}
+
+static void vnode_free(vma_t *v, vnode_t *n)
+{
+	n->left = n->parent = 0;
+	n->right = v->free_nodes;
+	v->free_nodes = n;
+}
+
+static void __update(vnode_t *n)
+{
+	unsigned g = n->gap;
+	if(max_gap(n->left) > g) g = max_gap(n->left);
+	if(max_gap(n->right) > g) g = max_gap(n->right);
+	n->max_gap = g;
+	int h = height(n->left) > height(n->right) ? height(n->left) : height(n->right);
+	n->height = h + 1;
+}
+
+/* recalculate the gaps of n and its ancestors */
+static void __update_path(vnode_t *n)
+{
+	for(;n;n = n->parent)
+		__update(n);
+}
+
+/* put new where old is in the tree */
+static void __replace(vma_t *v, vnode_t *old, vnode_t *new)
+{
+	if(!old->parent)
+		v->root = new;
+	else if(old->parent->left == old)
+		old->parent->left = new;
+	else
+		old->parent->right = new;
+	if(new)
+		new->parent = old->parent;
+}
+
+static vnode_t *__rotate_left(vma_t *v, vnode_t *x)
+{
+	vnode_t *y = x->right;
+	x->right = y->left;
+	if(y->left)
+		y->left->parent = x;
+	__replace(v, x, y);
+	y->left = x;
+	x->parent = y;
+	__update(x);
+	__update(y);
+	return y;
+}
+
+static vnode_t *__rotate_right(vma_t *v, vnode_t *x)
+{
+	vnode_t *y = x->left;
+	x->left = y->right;
+	if(y->right)
+		y->right->parent = x;
+	__replace(v, x, y);
+	y->right = x;
+	x->parent = y;
+	__update(x);
+	__update(y);
+	return y;
+}
+
+/* walk up from n, fixing heights and gaps, and rotating wherever the
+ * tree has become unbalanced */
+static void __rebalance(vma_t *v, vnode_t *n)
+{
+	while(n) {
+		__update(n);
+		int b = height(n->left) - height(n->right);
+		if(b > 1) {
+			if(height(n->left->left) < height(n->left->right))
+				__rotate_left(v, n->left);
+			n = __rotate_right(v, n);
+		} else if(b < -1) {
+			if(height(n->right->right) < height(n->right->left))
+				__rotate_right(v, n->right);
+			n = __rotate_left(v, n);
 		}
-		n=n->next;
+		n = n->parent;
 	}
-	if((addr_t)n >= (v->addr + v->num_ipages*PAGE_SIZE))
-		return 0;
+}
+
+static vnode_t *__first(vnode_t *n)
+{
+	while(n && n->left)
+		n = n->left;
 	return n;
 }
 
+static vnode_t *__last(vnode_t *n)
+{
+	while(n && n->right)
+		n = n->right;
+	return n;
+}
+
+static vnode_t *__next(vnode_t *n)
+{
+	if(n->right)
+		return __first(n->right);
+	while(n->parent && n->parent->right == n)
+		n = n->parent;
+	return n->parent;
+}
+
+/* the lowest region that has at least num_p free pages before it */
+static vnode_t *__find_gap(vma_t *v, unsigned num_p)
+{
+	vnode_t *n = v->root;
+	if(max_gap(n) < num_p)
+		return 0;
+	while(n) {
+		if(max_gap(n->left) >= num_p)
+			n = n->left;
+		else if(n->gap >= num_p)
+			return n;
+		else
+			n = n->right;
+	}
+	panic(PANIC_MEM | PANIC_NOSYNC, "vmem alloc index corrupted (gaps don't add up)");
+	return 0;
+}
+
 vnode_t *insert_vmem_area(vma_t *v, unsigned num_p)
 {
 	assert(v && num_p);
-	if((num_p * PAGE_SIZE + v->addr+(v->num_ipages*PAGE_SIZE)) > v->max)
+	if((num_p * PAGE_SIZE + DATA_START(v)) > v->max)
 		return 0;
 	mutex_acquire(&v->lock);
-	vnode_t *n = (vnode_t *)v->first;
-	vnode_t *newn=0;
-	if(!n)
-	{
-		assert(!v->nodes[0]);
-		n = (vnode_t *)v->addr;
-		n->addr = v->addr + v->num_ipages*PAGE_SIZE;
-		n->num_pages = num_p;
-		n->next=0;
-		v->nodes[0]=1;
-		newn=n;
-		v->first = n;
-	} else
-	{
-		n = get_node_insert_location(v, num_p);
-		if(!n) 
+	vnode_t *newn = 0, *next = __find_gap(v, num_p);
+	addr_t addr;
+	if(next)
+		addr = next->addr - next->gap*PAGE_SIZE;
+	else {
+		/* no room between regions, so it goes after the last one */
+		vnode_t *last = __last(v->root);
+		addr = last ? NODE_END(last) : DATA_START(v);
+		if(addr + num_p*PAGE_SIZE > v->max || addr + num_p*PAGE_SIZE < addr)
 			goto out;
-		/* n is the node to insert after. */
-		unsigned i=0;
-		while(i < NUM_NODES(v) && v->nodes[i]) ++i;
-		assert(i<NUM_NODES(v));
-		v->nodes[i]=1;
-		newn = (vnode_t *)(v->addr + i*sizeof(vnode_t));
-		memset(newn, 0, sizeof(vnode_t));
-		newn->next = n->next;
-		n->next = newn;
-		newn->num_pages = num_p;
-		newn->addr = n->addr + n->num_pages * PAGE_SIZE;
-		if(newn->next)
-			assert(newn->num_pages * PAGE_SIZE + newn->addr <= newn->next->addr);
-		assert(n->num_pages * PAGE_SIZE + n->addr <= n->next->addr);
 	}
+	if(!(newn = vnode_alloc(v)))
+		goto out;
+	newn->addr = addr;
+	newn->num_pages = num_p;
+	/* link it in just before next (or at the end) */
+	vnode_t *p;
+	if(!next) {
+		if((p = __last(v->root)))
+			p->right = newn;
+		else
+			v->root = newn;
+	} else if(!next->left) {
+		p = next;
+		p->left = newn;
+	} else {
+		p = __last(next->left);
+		p->right = newn;
+	}
+	newn->parent = p;
+	if(next) {
+		next->gap -= num_p;
+		__update_path(next);
+	}
+	__rebalance(v, newn);
 	v->used_nodes++;
 	out:
 	mutex_release(&v->lock);
@@ -85,21 +214,34 @@ vnode_t *insert_vmem_area(vma_t *v, unsigned num_p)
 int remove_vmem_area(vma_t *v, vnode_t *n)
 {
 	mutex_acquire(&v->lock);
-	if(n == v->first)
-		v->first = n->next;
-	else
-	{
-		vnode_t *t = v->first;
-		while(t && t->next != n) t=t->next;
-		assert(t);
-		t->next = n->next;
-	}
-	n->next=0;
-	unsigned i = (unsigned)(((addr_t)n - v->addr) / sizeof(vnode_t));
 	assert((addr_t)n >= (addr_t)v->addr);
-	assert((addr_t)n < ((addr_t)v->addr + v->num_ipages*PAGE_SIZE));
-	assert(i < NUM_NODES(v));
-	v->nodes[i]=0;
+	assert((addr_t)n < DATA_START(v));
+	/* the freed pages become part of the gap before the next region */
+	vnode_t *next = __next(n);
+	if(next) {
+		next->gap += n->gap + n->num_pages;
+		__update_path(next);
+	}
+	vnode_t *fix;
+	if(n->left && n->right) {
+		/* next has no left child. Move it into n's place */
+		if(next->parent == n)
+			fix = next;
+		else {
+			fix = next->parent;
+			__replace(v, next, next->right);
+			next->right = n->right;
+			next->right->parent = next;
+		}
+		__replace(v, n, next);
+		next->left = n->left;
+		next->left->parent = next;
+	} else {
+		fix = n->parent;
+		__replace(v, n, n->left ? n->left : n->right);
+	}
+	__rebalance(v, fix);
+	vnode_free(v, n);
 	v->used_nodes--;
 	mutex_release(&v->lock);
 	return 0;
@@ -110,11 +252,14 @@ vnode_t *find_vmem_area(vma_t *v, addr_t addr)
 	if(!v)
 		return 0;
 	mutex_acquire(&v->lock);
-	vnode_t *t = v->first;
+	vnode_t *t = v->root;
 	while(t) {
-		if(addr >= t->addr && addr < (t->addr + t->num_pages*PAGE_SIZE))
+		if(addr < t->addr)
+			t = t->left;
+		else if(addr >= NODE_END(t))
+			t = t->right;
+		else
 			break;
-		t=t->next;
 	}
 	mutex_release(&v->lock);
 	return t;
@@ -127,9 +272,6 @@ int init_vmem_area(vma_t *v, addr_t addr, addr_t max, int num_ipages)
 	v->num_ipages=num_ipages;
 	v->max = max;
 	v->used_nodes=0;
-	int i;
-	for(i=0;i<num_ipages;i++)
-		map_if_not_mapped(addr + i * PAGE_SIZE);
 	mutex_create(&v->lock, 0);
 	return 0;
 }
@@ -0,0 +1,282 @@
+/* buddy.c - physical page allocator
+ * Free memory is kept in blocks of 2^order pages. Blocks are split in
+ * half to satisfy smaller requests, and a freed block is merged with its
+ * 'buddy' (the other half of the block it was split from) whenever that
+ * is free too. Memory below PM_DMA_LIMIT is kept in its own zone and only
+ * used for normal allocations once the rest has run out.
+ */
+#include <kernel.h>
+#include <memory.h>
+#include <task.h>
+#include <cpu.h>
+#include <atomic.h>
+#include <buddy.h>
+#include <shrink.h>
+
+static struct page_frame *pm_frames = (struct page_frame *)PM_FRAMES_ADDR;
+static struct pm_zone pm_zones[PM_NUM_ZONES];
+static addr_t pm_max_pfn=0;
+
+#define addr_to_pfn(a) ((u32)((a) / PAGE_SIZE))
+#define pfn_to_addr(p) ((addr_t)(p) * PAGE_SIZE)
+#define pfn_zone(p) (pfn_to_addr(p) < PM_DMA_LIMIT ? PM_ZONE_DMA : PM_ZONE_NORMAL)
+/* how long a task sleeps before trying again, under OOM_SLEEP */
+#define OOM_SLEEP_TICKS (current_hz / 10 + 1)
+
+/* map and clear the frame array. This is called before any memory is
+ * given to the allocator, so the pages come from pm_location */
+void pm_init_frames(addr_t highest)
+{
+	pm_max_pfn = addr_to_pfn(highest) + 1;
+	addr_t end = PM_FRAMES_ADDR + pm_max_pfn * sizeof(struct page_frame);
+	if(end > PM_FRAMES_ADDR_TOP || end < PM_FRAMES_ADDR)
+		panic(PANIC_MEM | PANIC_NOSYNC, "Too much physical memory to keep track of");
+	addr_t a;
+	for(a = PM_FRAMES_ADDR; a < end; a += PAGE_SIZE)
+		vm_map(a, pm_alloc_page(), PAGE_PRESENT | PAGE_WRITE, MAP_CRIT);
+	int z, o;
+	for(z=0;z<PM_NUM_ZONES;z++) {
+		for(o=0;o<PM_MAX_ORDER;o++)
+			pm_zones[z].free_list[o] = PFN_NONE;
+	}
+}
+
+static void frame_list_add(struct pm_zone *z, u32 pfn, unsigned order)
+{
+	struct page_frame *f = &pm_frames[pfn];
+	f->prev = PFN_NONE;
+	f->next = z->free_list[order];
+	if(f->next != PFN_NONE)
+		pm_frames[f->next].prev = pfn;
+	z->free_list[order] = pfn;
+	f->order = order;
+	f->flags |= PF_FREE;
+	z->num_free[order]++;
+	z->free_pages += 1 << order;
+}
+
+static void frame_list_del(struct pm_zone *z, u32 pfn)
+{
+	struct page_frame *f = &pm_frames[pfn];
+	if(f->prev != PFN_NONE)
+		pm_frames[f->prev].next = f->next;
+	else
+		z->free_list[f->order] = f->next;
+	if(f->next != PFN_NONE)
+		pm_frames[f->next].prev = f->prev;
+	f->flags &= ~PF_FREE;
+	z->num_free[f->order]--;
+	z->free_pages -= 1 << f->order;
+}
+
+/* the buddy functions must be called with pm_mutex held */
+static addr_t buddy_alloc(int zone, unsigned order)
+{
+	struct pm_zone *z = &pm_zones[zone];
+	unsigned o = order;
+	while(o < PM_MAX_ORDER && z->free_list[o] == PFN_NONE)
+		o++;
+	if(o == PM_MAX_ORDER)
+		return 0;
+	u32 pfn = z->free_list[o];
+	frame_list_del(z, pfn);
+	/* split the block, giving back the upper halves */
+	while(o > order) {
+		o--;
+		frame_list_add(z, pfn + (1 << o), o);
+	}
+	pm_frames[pfn].order = order;
+	return pfn_to_addr(pfn);
+}
+
+static void buddy_free(addr_t addr, unsigned order)
+{
+	u32 pfn = addr_to_pfn(addr);
+	int zone = pfn_zone(pfn);
+	struct pm_zone *z = &pm_zones[zone];
+	if(pm_frames[pfn].flags & PF_FREE)
+		panic(PANIC_MEM | PANIC_NOSYNC, "physical page %x freed twice", addr);
+	while(order < PM_MAX_ORDER-1) {
+		u32 buddy = pfn ^ (1 << order);
+		if(buddy >= pm_max_pfn || pfn_zone(buddy) != zone)
+			break;
+		struct page_frame *b = &pm_frames[buddy];
+		if(!(b->flags & PF_FREE) || b->order != order)
+			break;
+		frame_list_del(z, buddy);
+		pfn &= ~(1 << order);
+		order++;
+	}
+	frame_list_add(z, pfn, order);
+}
+
+static struct pm_cpu_pages *pm_get_cpu_pages()
+{
+	cpu_t *cpu = current_task ? current_task->cpu : 0;
+	return cpu ? &cpu->pm_pages : 0;
+}
+
+/* single pages from the normal zone come from the current cpu's list,
+ * which is refilled PM_CPU_BATCH pages at a time */
+static addr_t pm_cpu_alloc()
+{
+	addr_t ret = 0;
+	if(!pm_get_cpu_pages())
+		return 0;
+	int old = set_int(0);
+	struct pm_cpu_pages *pcp = pm_get_cpu_pages();
+	if(pcp->num)
+		ret = pcp->pages[--pcp->num];
+	set_int(old);
+	if(ret)
+		return ret;
+	mutex_acquire(&pm_mutex);
+	old = set_int(0);
+	pcp = pm_get_cpu_pages();
+	while(pcp->num < PM_CPU_BATCH) {
+		addr_t p = buddy_alloc(PM_ZONE_NORMAL, 0);
+		if(!p)
+			break;
+		pcp->pages[pcp->num++] = p;
+	}
+	if(pcp->num)
+		ret = pcp->pages[--pcp->num];
+	set_int(old);
+	mutex_release(&pm_mutex);
+	return ret;
+}
+
+static int pm_cpu_free(addr_t addr)
+{
+	if(pfn_zone(addr_to_pfn(addr)) != PM_ZONE_NORMAL || !pm_get_cpu_pages())
+		return 0;
+	int old = set_int(0);
+	struct pm_cpu_pages *pcp = pm_get_cpu_pages();
+	if(pcp->num < PM_CPU_PAGES) {
+		pcp->pages[pcp->num++] = addr;
+		set_int(old);
+		return 1;
+	}
+	set_int(old);
+	/* the list is full. Give back the pages that were freed longest ago,
+	 * since they are the least likely to still be in the cache */
+	mutex_acquire(&pm_mutex);
+	old = set_int(0);
+	pcp = pm_get_cpu_pages();
+	if(pcp->num == PM_CPU_PAGES) {
+		unsigned i;
+		for(i=0;i<PM_CPU_BATCH;i++)
+			buddy_free(pcp->pages[i], 0);
+		memmove(pcp->pages, pcp->pages + PM_CPU_BATCH,
+				(PM_CPU_PAGES - PM_CPU_BATCH) * sizeof(addr_t));
+		pcp->num -= PM_CPU_BATCH;
+	}
+	pcp->pages[pcp->num++] = addr;
+	set_int(old);
+	mutex_release(&pm_mutex);
+	return 1;
+}
+
+/* allocate 2^order physically contiguous pages, aligned to their size */
+addr_t __pm_alloc_pages(unsigned order, unsigned flags, char *file, int line)
+{
+	assert(order < PM_MAX_ORDER);
+	if(!memory_has_been_mapped)
+		panic(PANIC_MEM | PANIC_NOSYNC, "Physical memory allocation before initilization");
+	addr_t ret;
+	unsigned flag=0;
+	try_again:
+	ret=0;
+	if(!order && !(flags & PM_DMA))
+		ret = pm_cpu_alloc();
+	if(!ret) {
+		mutex_acquire(&pm_mutex);
+		if(!(flags & PM_DMA))
+			ret = buddy_alloc(PM_ZONE_NORMAL, order);
+		if(!ret)
+			ret = buddy_alloc(PM_ZONE_DMA, order);
+		mutex_release(&pm_mutex);
+	}
+	if(!ret && (flags & PM_TRY))
+		return 0;
+	/* out of physical memory!! See if the caches can give some back
+	 * before we do anything drastic */
+	if(!ret && shrink_memory(1 << order))
+		goto try_again;
+	if(!ret) {
+		if(current_task == kernel_task || !current_task)
+			panic(PANIC_MEM | PANIC_NOSYNC, "Ran out of physical memory");
+		if(OOM_HANDLER == OOM_SLEEP) {
+			/* wait for someone else to free memory */
+			if(!flag++)
+				printk(0, "Warning - Ran out of physical memory in task %d\n",
+						current_task->pid);
+			if(task_can_sleep())
+				delay(OOM_SLEEP_TICKS);
+			else
+				schedule();
+			goto try_again;
+		} else if(OOM_HANDLER == OOM_KILL)
+		{
+			printk(0, "Warning - Ran out of physical memory in task %d. Killing...\n",
+					current_task->pid);
+			exit(-10);
+		}
+		else
+			panic(PANIC_MEM | PANIC_NOSYNC, "Ran out of physical memory");
+	}
+	if(ret < pm_location || ret > highest_page || ret < lowest_page)
+		panic(PANIC_MEM | PANIC_NOSYNC, "found invalid physical page: %x\n", ret);
+	add_atomic(&pm_used_pages, 1 << order);
+	if(current_task) {
+		current_task->allocated++;
+		current_task->phys_mem_usage += 1 << order;
+		current_task->num_pages += 1 << order;
+	}
+	return ret;
+}
+
+void pm_free_pages(addr_t addr, unsigned order)
+{
+	assert(order < PM_MAX_ORDER);
+	if(addr < pm_location || addr > highest_page || addr < lowest_page
+			|| (addr & ((PAGE_SIZE << order) - 1)))
+		panic(PANIC_MEM | PANIC_NOSYNC, "tried to free invalid physical address (%x)", addr);
+	if(!order) {
+		/* a shared page is only freed once the last mapping is gone */
+		struct page_frame *f = &pm_frames[addr_to_pfn(addr)];
+		if(f->count && sub_atomic(&f->count, 1) >= 0)
+			return;
+		f->count = 0;
+	}
+	if(current_task) {
+		current_task->freed++;
+		current_task->phys_mem_usage -= 1 << order;
+		if(current_task->num_pages >= (1U << order))
+			current_task->num_pages -= 1 << order;
+	}
+	sub_atomic(&pm_used_pages, 1 << order);
+	if(!order && pm_cpu_free(addr))
+		return;
+	mutex_acquire(&pm_mutex);
+	buddy_free(addr, order);
+	mutex_release(&pm_mutex);
+}
+
+/* add another reference to a page that is about to be mapped into a
+ * second address space. Returns 0 if the page isn't ours to share */
+int pm_page_share(addr_t addr)
+{
+	if(addr < pm_location || addr > highest_page || addr < lowest_page
+			|| addr_to_pfn(addr) >= pm_max_pfn)
+		return 0;
+	add_atomic(&pm_frames[addr_to_pfn(addr)].count, 1);
+	return 1;
+}
+
+int pm_page_is_shared(addr_t addr)
+{
+	if(addr_to_pfn(addr) >= pm_max_pfn)
+		return 0;
+	return pm_frames[addr_to_pfn(addr)].count > 0;
+}
@@ -6,13 +6,20 @@
 #include <task.h>
 addr_t (*do_kmalloc_wrap)(size_t, char)=0;
 void (*do_kfree_wrap)(void *)=0;
+/* optional per-cpu caches in front of the allocator. These are called
+ * without km_m held, and return 0 if the request wasn't handled */
+addr_t (*do_kmalloc_cpu_wrap)(size_t, char)=0;
+int (*do_kfree_cpu_wrap)(void *)=0;
 char kmalloc_name[128];
 mutex_t km_m;
 void install_kmalloc(char *name, unsigned (*init)(addr_t, addr_t), 
-	addr_t (*alloc)(size_t, char), void (*free)(void *))
+	addr_t (*alloc)(size_t, char), void (*free)(void *), 
+	addr_t (*cpu_alloc)(size_t, char), int (*cpu_free)(void *))
 {
 	do_kmalloc_wrap = alloc;
 	do_kfree_wrap = free;
+	do_kmalloc_cpu_wrap = cpu_alloc;
+	do_kfree_cpu_wrap = cpu_free;
 	strncpy(kmalloc_name, name, 128);
 	mutex_create(&km_m, 0);
 	if(init)
@@ -23,9 +30,12 @@ addr_t do_kmalloc(size_t sz, char align, char *file, int line)
 {
 	if(!do_kmalloc_wrap)
 		panic(PANIC_MEM | PANIC_NOSYNC, "No kernel-level allocator installed!");
-	mutex_acquire(&km_m);
-	addr_t ret = do_kmalloc_wrap(sz, align);
-	mutex_release(&km_m);
+	addr_t ret = do_kmalloc_cpu_wrap ? do_kmalloc_cpu_wrap(sz, align) : 0;
+	if(!ret) {
+		mutex_acquire(&km_m);
+		ret = do_kmalloc_wrap(sz, align);
+		mutex_release(&km_m);
+	}
 	if(!ret || ret >= KMALLOC_ADDR_END || ret < KMALLOC_ADDR_START)
 		panic(PANIC_MEM | PANIC_NOSYNC, "kmalloc returned impossible address");
 	memset((void *)ret, 0, sz);
@@ -61,6 +71,8 @@ void *__kmalloc_ap(size_t s, addr_t *p, char *file, int line)
 void kfree(void *pt)
 {
 	if(!pt) return;
+	if(do_kfree_cpu_wrap && do_kfree_cpu_wrap(pt))
+		return;
 	mutex_acquire(&km_m);
 	if(do_kfree_wrap)
 		do_kfree_wrap(pt);
@@ -7,6 +7,8 @@
 #include <symbol.h>
 #include <atomic.h>
 #include <pmap.h>
+#include <ll.h>
+#include <shrink.h>
 
 void slab_stat(struct mem_stat *s);
 void process_memorymap(struct multiboot *mboot)
@@ -14,6 +16,8 @@ void process_memorymap(struct multiboot *mboot)
 	addr_t i = mboot->mmap_addr;
 	unsigned int num_pages=0;
 	addr_t j=0;
+	/* find out how much memory there is first, so that the page frame
+	 * array can be set up before we start freeing pages into it */
 	while(i < (mboot->mmap_addr + mboot->mmap_length)){
 		mmap_entry_t *me = (mmap_entry_t *)(i);
 		printk(1, "[mm]: Map %d: %x -> %x\n", me->type, me->base_addr_low, 
@@ -27,8 +31,6 @@ void process_memorymap(struct multiboot *mboot)
 					lowest_page=j;
 				if(j > highest_page)
 					highest_page=j;
-				if(j >= pm_location)
-					pm_free_page(j);
 				num_pages++;
 			}
 		}
@@ -37,6 +39,20 @@ void process_memorymap(struct multiboot *mboot)
 	printk(1, "[mm]: Highest page = %x, num_pages = %d               \n", highest_page, num_pages);
 	if(!j)
 		panic(PANIC_MEM | PANIC_NOSYNC, "Memory map corrupted");
+	pm_init_frames(highest_page);
+	for(i = mboot->mmap_addr;i < (mboot->mmap_addr + mboot->mmap_length);) {
+		mmap_entry_t *me = (mmap_entry_t *)(i);
+		if(me->type == 1)
+		{
+			for (j = me->base_addr_low; 
+				j < (me->base_addr_low+me->length_low); j += PAGE_SIZE)
+			{
+				if(j >= pm_location)
+					pm_free_page(j);
+			}
+		}
+		i += me->size + sizeof (uint32_t);
+	}
 	int gbs=0;
 	int mbs = ((num_pages * PAGE_SIZE)/1024)/1024;
 	if(mbs < 4){
@@ -63,7 +79,10 @@ void init_memory(struct multiboot *m)
 	mutex_create(&pm_mutex, 0);
 	vm_init(pm_location);
 	process_memorymap(m);
- 	install_kmalloc(KMALLOC_NAME, KMALLOC_INIT, KMALLOC_ALLOC, KMALLOC_FREE);
+	init_shrinkers();
+ 	install_kmalloc(KMALLOC_NAME, KMALLOC_INIT, KMALLOC_ALLOC, KMALLOC_FREE, 
+		KMALLOC_CPU_ALLOC, KMALLOC_CPU_FREE);
+	ll_init_cache();
 	vm_init_2();
 	primary_cpu->flags |= CPU_PAGING;
 	set_ksf(KSF_MMU);
@@ -77,6 +96,9 @@ void init_memory(struct multiboot *m)
 	add_kernel_symbol(__kmalloc_a);
 	add_kernel_symbol(__kmalloc_p);
 	add_kernel_symbol(kfree);
+	add_kernel_symbol(kmem_cache_create);
+	add_kernel_symbol(kmem_cache_alloc);
+	add_kernel_symbol(kmem_cache_free);
 	add_kernel_symbol(vm_map);
 	add_kernel_symbol(vm_do_unmap);
 	add_kernel_symbol(vm_do_unmap_only);
@@ -88,6 +110,10 @@ void init_memory(struct multiboot *m)
 	add_kernel_symbol(vm_do_getattrib);
 	add_kernel_symbol(vm_setattrib);
 	add_kernel_symbol(pm_free_page);
+	add_kernel_symbol(__pm_alloc_pages);
+	add_kernel_symbol(pm_free_pages);
+	add_kernel_symbol(shrinker_register);
+	add_kernel_symbol(shrinker_unregister);
 #endif
 }
 
@@ -101,3 +127,51 @@ int pm_stat_mem(struct mem_stat *s)
 	slab_stat(s);
 	return 0;
 }
+
+/* map the large page that contains virt if it lies entirely within
+ * [lo, hi) and there's a free block to back it. Returns the number of
+ * bytes mapped, or 0 if the caller should map single pages as usual */
+int vm_try_map_large(addr_t virt, addr_t lo, addr_t hi, unsigned attr)
+{
+#ifdef LARGE_PAGE_SIZE
+	addr_t start = virt & ~((addr_t)LARGE_PAGE_SIZE-1);
+	if(start < lo || start + LARGE_PAGE_SIZE > hi || start + LARGE_PAGE_SIZE < start)
+		return 0;
+	addr_t block = pm_alloc_pages(LARGE_PAGE_ORDER, PM_TRY);
+	if(!block)
+		return 0;
+	/* cleared before it's mapped, so that other threads never see old
+	 * data and we don't do it with the page directory locked */
+	memset((void *)(block + PHYS_PAGE_MAP), 0, LARGE_PAGE_SIZE);
+	if(vm_map_large(start, block, attr, MAP_NOCLEAR)) {
+		pm_free_pages(block, LARGE_PAGE_ORDER);
+		return 0;
+	}
+	return LARGE_PAGE_SIZE;
+#else
+	return 0;
+#endif
+}
+
+/* unmap and free whatever is mapped in [start, end). Large pages that are
+ * only partly in the range are split. The tlb is flushed once at the end,
+ * instead of for every page */
+void vm_unmap_range(addr_t start, addr_t end)
+{
+	struct tlb_batch b;
+	tlb_batch_init(&b);
+	addr_t a = start;
+	while(a < end) {
+#ifdef LARGE_PAGE_SIZE
+		if(!(a & (LARGE_PAGE_SIZE-1)) && a + LARGE_PAGE_SIZE <= end
+				&& vm_unmap_large(a)) {
+			a += LARGE_PAGE_SIZE;
+			continue;
+		}
+#endif
+		if(vm_getmap(a, 0))
+			vm_unmap_batch(a, &b);
+		a += PAGE_SIZE;
+	}
+	tlb_batch_flush(&b);
+}
@@ -1,153 +1,213 @@
+/* mmfile.c - mmap
+ * Mappings are placed between MMF_START and MMF_END, and the space for
+ * them is handed out by a vma_t. mmap itself doesn't map anything; pages
+ * are filled in by the page fault handler the first time they're touched.
+ * Pages of files come from the inode's page cache, so MAP_SHARED mappings
+ * of a file see each other's writes, and MAP_PRIVATE mappings share the
+ * cached page copy-on-write until they write to it. Dirty pages of shared
+ * file mappings are written back by msync, munmap and exit.
+ */
 #include <kernel.h>
 #include <memory.h>
 #include <task.h>
 #include <fs.h>
+#include <file.h>
+#include <sys/fcntl.h>
+#include <atomic.h>
+#include <mmfile.h>
+#include <pagecache.h>
 
-unsigned sys_mmap(void *addr, void *str, int prot, int flags, int fildes)
+#define MMF_MAX_LEN ((MMF_END - MMF_START) < 0x80000000 ? (MMF_END - MMF_START) : 0x80000000)
+
+static struct mmap_space *mmf_get_space()
 {
-#if 0
-	if(!str)
-		return EINVAL;
-	struct mmapblock {
-		unsigned len;
-		unsigned off;
-	} *blk = str;
-	if(flags & MAP_ANON || (addr && flags&MAP_FIXED))
-		return ENOTSUP;
-	struct file *fil = get_file_pointer((task_t *)current_task, fildes);
-	if(!fil)
-		return EBADF;
-	if(!(fil->flags & _FREAD)) {
-		fput((task_t *)current_task, fildes, 0);
-		return EACCES;
-	}
-	if(flags&PROT_WRITE && !(fil->flags&_FWRITE)) {
-		fput((task_t *)current_task, fildes, 0);
-		return EACCES;
-	}
-	/* Ok, we can attempt to allocate the area */
-	vma_t **v = (vma_t **)((flags&MAP_SHARED) ? 
-			&((task_t *)current_task)->mmf_share_space 
-			: &((task_t *)current_task)->mmf_priv_space);
-	if(!*v) {
-		*v = (vma_t *)kmalloc(sizeof(vma_t));
-		init_vmem_area(*v, (flags&MAP_SHARED) ? MMF_SHARED_START 
-					: MMF_PRIV_START, (flags&MAP_SHARED) ? MMF_SHARED_END 
-					: MMF_PRIV_END, A_NI);
-		unsigned a = (*v)->addr, e = (*v)->addr + A_NI*PAGE_SIZE;
-		while(a < e) {
-			vm_map(a, pm_alloc_page(), PAGE_PRESENT | PAGE_USER | PAGE_WRITE
-																, MAP_CRIT);
-			a += PAGE_SIZE;
-		}
+	struct mmap_space *mm = pd_cur_data->mmap;
+	if(mm)
+		return mm;
+	mm = (void *)kmalloc(sizeof(struct mmap_space));
+	mutex_create(&mm->lock, 0);
+	mm->files = 0;
+	init_vmem_area(&mm->vma, MMF_START, MMF_END, A_NI);
+	/* another thread may have beaten us to it */
+	mutex_acquire(&pd_cur_data->lock);
+	if(!pd_cur_data->mmap) {
+		pd_cur_data->mmap = mm;
+		mm = 0;
 	}
-	int np = blk->len/PAGE_SIZE + 1;
-	vnode_t *node = insert_vmem_area(*v, np);
-	if(!node) {
-		fput((task_t *)current_task, fildes, 0);
-		return ENOMEM;
+	mutex_release(&pd_cur_data->lock);
+	if(mm) {
+		mutex_destroy(&mm->vma.lock);
+		mutex_destroy(&mm->lock);
+		kfree(mm);
 	}
-	int i=0;
-	/* Make sure that nothing is mapped there */
-	while(i < np) {
-		if(vm_getmap(node->addr + i*PAGE_SIZE, 0))
-			vm_unmap(node->addr + i*PAGE_SIZE);
-		i++;
-	}
-	/* And create the entry */
-	mmf_t *mf = (mmf_t *)kmalloc(sizeof(mmf_t));
-	mf->flags=flags;
-	mf->prot=prot;
-	mf->node=node;
-	mf->sz=blk->len;
-	mf->off=blk->off;
-	mf->count=(unsigned *)kmalloc(sizeof(unsigned));
-	*mf->count=1;
-	mf->fd = fildes;
-	add_mmf((task_t *)current_task, mf);
-	fput((task_t *)current_task, fildes, 0);
-	return node->addr;
-#endif
-	return 0;
+	return pd_cur_data->mmap;
 }
 
-mmf_t *find_mmf(task_t *t, vnode_t *n)
+static addr_t mmf_end(mmf_t *mf)
 {
-	mmf_t *m = t->mm_files;
-	while(m && m->node != n)
-		m=m->next;
-	return m;
+	return mf->node->addr + (addr_t)mf->node->num_pages * PAGE_SIZE;
 }
 
-void flush_mmf(mmf_t *m, int un_map, unsigned off, unsigned addr, unsigned end)
+/* must be called with mm->lock held */
+static mmf_t *mmf_find(struct mmap_space *mm, addr_t addr)
 {
-#if 0
-	struct file *fil = get_file_pointer((task_t *)current_task, m->fd);
-	if(!fil)
-		return;
-	int sz = end-addr;
-	int i=0;
-	while(addr < end)
-	{
-		if(vm_getmap(addr, 0))
-		{
-			int length = sz-i;
-			if(length > PAGE_SIZE)
-				length = PAGE_SIZE;
-			do_sys_write_flags(fil, i+off, (char *)addr, length);
-			if(un_map)
-				vm_unmap(addr);
-		}
-		i += PAGE_SIZE;
-		addr += PAGE_SIZE;
-	}
-	fput((task_t *)current_task, m->fd, 0);
-#endif
+	vnode_t *n = find_vmem_area(&mm->vma, addr);
+	if(!n)
+		return 0;
+	mmf_t *mf = mm->files;
+	while(mf && mf->node != n)
+		mf = mf->next;
+	return mf;
+}
+
+static void mmf_remove(struct mmap_space *mm, mmf_t *mf)
+{
+	if(mf->prev)
+		mf->prev->next = mf->next;
+	else
+		mm->files = mf->next;
+	if(mf->next)
+		mf->next->prev = mf->prev;
+	remove_vmem_area(&mm->vma, mf->node);
+	if(mf->inode)
+		iput(mf->inode);
+	kfree(mf);
 }
 
-int change_count(mmf_t *mf, int ch)
+/* write the dirty pages of a shared file mapping between start and end
+ * back to the file. Nothing past the end of the file is written */
+static void mmf_writeback(mmf_t *mf, addr_t start, addr_t end)
 {
-	
-	*mf->count += ch;
-	int r = *mf->count;
-	
-	return r;
+	if(!mf->inode || !(mf->flags & MAP_SHARED) || !(mf->prot & PROT_WRITE))
+		return;
+	for(addr_t a = start; a < end; a += PAGE_SIZE) {
+		unsigned attr;
+		if(!vm_getmap(a, 0) || !(vm_getattrib(a, &attr) & PAGE_DIRTY))
+			continue;
+		off_t off = mf->off + (a - mf->node->addr);
+		if(off >= mf->inode->len)
+			break;
+		vm_setattrib(a, attr & ~PAGE_DIRTY);
+		size_t len = PAGE_SIZE;
+		if(off + len > (size_t)mf->inode->len)
+			len = mf->inode->len - off;
+		/* this is the data that's in the page cache already, so unlike
+		 * write_fs this doesn't need to drop it */
+		vfs_callback_write(mf->inode, off, len, (char *)a);
+	}
 }
 
-int sys_munmap(void *ptr, unsigned sz)
+addr_t sys_mmap(void *addr, struct mmapblock *blk, int prot, int flags, int fildes)
 {
-	#if 0
-	if(!ptr)
+	if(!blk)
 		return -EINVAL;
-	ptr = (void *)((unsigned)ptr & PAGE_MASK);
-	vma_t *v   = current_task->mmf_priv_space;
-	vnode_t *n = find_vmem_area(v, (unsigned)ptr);
-	if(!n)
-		n = find_vmem_area((v=current_task->mmf_share_space), (unsigned)ptr);
-	if(!n)
+	size_t len = blk->len;
+	off_t off = blk->off;
+	/* the vma_t works out sizes in 32 bits */
+	if(!len || off < 0 || (off & ~PAGE_MASK) || len > MMF_MAX_LEN)
 		return -EINVAL;
-	mmf_t *mf = find_mmf((task_t *)current_task, n);
-	if(!mf)
+	if(!(flags & MAP_SHARED) == !(flags & MAP_PRIVATE))
 		return -EINVAL;
-	vnode_t *vn = mf->node;
-	int clear=0;
-	if((unsigned)ptr == vn->addr && (sz / PAGE_SIZE) == vn->num_pages)
-		clear=1;
-	flush_mmf(mf, clear, ((unsigned)ptr - vn->addr)+mf->off, (unsigned)ptr, 
-														(unsigned)ptr + sz);
-	if(clear)
-	{
-		remove_mmf(mf);
-		remove_vmem_area(v, vn);
+	/* mappings go wherever the allocator puts them */
+	if(flags & MAP_FIXED)
+		return -ENOTSUP;
+	struct inode *inode = 0;
+	if(!(flags & MAP_ANON)) {
+		struct file *f = get_file_pointer((task_t *)current_task, fildes);
+		if(!f)
+			return -EBADF;
+		int err = 0;
+		if(is_directory(f->inode) || f->inode->pipe)
+			err = -ENODEV;
+		else if(!(f->flags & _FREAD))
+			err = -EACCES;
+		else if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !(f->flags & _FWRITE))
+			err = -EACCES;
+		if(!err) {
+			inode = f->inode;
+			add_atomic(&inode->count, 1);
+		}
+		fput((task_t *)current_task, fildes, 0);
+		if(err)
+			return err;
 	}
-	return 0;
-#endif
+	struct mmap_space *mm = mmf_get_space();
+	mutex_acquire(&mm->lock);
+	vnode_t *node = insert_vmem_area(&mm->vma, (len + PAGE_SIZE - 1) / PAGE_SIZE);
+	if(!node) {
+		mutex_release(&mm->lock);
+		if(inode)
+			iput(inode);
+		return -ENOMEM;
+	}
+	mmf_t *mf = (void *)kmalloc(sizeof(mmf_t));
+	mf->inode = inode;
+	mf->flags = flags;
+	mf->prot = prot;
+	mf->sz = len;
+	mf->off = off;
+	mf->node = node;
+	mf->prev = 0;
+	mf->next = mm->files;
+	if(mm->files)
+		mm->files->prev = mf;
+	mm->files = mf;
+	mutex_release(&mm->lock);
+	return node->addr;
+}
+
+/* pages of a mapping that is only partly unmapped are dropped, but the
+ * address space stays reserved until the whole mapping is gone */
+int sys_munmap(void *ptr, size_t sz)
+{
+	addr_t start = (addr_t)ptr, end = start + sz;
+	if((start & ~PAGE_MASK) || !sz || end < start)
+		return -EINVAL;
+	end = (end + PAGE_SIZE - 1) & PAGE_MASK;
+	struct mmap_space *mm = pd_cur_data->mmap;
+	if(!mm)
+		return 0;
+	mutex_acquire(&mm->lock);
+	mmf_t *mf = mm->files, *next;
+	while(mf) {
+		next = mf->next;
+		addr_t lo = start > mf->node->addr ? start : mf->node->addr;
+		addr_t hi = end < mmf_end(mf) ? end : mmf_end(mf);
+		if(lo < hi) {
+			mmf_writeback(mf, lo, hi);
+			vm_unmap_range(lo, hi);
+			if(lo == mf->node->addr && hi == mmf_end(mf))
+				mmf_remove(mm, mf);
+		}
+		mf = next;
+	}
+	mutex_release(&mm->lock);
 	return 0;
 }
 
-int sys_msync()
+/* MS_ASYNC is treated like MS_SYNC */
+int sys_msync(void *ptr, size_t sz, int flags)
 {
-	return -ENOSYS;
+	addr_t start = (addr_t)ptr, end = start + sz;
+	if((start & ~PAGE_MASK) || end < start)
+		return -EINVAL;
+	if((flags & MS_ASYNC) && (flags & MS_SYNC))
+		return -EINVAL;
+	struct mmap_space *mm = pd_cur_data->mmap;
+	if(!mm)
+		return -ENOMEM;
+	int found = 0;
+	mutex_acquire(&mm->lock);
+	for(mmf_t *mf = mm->files; mf; mf = mf->next) {
+		addr_t lo = start > mf->node->addr ? start : mf->node->addr;
+		addr_t hi = end < mmf_end(mf) ? end : mmf_end(mf);
+		if(lo < hi) {
+			mmf_writeback(mf, lo, hi);
+			found = 1;
+		}
+	}
+	mutex_release(&mm->lock);
+	return found ? 0 : -ENOMEM;
 }
 
 int sys_mprotect()
@@ -155,116 +215,161 @@ int sys_mprotect()
 	return -ENOSYS;
 }
 
-void check_mmf_and_flush(task_t *t, int fd)
+/* map phys at addr with interim attributes while its contents are read in.
+ * Returns 0 if another thread has mapped something there already */
+static int mmf_map_page(addr_t addr, addr_t phys, unsigned attr, unsigned opt)
 {
-	mmf_t *mf = t->mm_files, *nex;
-	while(mf)
-	{
-		nex = mf->next;
-		if(((int)mf->fd == fd) || (fd == -1))
-			flush_mmf(mf, 0, mf->off, mf->node->addr, mf->sz);
-		mf=nex;
+	int ret = 0;
+	mutex_acquire(&pd_cur_data->lock);
+	if(!vm_do_getmap(addr, 0, 1)) {
+		vm_map(addr, phys, attr, opt | MAP_CRIT | MAP_PDLOCKED);
+		ret = 1;
 	}
+	mutex_release(&pd_cur_data->lock);
+	if(!ret)
+		pm_free_page(phys);
+	return ret;
 }
 
-void copy_mmf(task_t *old, task_t *new)
+/* read a page of the file into a fresh page mapped (for the kernel only,
+ * so other threads wait for it) at addr */
+static int mmf_read_page(mmf_t *mf, addr_t addr, off_t off)
 {
-	#if 0
-	/* This will increase the count of all shared MMFs */
-	mmf_t *mf = old->mm_files;
-	while(mf)
-	{
-		mmf_t *n = (mmf_t *)kmalloc(sizeof(mmf_t));
-		memcpy(n, mf, sizeof(mmf_t));
-		if(mf->flags & MAP_SHARED)
-			change_count(mf, 1);
-		else {
-			n->count = (unsigned *)kmalloc(sizeof(unsigned));
-			*n->count=1;
-		}
-		add_mmf(new, n);
-		mf = mf->next;
+	if(!mmf_map_page(addr, pm_alloc_page(), PAGE_PRESENT | PAGE_WRITE, 0))
+		return 0;
+	if(off >= mf->inode->len)
+		return 1;
+	size_t len = PAGE_SIZE;
+	if(off + len > (size_t)mf->inode->len)
+		len = mf->inode->len - off;
+	if(read_fs(mf->inode, off, len, (char *)addr) < 0) {
+		vm_unmap(addr);
+		return -EIO;
 	}
-#endif
+	return 1;
 }
 
-int pfault_mmf_check(unsigned err, unsigned addr)
+static int mmf_fill_page(mmf_t *mf, addr_t addr, int write)
 {
-	#if 0
-	mmf_t *mf = current_task->mm_files;
-	vma_t *v   = current_task->mmf_priv_space;
-	vnode_t *n = find_vmem_area(v, addr);
-	if(!n)
-		n = find_vmem_area((v=current_task->mmf_share_space), addr);
-	if(!n)
-		return 0;
-	while(mf && mf->node != n)
-		mf=mf->next;
-	/* If we tried to write and we aren't allowed to do so */
-	if((err & 0x2) && !(mf->prot & PROT_WRITE))
-		return 0;
-	/* If its already present */
-	if(err & 0x1)
-		return 0;
-	unsigned p = pm_alloc_page();
 	unsigned attr = PAGE_PRESENT | PAGE_USER;
-	if(mf->prot & PROT_WRITE)
-		attr |= PAGE_WRITE;
-	vm_map(addr & PAGE_MASK, p, attr, MAP_CRIT);
-	memset((void *)(addr & PAGE_MASK), 0, PAGE_SIZE);
-	struct file *fil = get_file_pointer((task_t *)current_task, mf->fd);
-	if(!fil)
+	if(mf->flags & MAP_SHARED)
+		attr |= PAGE_SHARED;
+	if(!mf->inode) {
+		if(mf->prot & PROT_WRITE)
+			attr |= PAGE_WRITE;
+		/* private anonymous memory gets a whole large page at once, if
+		 * the mapping covers one */
+		if((mf->flags & MAP_PRIVATE) && vm_try_map_large(addr, mf->node->addr, mmf_end(mf), attr))
+			return 1;
+		mmf_map_page(addr, pm_alloc_page(), attr, 0);
 		return 1;
-	int off = (addr&PAGE_MASK) - n->addr;
-	do_sys_read_flags(fil, mf->off + off, (char *)(addr&PAGE_MASK), PAGE_SIZE);
+	}
+	off_t off = mf->off + (addr - mf->node->addr);
+	if(write && (mf->flags & MAP_PRIVATE)) {
+		/* the write would have to copy the cached page straight away */
+		int ret = mmf_read_page(mf, addr, off);
+		if(ret > 0)
+			vm_setattrib(addr, attr | PAGE_WRITE);
+		return ret >= 0;
+	}
+	u64 index = off / PAGE_SIZE;
+	addr_t phys = pcache_find(mf->inode, index);
+	if(!phys) {
+		int ret = mmf_read_page(mf, addr, off);
+		if(ret <= 0)
+			return ret == 0;
+		phys = vm_getmap(addr, 0);
+		addr_t cached = pcache_insert(mf->inode, index, phys);
+		if(cached != phys) {
+			vm_map(addr, cached, PAGE_PRESENT | PAGE_WRITE, MAP_CRIT | MAP_NOCLEAR);
+			pm_free_page(phys);
+		}
+	} else if(!mmf_map_page(addr, phys, PAGE_PRESENT, MAP_NOCLEAR))
+		return 1;
+	if(mf->prot & PROT_WRITE)
+		attr |= (mf->flags & MAP_SHARED) ? PAGE_WRITE : PAGE_COW;
+	vm_setattrib(addr, attr);
 	return 1;
-#endif
-	return 0;
 }
 
-void clear_mmfiles(task_t *t, int exiting)
+/* handle a fault on a mapped page. Reading the file may have to wait for
+ * the disk, so interrupts are enabled if the faulting code had them
+ * enabled */
+int pfault_mmf_check(unsigned err, addr_t addr, int can_sleep)
 {
-	#if 0
-	/* If we are exiting, we decrease the count of shared MMFs
-	 * and we always remove private MMFs */
-	/* Then free the mmf_*_space */
-	mmf_t *mf = t->mm_files;
-	unsigned int *pd = (unsigned *)t->pd;
-	/* Unlink memory */
-	lock_scheduler();
-	task_t *q = kernel_task;
-	///
-	///
-	///
-	///while(q && q->mmf_share_space != t->mmf_share_space) q=q->next;
-	if(!q)
-		kfree(t->mmf_share_space);
-	lock_scheduler();
-	int S = PAGE_DIR_IDX(MMF_SHARED_START/PAGE_SIZE);
-	int E = PAGE_DIR_IDX(MMF_SHARED_END/PAGE_SIZE);
-	int i;
-	for(i=S;i<E;i++) {
-		if(!q && pd[i])
-		{
-			//self_free_table(i);
-			pm_free_page(pd[i]&PAGE_MASK);
-		}
-		pd[i]=0;
-	}
-	t->mmf_share_space=0;
-	unlock_scheduler();
-	while(mf)
-	{
-		change_count(mf, -1);
-		mmf_t *n = mf->next;
-		remove_mmf(mf);
-		mf=n;
+	struct mmap_space *mm = pd_cur_data->mmap;
+	if(!mm || addr < MMF_START || addr >= MMF_END)
+		return 0;
+	addr &= PAGE_MASK;
+	int ret = 0;
+	int old = set_int(can_sleep ? 1 : 0);
+	mutex_acquire(&mm->lock);
+	mmf_t *mf = mmf_find(mm, addr);
+	unsigned attr;
+	if(!mf || !(mf->prot & (PROT_READ | PROT_WRITE | PROT_EXEC)))
+		ret = 0;
+	else if(vm_getmap(addr, 0)) {
+		/* another thread was filling this page in while we waited */
+		vm_getattrib(addr, &attr);
+		ret = (attr & PAGE_USER) && (!(err & 2) || (attr & PAGE_WRITE));
+	} else if(!(err & 2) || (mf->prot & PROT_WRITE))
+		ret = mmf_fill_page(mf, addr, err & 2);
+	mutex_release(&mm->lock);
+	set_int(old);
+	return ret;
+}
+
+/* called by vm_clone. Returns a copy of the current address space's
+ * mappings for the child, and keeps them locked until mmf_fork_end so
+ * that they match the page tables that the child gets */
+struct mmap_space *mmf_fork_begin()
+{
+	struct mmap_space *mm = pd_cur_data->mmap;
+	if(!mm)
+		return 0;
+	struct mmap_space *new = (void *)kmalloc(sizeof(struct mmap_space));
+	mutex_acquire(&mm->lock);
+	memcpy(&new->vma, &mm->vma, sizeof(vma_t));
+	mutex_create(&new->vma.lock, 0);
+	mutex_create(&new->lock, 0);
+	new->files = 0;
+	for(mmf_t *mf = mm->files; mf; mf = mf->next) {
+		mmf_t *n = (void *)kmalloc(sizeof(mmf_t));
+		memcpy(n, mf, sizeof(mmf_t));
+		if(n->inode)
+			add_atomic(&n->inode->count, 1);
+		n->prev = 0;
+		n->next = new->files;
+		if(new->files)
+			new->files->prev = n;
+		new->files = n;
 	}
-	kfree(t->mmf_priv_space);
-	#endif
+	return new;
 }
 
-void mmf_sync()
+void mmf_fork_end(struct mmap_space *new)
 {
-	
+	if(new)
+		mutex_release(&pd_cur_data->mmap->lock);
+}
+
+/* called when the current address space is thrown away by exec or exit,
+ * before the pages are freed */
+void mmf_release_space()
+{
+	struct mmap_space *mm = pd_cur_data->mmap;
+	if(!mm)
+		return;
+	pd_cur_data->mmap = 0;
+	mmf_t *mf;
+	while((mf = mm->files)) {
+		mm->files = mf->next;
+		mmf_writeback(mf, mf->node->addr, mmf_end(mf));
+		if(mf->inode)
+			iput(mf->inode);
+		kfree(mf);
+	}
+	mutex_destroy(&mm->vma.lock);
+	mutex_destroy(&mm->lock);
+	kfree(mm);
 }
@@ -0,0 +1,66 @@
+/* shrink.c - giving memory back under pressure
+ * Caches that hold on to memory they don't strictly need register a
+ * shrinker here. When the page allocator runs out, it calls them in turn
+ * until enough has been freed, before it resorts to OOM_HANDLER.
+ */
+#include <kernel.h>
+#include <memory.h>
+#include <task.h>
+#include <mutex.h>
+#include <shrink.h>
+
+static struct shrinker *shrinkers=0;
+static mutex_t shrink_lock;
+extern mutex_t km_m;
+
+void init_shrinkers()
+{
+	mutex_create(&shrink_lock, 0);
+}
+
+void shrinker_register(struct shrinker *s, const char *name,
+	unsigned long (*shrink)(struct shrinker *, unsigned long), void *data)
+{
+	strncpy(s->name, name, 31);
+	s->shrink = shrink;
+	s->data = data;
+	mutex_acquire(&shrink_lock);
+	s->prev = 0;
+	s->next = shrinkers;
+	if(shrinkers)
+		shrinkers->prev = s;
+	shrinkers = s;
+	mutex_release(&shrink_lock);
+}
+
+void shrinker_unregister(struct shrinker *s)
+{
+	mutex_acquire(&shrink_lock);
+	if(s->prev)
+		s->prev->next = s->next;
+	else
+		shrinkers = s->next;
+	if(s->next)
+		s->next->prev = s->prev;
+	s->next = s->prev = 0;
+	mutex_release(&shrink_lock);
+}
+
+/* try to free at least 'pages' pages. Returns how many were freed,
+ * which may be 0 if nothing could be */
+unsigned long shrink_memory(unsigned long pages)
+{
+	if(!task_can_sleep())
+		return 0;
+	/* shrinkers free memory with kfree, so they can't run while we're
+	 * inside the allocator, or while we're already shrinking */
+	if(km_m.pid == (int)current_task->pid || shrink_lock.pid == (int)current_task->pid)
+		return 0;
+	unsigned long freed = 0;
+	mutex_acquire(&shrink_lock);
+	struct shrinker *s;
+	for(s = shrinkers;s && freed < pages;s = s->next)
+		freed += s->shrink(s, pages - freed);
+	mutex_release(&shrink_lock);
+	return freed;
+}
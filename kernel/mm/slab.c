@@ -17,6 +17,8 @@
 #include <memory.h>
 #include <task.h>
 #include <atomic.h>
+#include <cpu.h>
+#include <shrink.h>
 
 slab_cache_t *scache_list[NUM_SCACHES];
 addr_t slab_start=0, slab_end=0;
@@ -25,7 +27,12 @@ unsigned pages_used=0;
 #define SLAB_NUM_INDEX 120
 unsigned num_slab=0, num_scache=0;
 void release_slab(slab_t *slab);
+static unsigned long slab_shrink(struct shrinker *s, unsigned long pages);
+static struct shrinker slab_shrinker;
 mutex_t scache_lock;
+/* stack of unused scache ids, so finding a free cache is constant time */
+static short scache_free_ids[NUM_SCACHES];
+static unsigned scache_num_free=0;
 //#define SLAB_DEBUG 1
 #ifdef SLAB_DEBUG
 unsigned total=0;
@@ -68,12 +75,8 @@ void free_slab(slab_t *slab)
 	pages_used -= slab->num_pages;
 	vnode_t *t = slab->vnode;
 	slab->magic = 0;
-	addr_t j;
 	addr_t addr = (addr_t)slab;
-	for(j=addr;j<(addr + num_pages*PAGE_SIZE);j+=PAGE_SIZE) {
-		if(vm_getmap(j, 0))
-			vm_unmap(j);
-	}
+	vm_unmap_range(addr, addr + num_pages*PAGE_SIZE);
 	remove_vmem_area(&slab_area_alloc, t);
 	sub_atomic(&num_slab, 1);
 }
@@ -81,24 +84,20 @@ void free_slab(slab_t *slab)
 slab_cache_t *get_empty_scache(int size, unsigned short flags)
 {
 	assert(size);
-	unsigned i=0;
 	mutex_acquire(&scache_lock);
-	while(i < NUM_SCACHES)
-	{
-		if(((slab_cache_t *)(scache_list[i]))->id == -1)
-			break;
-		i++;
-	}
 	/* Normally, we would panic. However, the allocator has a 
 	 * condition which might allow us to get around this. */
-	if(i == NUM_SCACHES) {
+	if(!scache_num_free) {
 		mutex_release(&scache_lock);
 		return 0;
 	}
+	unsigned i = scache_free_ids[--scache_num_free];
+	assert(((slab_cache_t *)(scache_list[i]))->id == -1);
 	memset(((slab_cache_t *)(scache_list[i])), 0, sizeof(slab_cache_t));
 	((slab_cache_t *)(scache_list[i]))->id = i;
 	((slab_cache_t *)(scache_list[i]))->flags = flags;
 	((slab_cache_t *)(scache_list[i]))->obj_size = size;
+	((slab_cache_t *)(scache_list[i]))->mag = -1;
 	add_atomic(&num_scache, 1);
 	mutex_release(&scache_lock);
 	return scache_list[i];
@@ -108,7 +107,9 @@ void release_scache(slab_cache_t *sc)
 {
 	assert(sc);
 	assert(!sc->full && !sc->partial && !sc->empty);
+	assert(!(sc->flags & S_KEEP));
 	mutex_acquire(&scache_lock);
+	scache_free_ids[scache_num_free++] = sc->id;
 	sc->id=-1;
 	sub_atomic(&num_scache, 1);
 	mutex_release(&scache_lock);
@@ -129,6 +130,8 @@ int add_slab_to_list(slab_t *slab, char to)
 	{
 		case TO_EMPTY:
 			list=&sc->empty; 
+			slab->flags |= S_EMPTY;
+			sc->empty_count++;
 			break;
 		case TO_PARTIAL:
 			list=&sc->partial; 
@@ -158,6 +161,10 @@ void remove_slab_list(slab_t *slab)
 	assert(slab && slab->magic == SLAB_MAGIC);
 	slab_cache_t *sc = (slab_cache_t *)(slab->parent);
 	assert(sc);
+	if(slab->flags & S_EMPTY) {
+		slab->flags &= ~S_EMPTY;
+		sc->empty_count--;
+	}
 	if(slab->prev)
 		slab->prev->next=slab->next;
 	if(slab->next)
@@ -194,7 +201,7 @@ slab_t *create_slab(slab_cache_t *sc, int num_pages, unsigned short flags)
 	addr_t j;
 	for(j=addr;j<(addr + num_pages*PAGE_SIZE);j+=PAGE_SIZE) {
 		if(!vm_getmap(j, 0))
-			vm_map(j, pm_alloc_page(), PAGE_PRESENT | PAGE_USER, MAP_CRIT);
+			vm_map(j, pm_alloc_page(), PAGE_PRESENT | PAGE_WRITE | PAGE_USER, MAP_CRIT);
 	}
 	slab_t *slab = (slab_t *)addr;
 	assert(slab->magic != SLAB_MAGIC);
@@ -287,11 +294,18 @@ void release_object(slab_t *slab, int obj)
 	unsigned res = do_release_object(slab, obj);
 	if(!res)
 	{
-		/* We must move it to the empty list or destroy it */
+		/* keep a few empty slabs around, so that a cache that keeps
+		 * going back and forth over a slab boundary doesn't create and
+		 * destroy a slab every time */
+		slab_cache_t *sc = (slab_cache_t *)slab->parent;
+		remove_slab_list(slab);
+		if(sc->empty_count < SLAB_MAX_EMPTY) {
+			add_slab_to_list(slab, TO_EMPTY);
+			return;
+		}
 #ifdef SLAB_DEBUG
 		printk(0, "%x: destroy\n", (addr_t)slab);
 #endif
-		remove_slab_list(slab);
 		release_slab(slab);
 	} else
 	{
@@ -321,10 +335,32 @@ void release_slab(slab_t *slab)
 	slab_cache_t *sc = (slab_cache_t *)(slab->parent);
 	assert(sc);
 	do_release_slab(slab);
-	if(!sc->slab_count)
+	if(!sc->slab_count && !(sc->flags & S_KEEP))
 		release_scache(sc);
 }
 
+static const unsigned slab_class_size[SLAB_NUM_CLASSES] = {
+	32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048
+};
+#define SLAB_CLASS_SHIFT 4
+/* index of the smallest class that fits each size, in 16 byte steps */
+static unsigned char slab_class_index[(SLAB_MAX_CLASS_SIZE >> SLAB_CLASS_SHIFT) + 1];
+
+static void init_size_classes()
+{
+	unsigned i, class=0;
+	for(i=0;i<=(SLAB_MAX_CLASS_SIZE >> SLAB_CLASS_SHIFT);i++) {
+		while(slab_class_size[class] < (i << SLAB_CLASS_SHIFT))
+			class++;
+		slab_class_index[i] = class;
+	}
+}
+
+static inline int slab_size_class(size_t sz)
+{
+	return slab_class_index[(sz + (1 << SLAB_CLASS_SHIFT) - 1) >> SLAB_CLASS_SHIFT];
+}
+
 unsigned slab_init(addr_t start, addr_t end)
 {
 	printk(1, "[slab]: Initiating slab allocator...");
@@ -339,10 +375,13 @@ unsigned slab_init(addr_t start, addr_t end)
 	{
 		scache_list[i] = (slab_cache_t *)(start + sizeof(slab_cache_t)*i);
 		scache_list[i]->id=-1;
+		scache_free_ids[scache_num_free++] = NUM_SCACHES - (i+1);
 	}
+	init_size_classes();
 	printk(1, "done\n");
 	pages_used = SLAB_NUM_INDEX+1;
 	mutex_create(&scache_lock, 0);
+	shrinker_register(&slab_shrinker, "slab", slab_shrink, 0);
 	return 0;
 }
 
@@ -385,6 +424,7 @@ slab_t *find_usable_slab(unsigned size, int align, int allow_range)
 		/* If we want aligned objects, we need to have sizes 
 		 * multiples of 0x1000 */
 		if(scache_list[i]->id != -1 
+			&& !(scache_list[i]->flags & S_NAMED)
 			&& scache_list[i]->obj_size >= size 
 			&& (scache_list[i]->obj_size <= size*RANGE_MUL || allow_range == 2)) 
 		{
@@ -465,8 +505,47 @@ slab_t *find_usable_slab(unsigned size, int align, int allow_range)
 	return find_usable_slab(size, align, 0);
 }
 
+/* Returns an object from the cache, placing the slab pointer in front of
+ * it so that kfree can find the slab. The object is aligned to 'align' 
+ * bytes, and never page aligned, since kfree handles those differently. 
+ * Objects must have room for 2*align bytes more than the caller uses */
+static addr_t slab_alloc_from_cache(slab_cache_t *sc, size_t align)
+{
+	slab_t *slab = sc->partial ? sc->partial : sc->empty;
+	if(!slab) {
+		slab = create_slab(sc, slab_size(sc->obj_size)/PAGE_SIZE, 0);
+		add_slab_to_list(slab, TO_EMPTY);
+	}
+	addr_t obj = alloc_object(slab);
+	addr_t addr = ((obj + sizeof(addr_t)) + (align-1)) & ~(align-1);
+	if((addr & PAGE_MASK) == addr)
+		addr += align;
+	*(addr_t *)(addr - sizeof(addr_t)) = (addr_t)slab;
+	assert(addr - obj <= align*2);
+	return addr;
+}
+
+/* kmalloc sizes up to SLAB_MAX_CLASS_SIZE are rounded up to a size class,
+ * which has its own cache. This keeps the number of caches down, makes 
+ * finding a cache constant time, and lets freed objects be reused for 
+ * any request in the same class */
+static slab_cache_t *class_scache[SLAB_NUM_CLASSES];
+
 addr_t do_kmalloc_slab(size_t sz, char align)
 {
+	if(!align && sz <= SLAB_MAX_CLASS_SIZE) {
+		int class = slab_size_class(sz);
+		slab_cache_t *sc = class_scache[class];
+		if(!sc) {
+			sc = get_empty_scache(slab_class_size[class] + sizeof(addr_t) * 2, 
+					S_KEEP);
+			if(!sc)
+				panic(PANIC_MEM | PANIC_NOSYNC, "ran out of slab caches");
+			sc->mag = class;
+			class_scache[class] = sc;
+		}
+		return slab_alloc_from_cache(sc, sizeof(addr_t));
+	}
 	if(sz < 32) sz=32;
 	if(!align)
 		sz += (sizeof(addr_t) * 2);
@@ -540,3 +619,254 @@ void do_kfree_slab(void *ptr)
 	assert(obj < slab->obj_num);
 	release_object(slab, obj);
 }
+
+/* Per-cpu magazines (as in Bonwick's magazine allocator). Freed objects
+ * are pushed onto the current cpu's loaded magazine and allocations pop
+ * from it, so the common case touches only per-cpu data. When both of a
+ * cpu's magazines are empty (or full) it trades one with the depot for
+ * that cache, which is protected by km_m. Each size class and kmem_cache
+ * has its own magazines, and objects in a magazine still count as used
+ * by their slab. */
+extern mutex_t km_m;
+
+struct mag_depot {
+	struct magazine *full, *empty;
+	unsigned num_full, num_empty;
+};
+static struct mag_depot mag_depot[SLAB_NUM_MAGS];
+/* number of magazines of each kind a depot holds on to. Past this, full
+ * magazines are emptied back into their slabs */
+#define MAG_DEPOT_MAX 8
+
+static struct slab_cpu_cache *slab_get_cpu_cache(int mag)
+{
+	cpu_t *cpu = current_task ? current_task->cpu : 0;
+	return cpu ? &cpu->slab_cache[mag] : 0;
+}
+
+static void slab_swap_magazines(struct slab_cpu_cache *cc)
+{
+	struct magazine *tmp = cc->loaded;
+	cc->loaded = cc->previous;
+	cc->previous = tmp;
+}
+
+static addr_t mag_pop(struct slab_cpu_cache *cc)
+{
+	if(!(cc->loaded && cc->loaded->rounds) && cc->previous && cc->previous->rounds)
+		slab_swap_magazines(cc);
+	if(cc->loaded && cc->loaded->rounds)
+		return cc->loaded->objs[--cc->loaded->rounds];
+	return 0;
+}
+
+static int mag_push(struct slab_cpu_cache *cc, addr_t obj)
+{
+	if(!(cc->loaded && cc->loaded->rounds < MAG_ROUNDS) 
+			&& cc->previous && cc->previous->rounds < MAG_ROUNDS)
+		slab_swap_magazines(cc);
+	if(cc->loaded && cc->loaded->rounds < MAG_ROUNDS) {
+		cc->loaded->objs[cc->loaded->rounds++] = obj;
+		return 1;
+	}
+	return 0;
+}
+
+/* the depot functions must be called with km_m held */
+static void depot_put(struct magazine **list, unsigned *num, struct magazine *m)
+{
+	m->next = *list;
+	*list = m;
+	(*num)++;
+}
+
+static struct magazine *depot_get(struct magazine **list, unsigned *num)
+{
+	struct magazine *m = *list;
+	if(m) {
+		*list = m->next;
+		(*num)--;
+	}
+	return m;
+}
+
+/* give the objects in the depot's oldest full magazines back to the slabs */
+static void depot_trim(struct mag_depot *d)
+{
+	while(d->num_full > MAG_DEPOT_MAX) {
+		struct magazine *m = depot_get(&d->full, &d->num_full);
+		while(m->rounds)
+			do_kfree_slab((void *)m->objs[--m->rounds]);
+		if(d->num_empty < MAG_DEPOT_MAX)
+			depot_put(&d->empty, &d->num_empty, m);
+		else
+			do_kfree_slab(m);
+	}
+}
+
+static addr_t slab_mag_alloc(int mag)
+{
+	if(mag < 0 || !slab_get_cpu_cache(mag))
+		return 0;
+	int old = set_int(0);
+	addr_t ret = mag_pop(slab_get_cpu_cache(mag));
+	set_int(old);
+	if(ret)
+		return ret;
+	/* both magazines are empty. Trade one for a full one from the depot,
+	 * or let the caller go to the slabs if there isn't one */
+	struct mag_depot *d = &mag_depot[mag];
+	mutex_acquire(&km_m);
+	old = set_int(0);
+	struct slab_cpu_cache *cc = slab_get_cpu_cache(mag);
+	ret = mag_pop(cc);
+	if(!ret && d->full) {
+		if(cc->previous)
+			depot_put(&d->empty, &d->num_empty, cc->previous);
+		cc->previous = cc->loaded;
+		cc->loaded = depot_get(&d->full, &d->num_full);
+		ret = mag_pop(cc);
+	}
+	set_int(old);
+	mutex_release(&km_m);
+	return ret;
+}
+
+static int slab_mag_free(int mag, addr_t addr)
+{
+	if(mag < 0 || !slab_get_cpu_cache(mag))
+		return 0;
+	int old = set_int(0);
+	int ret = mag_push(slab_get_cpu_cache(mag), addr);
+	set_int(old);
+	if(ret)
+		return 1;
+	/* both magazines are full. Hand one to the depot and replace it
+	 * with an empty one. The allocation must be done before we disable
+	 * interrupts, since it may need to map pages */
+	struct mag_depot *d = &mag_depot[mag];
+	mutex_acquire(&km_m);
+	struct magazine *m = depot_get(&d->empty, &d->num_empty);
+	if(!m)
+		m = (struct magazine *)do_kmalloc_slab(sizeof(struct magazine), 0);
+	m->rounds = 0;
+	old = set_int(0);
+	struct slab_cpu_cache *cc = slab_get_cpu_cache(mag);
+	if(!mag_push(cc, addr)) {
+		if(cc->previous)
+			depot_put(&d->full, &d->num_full, cc->previous);
+		cc->previous = cc->loaded;
+		cc->loaded = m;
+		m = 0;
+		ret = mag_push(cc, addr);
+		assert(ret);
+	}
+	set_int(old);
+	if(m)
+		depot_put(&d->empty, &d->num_empty, m);
+	depot_trim(d);
+	mutex_release(&km_m);
+	return 1;
+}
+
+addr_t slab_cpu_alloc(size_t sz, char align)
+{
+	if(align || sz > SLAB_MAX_CLASS_SIZE)
+		return 0;
+	return slab_mag_alloc(slab_size_class(sz));
+}
+
+int slab_cpu_free(void *ptr)
+{
+	addr_t addr = (addr_t)ptr;
+	if(addr < slab_start || addr >= slab_end || (addr & PAGE_MASK) == addr)
+		return 0;
+	slab_t *slab = (slab_t *)*(addr_t *)(addr - sizeof(addr_t));
+	if(!slab || slab->magic != SLAB_MAGIC)
+		return 0;
+	return slab_mag_free(((slab_cache_t *)slab->parent)->mag, addr);
+}
+
+/* called when memory runs low. Objects sitting in the depots are given
+ * back to their slabs, and then the empty slabs are released. The
+ * magazines loaded on each cpu can only be touched by that cpu, so
+ * they're left alone */
+static unsigned long slab_shrink(struct shrinker *s, unsigned long pages)
+{
+	unsigned long freed = 0;
+	if(!mutex_trylock(&km_m))
+		return 0;
+	int i;
+	for(i=0;i<SLAB_NUM_MAGS;i++) {
+		struct mag_depot *d = &mag_depot[i];
+		struct magazine *m;
+		while((m = depot_get(&d->full, &d->num_full))) {
+			while(m->rounds)
+				do_kfree_slab((void *)m->objs[--m->rounds]);
+			do_kfree_slab(m);
+		}
+		while((m = depot_get(&d->empty, &d->num_empty)))
+			do_kfree_slab(m);
+	}
+	unsigned j;
+	for(j=0;j<NUM_SCACHES && freed < pages;j++) {
+		slab_cache_t *sc = scache_list[j];
+		/* releasing the last slab of a cache may release the cache */
+		while(sc->id != -1 && sc->empty && freed < pages) {
+			freed += sc->empty->num_pages;
+			release_slab(sc->empty);
+		}
+	}
+	mutex_release(&km_m);
+	return freed;
+}
+
+static unsigned num_kmem_caches=0;
+
+/* Create a cache for objects of a single type. Caches are never destroyed */
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align, 
+	void (*ctor)(void *))
+{
+	if(align < sizeof(addr_t))
+		align = sizeof(addr_t);
+	assert(size && !(align & (align-1)) && align < PAGE_SIZE);
+	kmem_cache_t *kc = (void *)kmalloc(sizeof(kmem_cache_t));
+	strncpy(kc->name, name, 31);
+	kc->size = size;
+	kc->align = align;
+	kc->ctor = ctor;
+	/* leave room for the slab pointer and alignment (see
+	 * slab_alloc_from_cache) */
+	size = ((size + sizeof(addr_t) - 1) & ~(sizeof(addr_t) - 1)) + align*2;
+	mutex_acquire(&km_m);
+	kc->sc = get_empty_scache(size, S_NAMED | S_KEEP);
+	if(!kc->sc)
+		panic(PANIC_MEM | PANIC_NOSYNC, "ran out of slab caches for %s", name);
+	if(num_kmem_caches < KMEM_MAX_CACHES)
+		kc->sc->mag = SLAB_NUM_CLASSES + num_kmem_caches++;
+	mutex_release(&km_m);
+	return kc;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *kc)
+{
+	addr_t ret = slab_mag_alloc(kc->sc->mag);
+	if(!ret) {
+		mutex_acquire(&km_m);
+		ret = slab_alloc_from_cache(kc->sc, kc->align);
+		mutex_release(&km_m);
+	}
+	if(kc->ctor)
+		kc->ctor((void *)ret);
+	else
+		memset((void *)ret, 0, kc->size);
+	return (void *)ret;
+}
+
+void kmem_cache_free(kmem_cache_t *kc, void *obj)
+{
+	if(!obj) return;
+	assert((addr_t)((slab_t *)*(addr_t *)((addr_t)obj - sizeof(addr_t)))->parent 
+			== (addr_t)kc->sc);
+	kfree(obj);
+}
@@ -239,6 +239,7 @@ int do_page_out_task_addr(task_t *t, unsigned addr)
 	unlock_scheduler();
 	if(!attr) {
 		t->state = oldstate;
+		task_poke(t);
 		return -1;
 	}
 	/* Map it in where it was in theirs */
@@ -266,6 +267,7 @@ int do_page_out_task_addr(task_t *t, unsigned addr)
 		vm_unmap_only(addr);
 	}
 	t->state = oldstate;
+	task_poke(t);
 	return 0;
 }
 
@@ -1,14 +1,158 @@
 /* mutex.c - Handles mutual exclusion locks 
  * copyright 2013 Daniel Bittman
  * 
- * These are much simpler than RWlocks. They only use 1 bit and can be
- * in only two states: locked or unlocked. 
+ * These are much simpler than RWlocks. They can be in only two states:
+ * locked or unlocked. Tasks that have to wait for a mutex sleep on a
+ * list in the mutex, and are handed the lock in order.
  */
 #include <atomic.h>
 #include <mutex.h>
 #include <kernel.h>
 #include <task.h>
 #include <cpu.h>
+#include <lockstat.h>
+#include <asm/system.h>
+/* how many times a waiter checks the lock while the owner is running on
+ * another cpu before giving up and going to sleep */
+#define MUTEX_SPIN 1000
+/* a ticket lock waiter pauses this many times for each cpu ahead of it
+ * before looking at the lock again */
+#define MUTEX_TICKET_BACKOFF 32
+
+struct mutex_waiter {
+	struct mutex_waiter *next;
+	task_t *task;
+	volatile int granted;
+};
+
+static void __mutex_owned(mutex_t *m)
+{
+	assert(m->lock);
+	if(current_task) {
+		m->pid = current_task->pid;
+		m->owner = (void *)current_task;
+	}
+}
+
+#if CONFIG_SMP
+/* there's no point in spinning if the owner isn't running, since it
+ * won't release the lock until it gets to run again */
+static int __mutex_owner_running(mutex_t *m)
+{
+	task_t *owner = m->owner;
+	if(!owner || owner->magic != TASK_MAGIC || !current_task)
+		return 0;
+	cpu_t *cpu = owner->cpu;
+	return cpu && cpu != current_task->cpu && cpu->cur == owner;
+}
+#endif
+
+static void __mutex_wait_lock(mutex_t *m)
+{
+	while(bts_atomic(&m->lock, 2)) {
+		asm("pause");
+	}
+}
+
+/* MT_NOSCHED locks are taken in ticket order. Waiters only read
+ * now_serving, and back off in proportion to how far back in line they
+ * are, so the cache line isn't hammered with locked writes */
+static int __mutex_ticket_lock(mutex_t *m, char *file, int line)
+{
+	unsigned me = __sync_fetch_and_add(&m->next_ticket, 1);
+	int waited = 0;
+#if DEBUG
+	int t = 100000000;
+#endif
+	unsigned ahead;
+	while((ahead = me - m->now_serving)) {
+		waited = 1;
+		for(unsigned i=0;i<ahead * MUTEX_TICKET_BACKOFF;i++) {
+			asm("pause"); /* the intel manuals suggest this */
+		}
+#if DEBUG
+		if(!--t) panic(0, "mutex time out %s:%d\n", file, line);
+#endif
+	}
+	/* the lock bit is still kept so that the checks on m->lock work
+	 * the same for all mutexes */
+	m->lock = 1;
+	return waited;
+}
+
+/* returns 1 if we got the lock, or 0 if we had to wait and it was handed
+ * to us by the previous owner */
+static int __mutex_sleep(mutex_t *m)
+{
+	struct mutex_waiter w;
+	w.next = 0;
+	w.task = (task_t *)current_task;
+	w.granted = 0;
+	int old = set_int(0);
+	__mutex_wait_lock(m);
+	/* the owner can't release the lock while we hold the wait list,
+	 * so if it's still locked now we'll be woken up */
+	if(!bts_atomic(&m->lock, 0)) {
+		btr_atomic(&m->lock, 2);
+		set_int(old);
+		return 1;
+	}
+	if(m->wait_tail)
+		m->wait_tail->next = &w;
+	else
+		m->wait_head = &w;
+	m->wait_tail = &w;
+	or_atomic(&m->lock, MT_LCK_WAITERS);
+	raise_flag(TF_MUTEX);
+	current_task->state = TASK_USLEEP;
+	btr_atomic(&m->lock, 2);
+	while(!w.granted)
+		schedule();
+	set_int(old);
+	return 0;
+}
+
+/* take the lock, returning 1 if we had to wait for it */
+static int __mutex_lock(mutex_t *m, char *file, int line)
+{
+#if DEBUG
+	int t = 100000000;
+#endif
+	if(m->flags & MT_NOSCHED) {
+		int waited = __mutex_ticket_lock(m, file, line);
+		__mutex_owned(m);
+		return waited;
+	}
+	if(!bts_atomic(&m->lock, 0)) {
+		__mutex_owned(m);
+		return 0;
+	}
+#if CONFIG_SMP
+	for(int spin = MUTEX_SPIN; spin && __mutex_owner_running(m); spin--) {
+		asm("pause");
+		if(!(m->lock & 1) && !bts_atomic(&m->lock, 0))
+			goto out;
+	}
+#endif
+	if(task_can_sleep()) {
+		if(__mutex_sleep(m))
+			goto out;
+		/* the lock was handed to us */
+		assert(m->lock && m->pid == (int)current_task->pid);
+		return 1;
+	}
+	/* we can't sleep here, so poll for it the old way */
+	while(bts_atomic(&m->lock, 0)) {
+		schedule();
+#if DEBUG
+		if(!--t) panic(0, "mutex time out %s:%d\n", file, line);
+#endif
+	}
+	out:
+	__mutex_owned(m);
+	return 1;
+}
+
 /* a task may relock a mutex if it is inside an interrupt handler, 
  * and has previously locked the same mutex outside of the interrupt
  * handler. this allows for a task to handle an event that requires
@@ -29,27 +173,37 @@ void __mutex_acquire(mutex_t *m, char *file, int line)
 		&& (m->flags & MT_NOSCHED) && !(((cpu_t *)current_task->cpu)->flags&CPU_INTER)
 		&& (int)current_task->pid != m->pid && m->pid != -1)
 			panic(0, "mutex will deadlock (%d %d): %s:%d\n", file, line);
-#if DEBUG
-	int t = 100000000;
-#endif
 	if(current_task && (m->pid == (int)current_task->pid) && (current_task->flags & TF_IN_INT)) {
 		/* we don't need to be atomic, since we already own the lock */
 		assert(!(m->lock & MT_LCK_INT));
 		m->lock |= MT_LCK_INT;
 		return;
 	}
-	/* wait until we can set bit 0. once this is done, we have the lock */
-	while(bts_atomic(&m->lock, 0)) {
-		if(!(m->flags & MT_NOSCHED))
-			schedule();
-		else
-			asm("pause"); /* the intel manuals suggest this */
-#if DEBUG
-		if(!--t) panic(0, "mutex time out %s:%d\n", file, line);
+#if CONFIG_LOCKSTAT
+	unsigned long long start = read_tsc();
+	int contended = __mutex_lock(m, file, line);
+	m->ls_acquired = read_tsc();
+	m->ls_site = lockstat_site(file, line, LS_MUTEX);
+	lockstat_acquired(m->ls_site, m->ls_acquired - start, contended);
+#else
+	__mutex_lock(m, file, line);
 #endif
-	}
-	assert(m->lock);
-	if(current_task) m->pid = current_task->pid;
+}
+
+/* take the lock only if nobody (including us) holds it. Returns 1 if
+ * we got it. Not for MT_NOSCHED mutexes */
+int __mutex_trylock(mutex_t *m, char *file, int line)
+{
+	assert(m->magic == MUTEX_MAGIC);
+	assert(!(m->flags & MT_NOSCHED));
+	if(kernel_state_flags & KSF_SHUTDOWN) return 1;
+	if(bts_atomic(&m->lock, 0))
+		return 0;
+	__mutex_owned(m);
+#if CONFIG_LOCKSTAT
+	m->ls_site = 0;
+#endif
+	return 1;
 }
 
 void __mutex_release(mutex_t *m, char *file, int line)
@@ -65,8 +219,46 @@ void __mutex_release(mutex_t *m, char *file, int line)
 		m->lock &= ~MT_LCK_INT;
 		return;
 	}
+#if CONFIG_LOCKSTAT
+	lockstat_released(m->ls_site, read_tsc() - m->ls_acquired);
+#endif
 	m->pid = -1;
-	btr_atomic(&m->lock, 0);
+	m->owner = 0;
+	if(m->flags & MT_NOSCHED) {
+		m->lock = 0;
+		/* this is a locked instruction, so the stores above are seen
+		 * before the next ticket holder goes */
+		add_atomic(&m->now_serving, 1);
+		return;
+	}
+	/* fast path: nobody is waiting */
+	if(cas_atomic(&m->lock, 1, 0))
+		return;
+	int old = set_int(0);
+	__mutex_wait_lock(m);
+	struct mutex_waiter *w = m->wait_head;
+	if(w) {
+		/* hand the lock straight to the first waiter, so that the bit
+		 * never gets cleared for someone else to take */
+		m->wait_head = w->next;
+		if(!m->wait_head) {
+			m->wait_tail = 0;
+			and_atomic(&m->lock, ~MT_LCK_WAITERS);
+		}
+		task_t *t = w->task;
+		m->pid = t->pid;
+		m->owner = (void *)t;
+		/* w lives on the waiter's stack, so we can't touch it after
+		 * this */
+		w->granted = 1;
+		lower_task_flag(t, TF_MUTEX);
+		if(t->state == TASK_USLEEP)
+			t->state = TASK_RUNNING;
+		task_poke(t);
+	} else
+		btr_atomic(&m->lock, 0);
+	btr_atomic(&m->lock, 2);
+	set_int(old);
 }
 
 mutex_t *mutex_create(mutex_t *m, unsigned flags)
@@ -81,6 +273,12 @@ mutex_t *mutex_create(mutex_t *m, unsigned flags)
 	m->lock=0;
 	m->magic = MUTEX_MAGIC;
 	m->pid = -1;
+	m->owner = 0;
+	m->wait_head = m->wait_tail = 0;
+	m->next_ticket = m->now_serving = 0;
+#if CONFIG_LOCKSTAT
+	m->ls_site = 0;
+#endif
 	return m;
 }
 
@@ -88,6 +286,7 @@ void mutex_destroy(mutex_t *m)
 {
 	assert(m->magic == MUTEX_MAGIC);
 	if(kernel_state_flags & KSF_SHUTDOWN) return;
+	assert(!m->wait_head);
 	m->lock = m->magic = 0;
 	if(m->flags & MT_ALLOC)
 		kfree(m);
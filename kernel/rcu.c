@@ -0,0 +1,29 @@
+/* rcu.c - waiting for read-copy-update readers
+ * A reader that was running when an entry was unlinked keeps its cpu's
+ * reader count above zero until it's done. So once we've seen every
+ * other cpu's count at zero, nobody can still be looking at the entry.
+ * With one cpu there's nothing to wait for: readers can't be interrupted,
+ * so none can be running while we are.
+ */
+#include <kernel.h>
+#include <cpu.h>
+#include <rcu.h>
+
+void synchronize_rcu()
+{
+#if CONFIG_SMP
+	/* make sure that the unlink is seen before we look */
+	__sync_synchronize();
+	cpu_t *me = current_task ? current_task->cpu : 0;
+	for(unsigned i=0;i<cpu_array_num;i++) {
+		cpu_t *cpu = &cpu_array[i];
+		if(cpu == me) {
+			assert(!cpu->rcu_readers);
+			continue;
+		}
+		while(cpu->rcu_readers) {
+			asm("pause");
+		}
+	}
+#endif
+}
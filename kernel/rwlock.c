@@ -4,14 +4,181 @@
  * each rwlock may have any number of readers, but only one writer. Also
  * a writer may only clench a lock if there are zero readers, and if
  * a writer has the lock, no readers may lock it. If a lock cannot be
- * acquired, it will go into sleep until the lock can be acquired
+ * acquired, the task goes to sleep on the lock's wait list, and is
+ * handed the lock by whoever releases it. Waiters are served in order,
+ * except that readers at the front of the list are let in together.
  */
 #include <kernel.h>
 #include <atomic.h>
 #include <rwlock.h>
 #include <task.h>
+#include <cpu.h>
+#include <lockstat.h>
+#include <asm/system.h>
 #undef DEBUG
 #define DEBUG 0
+
+/* a reader waiting to escalate to a writer. It keeps its read lock
+ * while it waits */
+#define RWL_UPGRADE 0x8
+
+struct rwlock_waiter {
+	struct rwlock_waiter *next;
+	task_t *task;
+	unsigned type;
+	volatile int granted;
+};
+
+/* everything below is done with the wait list guarded and interrupts
+ * off, since rwlocks may be used in interrupt handlers */
+static int __rwlock_guard(rwlock_t *lock)
+{
+	int old = set_int(0);
+	while(bts_atomic(&lock->wait, 0)) {
+		asm("pause");
+	}
+	return old;
+}
+
+static void __rwlock_unguard(rwlock_t *lock, int old)
+{
+	btr_atomic(&lock->wait, 0);
+	set_int(old);
+}
+
+static int __rwlock_can_take(rwlock_t *lock, unsigned flags)
+{
+	if(flags & RWL_WRITER)
+		return !lock->locks && !lock->wait_head;
+	if(lock->locks & 1)
+		return 0;
+	/* a task that already reads from some lock is let in past waiting
+	 * writers, since it may be taking this one recursively */
+	return !lock->writers_waiting || (current_task && current_task->rwl_reads);
+}
+
+static void __rwlock_take(rwlock_t *lock, unsigned flags)
+{
+	if(flags & RWL_WRITER) {
+		lock->locks = 1;
+		return;
+	}
+	lock->locks += 2;
+	if(current_task)
+		current_task->rwl_reads++;
+}
+
+static void __rwlock_grant(rwlock_t *lock, struct rwlock_waiter *w)
+{
+	task_t *t = w->task;
+	lock->wait_head = w->next;
+	if(!lock->wait_head)
+		lock->wait_tail = 0;
+	if(w->type & RWL_READER) {
+		lock->locks += 2;
+		t->rwl_reads++;
+	} else {
+		lock->locks = 1;
+		lock->writers_waiting--;
+		if(w->type & RWL_UPGRADE)
+			t->rwl_reads--;
+	}
+	/* w lives on the waiter's stack, so we can't touch it after this */
+	w->granted = 1;
+	lower_task_flag(t, TF_MUTEX);
+	if(t->state == TASK_USLEEP)
+		t->state = TASK_RUNNING;
+	task_poke(t);
+}
+
+/* hand the lock to the waiters at the front of the list, if they can
+ * have it now */
+static void __rwlock_wake(rwlock_t *lock)
+{
+	struct rwlock_waiter *w;
+	while((w = lock->wait_head)) {
+		unsigned type = w->type;
+		if(type & RWL_UPGRADE) {
+			if(lock->locks != 2)
+				break;
+		} else if(type & RWL_WRITER) {
+			if(lock->locks)
+				break;
+		} else if(lock->locks & 1)
+			break;
+		__rwlock_grant(lock, w);
+		if(!(type & RWL_READER))
+			break;
+	}
+}
+
+/* called with the wait list guarded. Returns once the lock has been
+ * handed to us */
+static void __rwlock_sleep(rwlock_t *lock, unsigned type, int old)
+{
+	struct rwlock_waiter w;
+	w.next = 0;
+	w.task = (task_t *)current_task;
+	w.type = type;
+	w.granted = 0;
+	if(type & RWL_UPGRADE) {
+		/* everyone else is waiting for our read lock to go away
+		 * anyway, so an escalating reader goes first */
+		w.next = lock->wait_head;
+		lock->wait_head = &w;
+		if(!lock->wait_tail)
+			lock->wait_tail = &w;
+	} else {
+		if(lock->wait_tail)
+			lock->wait_tail->next = &w;
+		else
+			lock->wait_head = &w;
+		lock->wait_tail = &w;
+	}
+	if(type & RWL_WRITER)
+		lock->writers_waiting++;
+	raise_flag(TF_MUTEX);
+	current_task->state = TASK_USLEEP;
+	btr_atomic(&lock->wait, 0);
+	while(!w.granted)
+		schedule();
+	set_int(old);
+}
+
+/* take the lock, returning 1 if we had to wait for it */
+static int __rwlock_lock(rwlock_t *lock, unsigned flags, char *file, int line)
+{
+	int old = __rwlock_guard(lock);
+	if(__rwlock_can_take(lock, flags)) {
+		__rwlock_take(lock, flags);
+		__rwlock_unguard(lock, old);
+		return 0;
+	}
+	if(task_can_sleep()) {
+		__rwlock_sleep(lock, flags, old);
+		return 1;
+	}
+	__rwlock_unguard(lock, old);
+	/* we can't sleep here, so poll for it */
+#if DEBUG
+	int timeout = 100000;
+#endif
+	while(1) {
+		schedule();
+		old = __rwlock_guard(lock);
+		if(__rwlock_can_take(lock, flags)) {
+			__rwlock_take(lock, flags);
+			__rwlock_unguard(lock, old);
+			return 1;
+		}
+		__rwlock_unguard(lock, old);
+#if DEBUG
+		if(!--timeout)
+			panic(0, "waited too long to acquire the lock:%s:%d\n", file, line);
+#endif
+	}
+}
+
 void __rwlock_acquire(rwlock_t *lock, unsigned flags, char *file, int line)
 {
 	assert(lock->magic == RWLOCK_MAGIC);
@@ -19,49 +186,22 @@ void __rwlock_acquire(rwlock_t *lock, unsigned flags, char *file, int line)
 #ifdef RWL_DEBUG
 	  printk(0, "TRACE: %d: acquire rwl %x (%d) (%d): %s:%d\n", current_task->pid, lock, lock->locks, flags, file, line);
 #endif
-	while(1) 
-	{
-		/* if we're trying to get a writer lock, we need to wait until the
-		* lock is completely cleared */
-#if DEBUG
-		int timeout = 100000;
-		while((flags & RWL_WRITER) && lock->locks && --timeout) schedule();
-		if(timeout == 0)
-			panic(0, "(1) waited too long to acquire the lock:%s:%d\n", file, line);
-		/* now, spinlock-acquire the write_lock bit */
-		timeout = 100000;
-#else
-		while((flags & RWL_WRITER) && lock->locks) schedule();
-#endif
-		/* now try to get the write lock so we have exclusive access
-		 * to the lock itself */
-#if DEBUG
-		while(bts_atomic(&lock->locks, 0) && --timeout)
-			schedule();
-		if(timeout == 0)
-			panic(0, "(2) waited too long to acquire the lock:%s:%d\n", file, line);
+	flags &= (RWL_READER | RWL_WRITER);
+#if CONFIG_LOCKSTAT
+	unsigned long long start = read_tsc();
+	int contended = __rwlock_lock(lock, flags, file, line);
+	unsigned long long now = read_tsc();
+	struct lockstat_site *site = lockstat_site(file, line, LS_RWLOCK);
+	lockstat_acquired(site, now - start, contended);
+	/* there may be many readers, so hold times are only kept for
+	 * writers */
+	if(flags & RWL_WRITER) {
+		lock->ls_site = site;
+		lock->ls_acquired = now;
+	}
 #else
-		while(bts_atomic(&lock->locks, 0))
-			schedule();
+	__rwlock_lock(lock, flags, file, line);
 #endif
-		/* if we're trying to read, we need to increment the locks by 2
-		 * thus skipping over the write_lock bit */
-		if(flags & RWL_READER) {
-			add_atomic(&lock->locks, 2);
-			/* and now reset the write_lock */
-			btr_atomic(&lock->locks, 0);
-			break;
-		}
-		if(flags & RWL_WRITER) {
-			/* if we were able to get the lock (write_lock bit is set, 
-			 * and there are no readers), then we break. Otherwise, we 
-			 * reset the write_bit and try again */
-			if(lock->locks == 1)
-				break;
-			else
-				btr_atomic(&lock->locks, 0);
-		}
-	}
 }
 
 void __rwlock_escalate(rwlock_t *lock, unsigned flags, char *file, int line)
@@ -72,46 +212,63 @@ void __rwlock_escalate(rwlock_t *lock, unsigned flags, char *file, int line)
 #ifdef RWL_DEBUG
 	printk(0, "TRACE: %d: escalate rwl %x (%d) (%d): %s:%d\n", current_task->pid, lock, lock->locks, flags, file, line);
 #endif
+	int old = __rwlock_guard(lock);
 	if(lock->locks == 1 && (flags & RWL_READER)) {
-		/* change from a writer lock to a reader lock. This is easy. */
-		add_atomic(&lock->locks, 2);
-		/* and now reset the write_lock */
-		btr_atomic(&lock->locks, 0);
+		/* change from a writer lock to a reader lock. This is easy,
+		 * and may let in readers that were waiting on us */
+		lock->locks = 0;
+		__rwlock_take(lock, RWL_READER);
+		__rwlock_wake(lock);
 	} else if(lock->locks % 2 == 0 && (flags & RWL_WRITER)) {
-		/* change from a reader to a writer. This is, of course,
-		 * less simple. We must wait until we are the only reader, and
-		 * then attempt a switch */
-		while(1) {
-#if DEBUG
-			int timeout = 100000;
-			while(lock->locks != 2 && --timeout) schedule();
-			if(timeout == 0)
-				panic(0, "(1) waited too long to acquire the lock:%s:%d\n", file, line);
-			timeout=100000;
-#else
-			while(lock->locks != 2) schedule();
+		/* change from a reader to a writer. We must wait until we are
+		 * the only reader */
+#if CONFIG_LOCKSTAT
+		lock->ls_site = 0;
 #endif
-			/* now, spinlock-acquire the write_lock bit */
-#if DEBUG
-			while(bts_atomic(&lock->locks, 0) && --timeout)
+		if(lock->locks == 2) {
+			lock->locks = 1;
+			if(current_task && current_task->rwl_reads)
+				current_task->rwl_reads--;
+		} else if(task_can_sleep()) {
+			if(lock->wait_head && (lock->wait_head->type & RWL_UPGRADE))
+				panic(0, "two readers tried to escalate rwlock %x: %s:%d\n", lock, file, line);
+			__rwlock_sleep(lock, RWL_WRITER | RWL_UPGRADE, old);
+			return;
+		} else {
+			__rwlock_unguard(lock, old);
+			while(1) {
 				schedule();
-			if(timeout == 0)
-				panic(0, "(2) waited too long to acquire the lock:%s:%d\n", file, line);
-#else
-			while(bts_atomic(&lock->locks, 0))
-				schedule();
-#endif
-			if(lock->locks == 3)
-			{
-				/* remove our read lock */
-				sub_atomic(&lock->locks, 2);
-				break;
+				old = __rwlock_guard(lock);
+				if(lock->locks == 2)
+					break;
+				__rwlock_unguard(lock, old);
 			}
-			/* failed to grab the write_lock bit before a task
-			 * added itself */
-			btr_atomic(&lock->locks, 0);
+			lock->locks = 1;
+			if(current_task && current_task->rwl_reads)
+				current_task->rwl_reads--;
 		}
 	}
+	__rwlock_unguard(lock, old);
+}
+
+/* take the lock only if we can do so without waiting. Returns 1 if we
+ * got it */
+int rwlock_trylock(rwlock_t *lock, unsigned flags)
+{
+	assert(lock->magic == RWLOCK_MAGIC);
+	if(kernel_state_flags & KSF_SHUTDOWN) return 1;
+	flags &= (RWL_READER | RWL_WRITER);
+	int old = __rwlock_guard(lock);
+	int ret = __rwlock_can_take(lock, flags);
+	if(ret) {
+		__rwlock_take(lock, flags);
+#if CONFIG_LOCKSTAT
+		if(flags & RWL_WRITER)
+			lock->ls_site = 0;
+#endif
+	}
+	__rwlock_unguard(lock, old);
+	return ret;
 }
 
 void rwlock_release(rwlock_t *lock, unsigned flags)
@@ -122,14 +279,23 @@ void rwlock_release(rwlock_t *lock, unsigned flags)
 #ifdef RWL_DEBUG
 	printk(0, "TRACE: release rwl (%d) (%d)\n", lock->locks, flags);
 #endif
+	int old = __rwlock_guard(lock);
 	if(flags & RWL_READER) {
 		assert(lock->locks >= 2);
-		sub_atomic(&lock->locks, 2);
+		lock->locks -= 2;
+		if(current_task && current_task->rwl_reads)
+			current_task->rwl_reads--;
 	}
 	else if(flags & RWL_WRITER) {
 		assert(lock->locks == 1);
-		btr_atomic(&lock->locks, 0);
+		lock->locks = 0;
+#if CONFIG_LOCKSTAT
+		lockstat_released(lock->ls_site, read_tsc() - lock->ls_acquired);
+		lock->ls_site = 0;
+#endif
 	}
+	__rwlock_wake(lock);
+	__rwlock_unguard(lock, old);
 }
 
 rwlock_t *rwlock_create(rwlock_t *lock)
@@ -140,6 +306,11 @@ rwlock_t *rwlock_create(rwlock_t *lock)
 	} else
 		memset((void *)lock, 0, sizeof(rwlock_t));
 	lock->locks = 0;
+	lock->wait = lock->writers_waiting = 0;
+	lock->wait_head = lock->wait_tail = 0;
+#if CONFIG_LOCKSTAT
+	lock->ls_site = 0;
+#endif
 	lock->magic = RWLOCK_MAGIC;
 	return lock;
 }
@@ -149,7 +320,7 @@ void rwlock_destroy(rwlock_t *lock)
 	assert(lock->magic == RWLOCK_MAGIC);
 	if(kernel_state_flags & KSF_SHUTDOWN) return;
 	lock->magic=0;
-	assert(!lock->locks);
-	if(lock->flags & RWL_ALLOC) 
+	assert(!lock->locks && !lock->wait_head);
+	if(lock->flags & RWL_ALLOC)
 		kfree((void *)lock);
 }
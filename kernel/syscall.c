@@ -117,8 +117,8 @@ void *syscall_table[129] = {
 	
 	SC sys_utime,      SC sys_gethostname,SC sys_gsetpriority,SC sys_uname, 
 	SC sys_gethost,    SC sys_getserv,    SC sys_setserv,     SC sys_syslog,
-	SC sys_posix_fsstat,SC sys_null,      SC sys_null,        SC sys_null, 
-	SC sys_null,       SC sys_null,       SC sys_waitagain,   SC /**128*/sys_null /* RESERVED*/,
+	SC sys_posix_fsstat,SC sys_msync,     SC sys_sched_setaffinity,SC sys_sched_getaffinity,
+	SC sys_sched_setscheduler,SC sys_sched_getscheduler,SC sys_waitagain,   SC /**128*/sys_null /* RESERVED*/,
 };
 
 void init_syscalls()
@@ -158,7 +158,7 @@ int check_pointers(volatile registers_t *regs)
 	switch(SYSCALL_NUM_AND_RET) {
 		case SYS_READ: case SYS_FSTAT: case SYS_STAT: case SYS_GETPATH:
 		case SYS_READLINK: case SYS_GETNODESTR: 
-		case SYS_POSFSSTAT:
+		case SYS_POSFSSTAT: case SYS_MMAP:
 			return __is_valid_user_ptr(SYSCALL_NUM_AND_RET, (void *)_B_, 0);
 			
 		case SYS_TIMES: case SYS_GETPWD: case SYS_PIPE: 
@@ -192,6 +192,12 @@ int check_pointers(volatile registers_t *regs)
 			
 		case SYS_CHOWN: case SYS_CHMOD:
 			return __is_valid_user_ptr(SYSCALL_NUM_AND_RET, (void *)_A_, 1);
+			
+		case SYS_SETAFFINITY: case SYS_GETAFFINITY: case SYS_SETSCHED:
+			return __is_valid_user_ptr(SYSCALL_NUM_AND_RET, (void *)_C_, 0);
+			
+		case SYS_GETSCHED:
+			return __is_valid_user_ptr(SYSCALL_NUM_AND_RET, (void *)_B_, 1);
 	}
 	return 1;
 }
@@ -241,8 +247,9 @@ int syscall_handler(volatile registers_t *regs)
 	 * to write() from starving the resources of other tasks. syscall_count resets
 	 * on each call to schedule() */
 	if(current_task->flags & TF_SCHED 
-		|| (unsigned)(ticks-current_task->slice) > (unsigned)current_task->cur_ts
-		|| ++current_task->syscall_count > 2)
+		|| (current_task->policy == SCHED_OTHER
+			&& ((unsigned)(ticks-current_task->slice) > (unsigned)current_task->cur_ts
+			|| ++current_task->syscall_count > 2)))
 	{
 		/* clear out the flag. Either way in the if statement, we've rescheduled. */
 		lower_flag(TF_SCHED);
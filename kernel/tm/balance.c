@@ -0,0 +1,94 @@
+/* balance.c - moves tasks between the cpus' run queues
+ * Each cpu pulls work for itself: periodically from the timer tick, and
+ * whenever it is running its idle task. Work is stolen from whichever cpu
+ * has the most runable tasks.
+ */
+#include <config.h>
+#if CONFIG_SMP
+#include <kernel.h>
+#include <task.h>
+#include <cpu.h>
+#include <runqueue.h>
+#include <atomic.h>
+
+/* ticks between periodic balancing on each cpu */
+#define BALANCE_INTERVAL  100
+/* tasks that have run within this many ticks are considered cache-hot */
+#define BALANCE_HOT_TICKS 5
+/* how many more runable tasks another cpu needs before we steal from it */
+#define BALANCE_IMBALANCE 2
+
+static cpu_t *find_busiest_cpu(cpu_t *me)
+{
+	cpu_t *busiest = 0;
+	for(unsigned int i=0;i<num_cpus;i++) {
+		cpu_t *c = &cpu_array[i];
+		if(c == me || !(c->flags & CPU_TASK) || !c->active_queue)
+			continue;
+		if(!busiest || c->active_queue->num > busiest->active_queue->num)
+			busiest = c;
+	}
+	return busiest;
+}
+
+/* the least loaded cpu that t is allowed to run on. pref wins ties */
+cpu_t *sched_pick_cpu(task_t *t, cpu_t *pref)
+{
+	cpu_t *best = 0;
+	if(pref && (pref->flags & CPU_TASK) && pref->active_queue 
+			&& task_cpu_allowed(t, pref))
+		best = pref;
+	for(unsigned int i=0;i<num_cpus;i++) {
+		cpu_t *c = &cpu_array[i];
+		if(!(c->flags & CPU_TASK) || !c->active_queue || !task_cpu_allowed(t, c))
+			continue;
+		if(!best || c->active_queue->num < best->active_queue->num)
+			best = c;
+	}
+	return best;
+}
+
+/* try to pull a task onto this cpu. Returns 1 if a task was moved */
+int balance_cpu(cpu_t *me, int idle)
+{
+	if(!(me->flags & CPU_TASK) || !me->active_queue)
+		return 0;
+	/* the idle task may call this in a tight loop, so limit it to once
+	 * per tick */
+	if(idle) {
+		if(me->last_idle_balance == (unsigned long)ticks)
+			return 0;
+		me->last_idle_balance = ticks;
+	}
+	cpu_t *busiest = find_busiest_cpu(me);
+	if(!busiest)
+		return 0;
+	if(busiest->active_queue->num < me->active_queue->num + BALANCE_IMBALANCE)
+		return 0;
+	int old = set_int(0);
+	/* holding the cpu lock keeps the busiest cpu from switching tasks
+	 * while we choose one */
+	mutex_acquire(&busiest->lock);
+	task_t *t = runqueue_steal(busiest->active_queue, me->active_queue,
+			BALANCE_HOT_TICKS);
+	if(t) {
+		sub_atomic(&busiest->numtasks, 1);
+		add_atomic(&me->numtasks, 1);
+		add_atomic(&busiest->migrations_out, 1);
+		add_atomic(&me->migrations_in, 1);
+	}
+	mutex_release(&busiest->lock);
+	set_int(old);
+	return t ? 1 : 0;
+}
+
+/* called from the timer tick on each cpu */
+void balance_tick(cpu_t *me)
+{
+	if((unsigned long)ticks < me->next_balance)
+		return;
+	me->next_balance = ticks + BALANCE_INTERVAL;
+	balance_cpu(me, 0);
+}
+
+#endif
@@ -6,6 +6,8 @@
 #include <task.h>
 #include <cpu.h>
 #include <atomic.h>
+#include <exec.h>
+#include <mmfile.h>
 
 __attribute__((always_inline)) inline void set_as_dead(task_t *t)
 {
@@ -14,16 +16,17 @@ __attribute__((always_inline)) inline void set_as_dead(task_t *t)
 	sub_atomic(&(((cpu_t *)t->cpu)->numtasks), 1);
 	set_int(0);
 	raise_flag(TF_DYING);
-	tqueue_remove(((cpu_t *)t->cpu)->active_queue, t->activenode);
+	runqueue_remove(((cpu_t *)t->cpu)->active_queue, t);
 	t->state = TASK_DEAD;
 }
 
+/* locked is set if the caller holds the task index lock (see tasklist.c) */
 void move_task_to_kill_queue(task_t *t, int locked)
 {
-	if(locked)
-		tqueue_remove_nolock(primary_queue, t->listnode);
-	else
-		tqueue_remove(primary_queue, t->listnode);
+	/* only the first one to get here reaps the task */
+	if(!(locked ? __task_index_remove(t) : task_index_remove(t)))
+		return;
+	tqueue_remove(primary_queue, t->listnode);
 	raise_task_flag(t, TF_KILLREADY);
 }
 
@@ -67,11 +70,14 @@ int __KT_try_releasing_tasks()
 void release_task(task_t *p)
 {
 	destroy_task_page_directory(p);
-	kfree(p->listnode);
-	kfree(p->activenode);
-	kfree(p->blocknode);
+	if(p->sleep_timer)
+		timer_destroy(p->sleep_timer);
+	if(p->alarm_timer)
+		timer_destroy(p->alarm_timer);
+	kmem_cache_free(llistnode_cache, p->listnode);
+	kmem_cache_free(llistnode_cache, p->blocknode);
 	kfree((void *)p->kernel_stack);
-	kfree((void *)p);
+	kmem_cache_free(task_cache, (void *)p);
 }
 
 void task_suicide()
@@ -89,6 +95,7 @@ void kill_task(unsigned int pid)
 	}
 	task->state = TASK_SUICIDAL;
 	task->sigd = 0; /* fuck your signals */
+	task_poke(task);
 	if(task == current_task)
 	{
 		for(;;) schedule();
@@ -104,6 +111,11 @@ void exit(int code)
 	assert(t->thread->magic == THREAD_MAGIC);
 	ll_insert(kill_queue, (void *)t);
 	raise_flag(TF_EXITING);
+	/* make sure no timers fire for us after we're gone */
+	if(t->sleep_timer)
+		timer_cancel(t->sleep_timer);
+	if(t->alarm_timer)
+		timer_cancel(t->alarm_timer);
 	if(code != -9) 
 		t->exit_reason.cause = 0;
 	t->exit_reason.ret = code;
@@ -125,19 +137,22 @@ void exit(int code)
 		kfree(addr);
 	}
 	/* don't do this while the state is dead, as we may step on the toes of waitpid.
-	 * this fixes all tasks that are children of current_task, or are waiting
-	 * on current_task. For those waiting, it signals the task. For those that
-	 * are children, it fixes the 'parent' pointer. */
-	search_tqueue(primary_queue, TSEARCH_EXIT_PARENT | TSEARCH_EXIT_WAITING, 0, 0, 0, 0);
+	 * this signals the tasks waiting on current_task, and fixes the 'parent'
+	 * pointer of its children */
+	task_index_exit(t);
 	char flag_last_page_dir_task;
 	/* is this the last task to use this pd_info? */
 	flag_last_page_dir_task = (sub_atomic(&pd_cur_data->count, 1) == 0) ? 1 : 0;
 	if(flag_last_page_dir_task) {
 		/* no one else is referencing this directory. Clean it up... */
+		mmf_release_space();
+		exec_release_image();
 		free_thread_shared_directory();
 		vm_unmap(PDIR_DATA);
 		raise_flag(TF_LAST_PDIR);
 	}
 	set_as_dead(t);
+	/* only now is waitpid allowed to reap us */
+	task_child_event(t, WEV_EXIT);
 	for(;;) schedule();
 }
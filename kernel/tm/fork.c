@@ -44,8 +44,12 @@ void copy_task_struct(task_t *task, task_t *parent, char share_thread_data)
 	}
 	
 	task->tty = parent->tty;
+	task->pgid = parent->pgid;
+	task->sid = parent->sid;
 	task->sig_mask = parent->sig_mask;
 	task->priority = parent->priority;
+	task->policy = parent->policy;
+	task->rt_priority = parent->rt_priority;
 	task->stack_end = parent->stack_end;
 	task->heap_end = parent->heap_end;
 	task->heap_start = parent->heap_start;
@@ -53,6 +57,9 @@ void copy_task_struct(task_t *task, task_t *parent, char share_thread_data)
 	task->cmask = parent->cmask;
 	task->path_loc_start = parent->path_loc_start;
 
+#if CONFIG_SMP
+	memcpy((void *)task->cpu_mask, (void *)parent->cpu_mask, sizeof(task->cpu_mask));
+#endif
 	copy_file_handles(parent, task);
 	/* this flag gets cleared on the first scheduling of this task */
 	task->flags = TF_FORK;
@@ -61,24 +68,18 @@ void copy_task_struct(task_t *task, task_t *parent, char share_thread_data)
 
 #if CONFIG_SMP
 unsigned int __counter = 0;
-cpu_t *fork_choose_cpu(task_t *parent)
+cpu_t *fork_choose_cpu(task_t *task)
 {
-	cpu_t *pc = parent->cpu;
+	cpu_t *pc = task->parent->cpu;
 	cpu_t *cpu = &cpu_array[__counter];
 	add_atomic(&__counter, 1);
 	if(__counter >= num_cpus)
 		__counter=0;
-	if(!(cpu->flags & CPU_TASK))
-		return pc;
-	if(cpu->active_queue->num < 2) return cpu;
-	for(unsigned int i=0;i<num_cpus;i++) {
-		cpu_t *tmp = &cpu_array[i];
-		if(tmp->active_queue->num < cpu->active_queue->num)
-			cpu = tmp;
-	}
-	if(!(cpu->flags & CPU_TASK))
-		return pc;
-	return cpu;
+	if((cpu->flags & CPU_TASK) && task_cpu_allowed(task, cpu) 
+			&& cpu->active_queue->num < 2)
+		return cpu;
+	cpu = sched_pick_cpu(task, cpu);
+	return cpu ? cpu : pc;
 }
 #endif
 
@@ -92,7 +93,7 @@ int do_fork(unsigned flags)
 	if(flags & FORK_SHAREDIR)
 		newspace = vm_copy(current_task->pd);
 	else
-		newspace = vm_clone(current_task->pd, 0);
+		newspace = vm_clone(current_task->pd, 1);
 	if(!newspace)
 	{
 		kfree((void *)task);
@@ -111,9 +112,10 @@ int do_fork(unsigned flags)
 	 * And then add it to the queue */
 	task->state = TASK_USLEEP;
 	tqueue_insert(primary_queue, (void *)task, task->listnode);
+	task_index_add(task);
 	cpu_t *cpu = (cpu_t *)current_task->cpu;
 #if CONFIG_SMP
-	cpu = fork_choose_cpu(current_task);
+	cpu = fork_choose_cpu(task);
 #endif
 	/* Copy the stack */
 	set_int(0);
@@ -131,7 +133,8 @@ int do_fork(unsigned flags)
 		task->state = TASK_RUNNING;
 		task->cpu = cpu;
 		add_atomic(&cpu->numtasks, 1);
-		tqueue_insert(cpu->active_queue, (void *)task, task->activenode);
+		runqueue_insert(cpu->active_queue, task);
+		sched_wakeup(task);
 		__engage_idle();
 		return task->pid;
 	}
@@ -0,0 +1,337 @@
+/* runqueue.c - per-cpu priority run queues
+ * Picking the next task is constant time: we find the highest non-empty
+ * level from the bitmap and take the head of that level's list. The same
+ * rules as for tqueues apply: interrupts must be disabled and the mutex
+ * held while touching a run queue.
+ */
+#include <kernel.h>
+#include <task.h>
+#include <runqueue.h>
+#include <mutex.h>
+#include <atomic.h>
+#include <cpu.h>
+
+runqueue_t *runqueue_create(runqueue_t *rq, void *cpu, unsigned flags)
+{
+	if(!rq) {
+		rq = (void *)kmalloc(sizeof(runqueue_t));
+		rq->flags = (RQ_ALLOC | flags);
+	} else
+		rq->flags = flags;
+	mutex_create(&rq->lock, MT_NOSCHED);
+	rq->cpu = cpu;
+	memset(rq->arrays, 0, sizeof(rq->arrays));
+	rq->active = &rq->arrays[0];
+	rq->expired = &rq->arrays[1];
+	rq->rt = &rq->arrays[2];
+	rq->num = 0;
+	rq->rt_used = rq->rt_throttled = 0;
+	rq->rt_period = ticks;
+	rq->magic = RQ_MAGIC;
+	return rq;
+}
+
+void runqueue_destroy(runqueue_t *rq)
+{
+	assert(!rq->num);
+	mutex_destroy(&rq->lock);
+	if(rq->flags & RQ_ALLOC)
+		kfree(rq);
+}
+
+static int __rq_level(task_t *t)
+{
+	if(t->policy != SCHED_OTHER)
+		return RQ_RT_LEVEL(t->rt_priority);
+	int level = GET_MAX_TS(t) + RQ_PRIO_BIAS;
+	if(level < 0)
+		level = 0;
+	if(level >= RQ_NUM_LEVELS)
+		level = RQ_NUM_LEVELS - 1;
+	return level;
+}
+
+static int __rq_highest_level(struct rq_array *a)
+{
+	for(int i = RQ_BITMAP_WORDS; i > 0; i--) {
+		if(a->bitmap[i-1])
+			return (i-1) * RQ_BITS_PER_WORD
+				+ (RQ_BITS_PER_WORD - 1 - __builtin_clzl(a->bitmap[i-1]));
+	}
+	return -1;
+}
+
+static void __rq_list_append(struct rq_list *list, task_t *t)
+{
+	t->rq_next = 0;
+	t->rq_prev = list->tail;
+	if(list->tail)
+		list->tail->rq_next = t;
+	else
+		list->head = t;
+	list->tail = t;
+}
+
+static void __rq_list_push(struct rq_list *list, task_t *t)
+{
+	t->rq_prev = 0;
+	t->rq_next = list->head;
+	if(list->head)
+		list->head->rq_prev = t;
+	else
+		list->tail = t;
+	list->head = t;
+}
+
+static void __rq_list_unlink(struct rq_list *list, task_t *t)
+{
+	if(t->rq_prev)
+		t->rq_prev->rq_next = t->rq_next;
+	else
+		list->head = (task_t *)t->rq_next;
+	if(t->rq_next)
+		t->rq_next->rq_prev = t->rq_prev;
+	else
+		list->tail = (task_t *)t->rq_prev;
+	t->rq_next = t->rq_prev = 0;
+}
+
+/* real-time tasks always go to the rt array. If first is set, the task
+ * goes to the front of its level instead of the back */
+static void __rq_do_enqueue(runqueue_t *rq, struct rq_array *a, task_t *t, int first)
+{
+	int level = __rq_level(t);
+	if(t->policy != SCHED_OTHER)
+		a = rq->rt;
+	int i = level % RQ_NUM_LEVELS;
+	if(first)
+		__rq_list_push(&a->levels[i], t);
+	else
+		__rq_list_append(&a->levels[i], t);
+	a->bitmap[i / RQ_BITS_PER_WORD] |= (1UL << (i % RQ_BITS_PER_WORD));
+	a->num++;
+	t->rq_array = a;
+	t->rq_level = level;
+	rq->num++;
+}
+
+#define __rq_enqueue(rq, a, t) __rq_do_enqueue(rq, a, t, 0)
+
+static void __rq_unlink(runqueue_t *rq, task_t *t)
+{
+	struct rq_array *a = t->rq_array;
+	int i = t->rq_level % RQ_NUM_LEVELS;
+	assert(a == &rq->arrays[0] || a == &rq->arrays[1] || a == &rq->arrays[2]);
+	__rq_list_unlink(&a->levels[i], t);
+	if(!a->levels[i].head)
+		a->bitmap[i / RQ_BITS_PER_WORD] &= ~(1UL << (i % RQ_BITS_PER_WORD));
+	a->num--;
+	rq->num--;
+	t->rq_array = 0;
+}
+
+static __attribute__((always_inline)) inline int __rq_owns(runqueue_t *rq, task_t *t)
+{
+	return t->rq_array == &rq->arrays[0] || t->rq_array == &rq->arrays[1]
+		|| t->rq_array == &rq->arrays[2];
+}
+
+/* make a task runable on this queue. Does nothing if it's already queued.
+ * Returns -EAGAIN if the task was moved to a different cpu before we got
+ * the lock, in which case the caller should try again with the new cpu */
+int runqueue_insert(runqueue_t *rq, task_t *t)
+{
+	int ret = 0;
+	int old = set_int(0);
+	mutex_acquire(&rq->lock);
+	assert(rq->magic == RQ_MAGIC);
+	if(t->cpu != rq->cpu)
+		ret = -EAGAIN;
+	else if(!t->rq_array)
+		__rq_enqueue(rq, rq->active, t);
+	mutex_release(&rq->lock);
+	assert(!set_int(old));
+	return ret;
+}
+
+void runqueue_remove(runqueue_t *rq, task_t *t)
+{
+	int old = set_int(0);
+	mutex_acquire(&rq->lock);
+	assert(rq->magic == RQ_MAGIC);
+	if(__rq_owns(rq, t))
+		__rq_unlink(rq, t);
+	mutex_release(&rq->lock);
+	assert(!set_int(old));
+}
+
+/* requeue prev according to its state and timeslice, and then return
+ * the highest priority runable task. The returned task stays on the
+ * queue while it runs. Returns null if nothing is runable. */
+task_t *runqueue_next(runqueue_t *rq, task_t *prev)
+{
+	task_t *t = 0;
+	int old = set_int(0);
+	mutex_acquire(&rq->lock);
+	assert(rq->magic == RQ_MAGIC);
+	if(prev->rq_array) {
+		__rq_unlink(rq, prev);
+		/* a task that went to sleep stays off the queue until
+		 * something wakes it up, and one that is leaving this cpu
+		 * is queued on its new one */
+		if(task_is_runable(prev) && !(prev->flags & TF_MIGRATE)) {
+			if(prev->policy != SCHED_OTHER) {
+				/* a real-time task that is being preempted keeps its
+				 * place. Otherwise it goes behind its equals */
+				int top = __rq_highest_level(rq->rt);
+				__rq_do_enqueue(rq, rq->rt, prev, (rq->flags & RQ_THROTTLED)
+					|| (top >= 0 && RQ_RT_LEVEL(top) > prev->rq_level));
+			} else if(prev->cur_ts <= 0) {
+				prev->cur_ts = GET_MAX_TS(prev);
+				__rq_enqueue(rq, rq->expired, prev);
+			} else
+				__rq_enqueue(rq, rq->active, prev);
+		}
+	}
+	while(rq->num) {
+		struct rq_array *a = rq->rt;
+		if(!a->num || (rq->flags & RQ_THROTTLED)) {
+			if(!rq->active->num) {
+				struct rq_array *tmp = rq->active;
+				rq->active = rq->expired;
+				rq->expired = tmp;
+			}
+			a = rq->active;
+			/* only throttled real-time tasks are left */
+			if(!a->num)
+				break;
+		}
+		int level = __rq_highest_level(a);
+		assert(level >= 0);
+		t = a->levels[level].head;
+		assert(t);
+		if(unlikely(t->magic != TASK_MAGIC))
+			panic(0, "Invalid task (%d:%d): %x", t->pid, t->state, t->magic);
+		/* tasks may be put to sleep by other tasks without being
+		 * removed from the queue. Drop them lazily here */
+		if(task_is_runable(t))
+			break;
+		__rq_unlink(rq, t);
+		t = 0;
+	}
+	mutex_release(&rq->lock);
+	assert(!set_int(old));
+	return t;
+}
+
+/* change a task's scheduling policy, moving it to its new place if it's
+ * queued. Returns -EAGAIN if the task isn't on this queue's cpu */
+int runqueue_set_policy(runqueue_t *rq, task_t *t, int policy, int prio)
+{
+	int old = set_int(0);
+	mutex_acquire(&rq->lock);
+	assert(rq->magic == RQ_MAGIC);
+	if(t->cpu != rq->cpu) {
+		mutex_release(&rq->lock);
+		assert(!set_int(old));
+		return -EAGAIN;
+	}
+	int queued = __rq_owns(rq, t);
+	if(queued)
+		__rq_unlink(rq, t);
+	t->policy = policy;
+	t->rt_priority = prio;
+	t->cur_ts = GET_MAX_TS(t);
+	if(queued)
+		__rq_enqueue(rq, rq->active, t);
+	mutex_release(&rq->lock);
+	assert(!set_int(old));
+	return 0;
+}
+
+/* charge a timer tick to the running task, and start a new throttling
+ * period when it's time. Called from the tick with interrupts off.
+ * Returns 1 if the cpu should reschedule because real-time tasks were
+ * just throttled or let back in */
+int runqueue_rt_tick(runqueue_t *rq, task_t *cur)
+{
+	int resched = 0;
+	if(cur->policy != SCHED_OTHER && !(rq->flags & RQ_THROTTLED)
+			&& ++rq->rt_used * 100 >= (unsigned)RQ_RT_PERIOD * RQ_RT_SHARE) {
+		or_atomic(&rq->flags, RQ_THROTTLED);
+		rq->rt_throttled++;
+		resched = 1;
+	}
+	if((unsigned long)(ticks - rq->rt_period) >= (unsigned long)RQ_RT_PERIOD) {
+		rq->rt_period = ticks;
+		rq->rt_used = 0;
+		if(rq->flags & RQ_THROTTLED) {
+			and_atomic(&rq->flags, ~RQ_THROTTLED);
+			resched = rq->rt->num ? 1 : 0;
+		}
+	}
+	return resched;
+}
+
+static int __rq_can_steal(runqueue_t *from, runqueue_t *to, task_t *t, unsigned long hot)
+{
+	cpu_t *cpu = from->cpu;
+	if(t == cpu->cur || t == cpu->ktask || t == kernel_task)
+		return 0;
+	if(t->flags & (TF_MOVECPU | TF_MIGRATE | TF_LOCK | TF_EXITING | TF_DYING))
+		return 0;
+#if CONFIG_SMP
+	if(!task_cpu_allowed(t, (cpu_t *)to->cpu))
+		return 0;
+#endif
+	/* leave tasks that ran recently where their cache is. This also
+	 * keeps us from grabbing a task that 'from' is still in the middle
+	 * of switching away from */
+	if((unsigned long)(ticks - t->last_ran) < hot)
+		return 0;
+	return task_is_runable(t);
+}
+
+static task_t *__rq_find_steal(runqueue_t *from, runqueue_t *to, struct rq_array *a, unsigned long hot, int *scan)
+{
+	for(int level=0;level<RQ_NUM_LEVELS && *scan > 0;level++) {
+		if(!(a->bitmap[level / RQ_BITS_PER_WORD] & (1UL << (level % RQ_BITS_PER_WORD))))
+			continue;
+		task_t *t = a->levels[level].head;
+		while(t && (*scan)-- > 0) {
+			if(__rq_can_steal(from, to, t, hot))
+				return t;
+			t = (task_t *)t->rq_next;
+		}
+	}
+	return 0;
+}
+
+/* move a runable task from one cpu's queue to another. The caller must
+ * hold the lock for from's cpu so that it can't switch tasks while we
+ * look. We prefer tasks that have used up their timeslice and low
+ * priority tasks, since they are least likely to be cache-hot. */
+task_t *runqueue_steal(runqueue_t *from, runqueue_t *to, unsigned long hot)
+{
+	assert(from != to);
+	int scan = RQ_STEAL_SCAN;
+	/* always lock run queues in the same order */
+	runqueue_t *first = from < to ? from : to;
+	runqueue_t *second = from < to ? to : from;
+	int old = set_int(0);
+	mutex_acquire(&first->lock);
+	mutex_acquire(&second->lock);
+	assert(from->magic == RQ_MAGIC && to->magic == RQ_MAGIC);
+	task_t *t = __rq_find_steal(from, to, from->expired, hot, &scan);
+	if(!t)
+		t = __rq_find_steal(from, to, from->active, hot, &scan);
+	if(t) {
+		__rq_unlink(from, t);
+		t->cpu = to->cpu;
+		__rq_enqueue(to, to->active, t);
+	}
+	mutex_release(&second->lock);
+	mutex_release(&first->lock);
+	assert(!set_int(old));
+	return t;
+}
@@ -4,45 +4,91 @@
 #include <task.h>
 #include <cpu.h>
 #include <context.h>
+#include <isr.h>
+#include <atomic.h>
+#include <asm/system.h>
 
-__attribute__((always_inline)) inline void update_task(task_t *t)
-{
-	/* task's delay ran out */
-	if((t->state == TASK_USLEEP || t->state == TASK_ISLEEP) && t->tick <= ticks && t->tick)
-		t->state = TASK_RUNNING;
-}
 /* This here is the basic scheduler - It does nothing 
- * except find the next runable task */
+ * except find the next runable task. The run queue keeps only runable
+ * tasks in its priority arrays, so this doesn't depend on how many tasks
+ * are sleeping on this cpu. */
 __attribute__((always_inline)) inline task_t *get_next_task(task_t *prev, cpu_t *cpu)
 {
 	assert(prev && kernel_task);
 	assert(prev->cpu == cpu);
 	assert(cpu);
-	cpu = prev->cpu;
-	task_t *t = tqueue_next(cpu->active_queue);
-	while(t)
-	{
-		assert(t);
-		if(unlikely(t->magic != TASK_MAGIC))
-			panic(0, "Invalid task (%d:%d): %x", t->pid, t->state, t->magic);
-		/* this handles everything in the "active queue". This includes
-		 * running tasks, tasks that have timed blocks... */
-		update_task(t);
-		if(task_is_runable(t) && !(t->flags & TF_MOVECPU))
-			return t;
-		t = tqueue_next(cpu->active_queue);
-		/* This way the kernel can sleep without being in danger of 
-		 * causing a lockup. Basically, if the kernel is the only
-		 * runnable task, it gets forced to run */
-		if(t && t == prev && !task_is_runable(t)) {
-			/* make sure to update the state in case it slept */
-			assert(cpu->ktask);
-			cpu->ktask->state = TASK_RUNNING;
-			return (task_t *)cpu->ktask;
-		}
+	task_t *t = runqueue_next(cpu->active_queue, prev);
+	if(t)
+		return t;
+	/* This way the kernel can sleep without being in danger of 
+	 * causing a lockup. Basically, if nothing else is runnable,
+	 * the idle task gets forced to run */
+	assert(cpu->ktask);
+	cpu->ktask->state = TASK_RUNNING;
+	runqueue_insert(cpu->active_queue, cpu->ktask);
+	return (task_t *)cpu->ktask;
+}
+
+/* t was just put on its cpu's run queue. If it should run before
+ * whatever that cpu is running now, make the cpu reschedule: another cpu
+ * is sent an IPI, and this one reschedules at the next point where it's
+ * safe to (see resched_if_needed) */
+void sched_wakeup(task_t *t)
+{
+	cpu_t *cpu = t->cpu;
+	task_t *cur = cpu->cur;
+	if(t == cur)
+		return;
+	if(!t->woken_at)
+		t->woken_at = read_tsc();
+	int preempt = !cur || cur == cpu->ktask || t->rq_level > cur->rq_level;
+#if CONFIG_SMP
+	if(cpu != (current_task ? current_task->cpu : 0)) {
+		if(preempt && (cpu->flags & CPU_TASK) 
+				&& (kernel_state_flags & KSF_CPUS_RUNNING)) {
+			add_atomic(&cpu->wakeup_ipis, 1);
+			send_ipi(LAPIC_ICR_SHORT_DEST, cpu->apicid, 
+				LAPIC_ICR_LEVELASSERT | LAPIC_ICR_TM_LEVEL | IPI_SCHED);
+		} else
+			nohz_kick(cpu);
+		return;
 	}
-	panic(PANIC_NOSYNC, "get_next_task(): Task became null pointer!", t);
-	return (task_t *)0;
+#endif
+	if(preempt)
+		or_atomic(&cpu->flags, CPU_RESCHED);
+}
+
+/* called on the way out of interrupts and system calls */
+void resched_if_needed()
+{
+	cpu_t *cpu = current_task ? current_task->cpu : 0;
+	if(cpu && (cpu->flags & CPU_RESCHED))
+		run_scheduler();
+}
+
+static void account_wakeup(cpu_t *cpu, task_t *t)
+{
+	unsigned long long lat = read_tsc() - t->woken_at;
+	t->woken_at = 0;
+	cpu->wakeups++;
+	cpu->wakeup_lat_total += lat;
+	if(lat > cpu->wakeup_lat_max)
+		cpu->wakeup_lat_max = lat;
+}
+
+/* called right after switching to a new task. The task we switched
+ * away from is now completely off of this cpu, so it may be moved */
+__attribute__((always_inline)) static inline void finish_task_switch()
+{
+	cpu_t *cpu = current_task->cpu;
+	task_t *prev = cpu->prev_task;
+	cpu->prev_task = 0;
+#if CONFIG_SMP
+	if(prev && prev != current_task && (prev->flags & TF_MIGRATE))
+		finish_migration(prev);
+#else
+	(void)prev;
+#endif
 }
 
 __attribute__((always_inline)) static inline void post_context_switch()
@@ -101,8 +147,12 @@ int schedule()
 	task_t *old = current_task;
 	cpu_t *cpu = (cpu_t *)old->cpu;
 	assert(cpu && cpu->cur == old);
+#if CONFIG_SMP && CONFIG_NOHZ
+	nohz_exit(cpu);
+#endif
 	
 	mutex_acquire(&cpu->lock);
+	and_atomic(&cpu->flags, ~CPU_RESCHED);
 	store_context();
 	/* the exiting task has fully 'exited' and has now scheduled out of
 	 * itself. It will never be scheduled again, and the page directory
@@ -112,12 +162,24 @@ int schedule()
 		raise_flag(TF_BURIED);
 	}
 	old->syscall_count = 0;
+	old->last_ran = ticks;
+#if CONFIG_SMP
+	/* if our affinity no longer allows this cpu, stay off of its run
+	 * queue and get moved once we're switched out */
+	if(!task_cpu_allowed(old, cpu) && old != cpu->ktask && old != kernel_task
+			&& !(old->flags & (TF_EXITING | TF_DYING)))
+		raise_task_flag(old, TF_MIGRATE);
+#endif
 	task_t *next_task = (task_t *)get_next_task(old, cpu);
 	assert(next_task);
 	assert(cpu == next_task->cpu);
+	if(next_task->woken_at)
+		account_wakeup(cpu, next_task);
 	restore_context(next_task);
 	next_task->slice = ticks;
 	((cpu_t *)next_task->cpu)->cur = next_task;
+	/* a dying task may be freed as soon as we're off of it */
+	cpu->prev_task = (old->flags & TF_DYING) ? 0 : old;
 	
 	/* we need to call this after restore_context because in restore_context
 	 * we access new->cpu */
@@ -130,6 +192,7 @@ int schedule()
 	//reset_timer_state(); /* TODO: This may be needed... */
 	/* tasks that have come from fork() (aka, new tasks) have this
 	 * flag set, such that here we just jump to their entry point in fork() */
+	finish_task_switch();
 	if(likely(!(current_task->flags & TF_FORK)))
 	{
 		post_context_switch();
@@ -141,19 +204,3 @@ int schedule()
 	/* we never get here, but lets keep gcc happy */
 	return 1;
 }
-
-void check_alarms()
-{
-	if(!alarm_list_start) return;
-	/* interrupts will be disabled here. Thus, we can aquire 
-	 * a mutex safely */
-	mutex_acquire(alarm_mutex);
-	if((unsigned)ticks > alarm_list_start->alarm_end)
-	{
-		lower_task_flag(alarm_list_start, TF_ALARM);
-		alarm_list_start->sigd = SIGALRM;
-		alarm_list_start = alarm_list_start->alarm_next;
-		alarm_list_start->alarm_prev = 0;
-	}
-	mutex_release(alarm_mutex);
-}
@@ -34,18 +34,23 @@ void handle_signal(task_t *t)
 			case SIGUSLEEP:
 				if(t->thread->uid >= t->thread->uid) {
 					t->state = TASK_USLEEP;
-					t->tick=0;
+					if(t->sleep_timer)
+						timer_cancel(t->sleep_timer);
 				}
 				break;
 			case SIGSTOP: 
-				if(!(sa->sa_flags & SA_NOCLDSTOP))
+				if(!(sa->sa_flags & SA_NOCLDSTOP) && t->parent) {
 					t->parent->sigd=SIGCHILD;
+					task_poke((task_t *)t->parent);
+				}
 				t->exit_reason.cause=__STOPSIG;
-				t->exit_reason.sig=t->sigd; /* Fall through */
+				t->exit_reason.sig=t->sigd;
+				task_child_event(t, WEV_STOP); /* Fall through */
 			case SIGISLEEP:
 				if(t->thread->uid >= t->thread->uid) {
 					t->state = TASK_ISLEEP; 
-					t->tick=0;
+					if(t->sleep_timer)
+						timer_cancel(t->sleep_timer);
 				}
 				break;
 			default:
@@ -62,6 +67,50 @@ void handle_signal(task_t *t)
 	}
 }
 
+struct pgrp_signal {
+	int sig, p, self, count;
+};
+
+/* called for each member of a process group, with the task indexes
+ * locked. We can't look up tasks here, so the current task (if it's a
+ * member) is signaled afterwards */
+static void __pgrp_signal_action(task_t *t, void *data)
+{
+	struct pgrp_signal *ps = data;
+	if(t == current_task) {
+		ps->self = 1;
+		return;
+	}
+	if(t->state == TASK_DEAD || t->state == TASK_SUICIDAL || (t->flags & TF_EXITING))
+		return;
+	if(ps->sig < 32 && current_task->thread->uid > t->thread->uid && !ps->p)
+		return;
+	if(ps->sig < 32 && (t->sig_mask & (1<<ps->sig)) && ps->sig != SIGKILL)
+		return;
+	ps->count++;
+	t->sigd = ps->sig;
+	if(ps->sig == SIGKILL) {
+		t->exit_reason.cause=__EXITSIG;
+		t->exit_reason.sig=ps->sig;
+		t->state = TASK_SUICIDAL;
+		t->sigd = 0;
+	}
+	task_poke(t);
+}
+
+static int send_signal_pgrp(unsigned pgid, int __sig, int p)
+{
+	struct pgrp_signal ps;
+	ps.sig = __sig;
+	ps.p = p;
+	ps.self = ps.count = 0;
+	if(!task_for_each_in_pgrp(pgid, __pgrp_signal_action, &ps))
+		return -ESRCH;
+	if(ps.self)
+		return do_send_signal(current_task->pid, __sig, p);
+	return ps.count ? 0 : -EPERM;
+}
+
 int do_send_signal(int pid, int __sig, int p)
 {
 	if(!current_task)
@@ -73,6 +122,12 @@ int do_send_signal(int pid, int __sig, int p)
 	
 	if(!pid && !p && current_task->thread->uid && current_task->pid)
 		return -EPERM;
+	/* a negative pid signals a whole process group */
+	if(pid < -1) {
+		if(__sig <= 0 || __sig >= 32)
+			return -EINVAL;
+		return send_signal_pgrp(-pid, __sig, p);
+	}
 	task_t *task = get_task_pid(pid);
 	if(!task) return -ESRCH;
 	if(__sig == 127) {
@@ -103,6 +158,11 @@ int do_send_signal(int pid, int __sig, int p)
 		task->state = TASK_RUNNING;
 		kill_task(pid);
 	}
+	if(__sig == SIGCONT && (task->exit_reason.cause & __STOPSIG)) {
+		task->exit_reason.cause &= ~__STOPSIG;
+		task_child_event(task, WEV_CONT);
+	}
+	task_poke(task);
 	if(task == current_task)
 		raise_task_flag(task, TF_SCHED);
 	return 0;
@@ -121,47 +181,31 @@ void set_signal(int sig, addr_t hand)
 	current_task->thread->signal_act[sig]._sa_func._sa_handler = (void (*)(int))hand;
 }
 
+static void __alarm_timeout(struct timer *timer)
+{
+	task_t *t = timer->data;
+	lower_task_flag(t, TF_ALARM);
+	t->sigd = SIGALRM;
+	task_poke(t);
+}
+
+/* returns the number of seconds that were left on the previous alarm */
 int sys_alarm(int a)
 {
-	if(a)
-	{
-		int old_value = current_task->alarm_end - ticks;
-		current_task->alarm_end = a * current_hz + ticks;
-		if(!(current_task->flags & TF_ALARM)) {
-			/* need to clear interrupts here, because
-			 * we access this inside the scheduler... */
-			int old = set_int(0);
-			mutex_acquire(alarm_mutex);
-			task_t *t = alarm_list_start, *p = 0;
-			while(t && t->alarm_end < current_task->alarm_end) p = t, t = t->alarm_next;
-			if(!t) {
-				alarm_list_start = current_task;
-				current_task->alarm_next = current_task->alarm_prev = 0;
-			} else {
-				if(p) p->alarm_next = current_task;
-				current_task->alarm_prev = p;
-				current_task->alarm_next = t;
-				if(t) t->alarm_prev = current_task;
-			}
-			raise_flag(TF_ALARM);
-			mutex_release(alarm_mutex);
-			set_int(old);
-		} else
-			return old_value < 0 ? 0 : old_value;
-	} else {
-		task_t *t = current_task;
-		if((t->flags & TF_ALARM)) {
-			lower_flag(TF_ALARM);
-			int old = set_int(0);
-			mutex_acquire(alarm_mutex);
-			if(current_task->alarm_prev) current_task->alarm_prev->alarm_next = current_task->alarm_next;
-			if(current_task->alarm_next) current_task->alarm_next->alarm_prev = current_task->alarm_prev;
-			current_task->alarm_next = current_task->alarm_prev = 0;
-			mutex_release(alarm_mutex);
-			set_int(old);
-		}
+	task_t *t = (task_t *)current_task;
+	int old_value = 0;
+	if(!t->alarm_timer)
+		t->alarm_timer = timer_create(0, __alarm_timeout, (void *)t);
+	if(timer_cancel(t->alarm_timer)) {
+		long left = t->alarm_timer->expires - ticks;
+		old_value = left > 0 ? (left + current_hz - 1) / current_hz : 0;
 	}
-	return 0;
+	lower_flag(TF_ALARM);
+	if(a) {
+		raise_flag(TF_ALARM);
+		timer_add(t->alarm_timer, ticks + a * current_hz);
+	}
+	return old_value;
 }
 
 int sys_sigact(int sig, const struct sigaction *act, struct sigaction *oact)
@@ -7,23 +7,25 @@
 #include <ll.h>
 #include <atomic.h>
 
-volatile task_t *kernel_task=0, *alarm_list_start=0;
-mutex_t *alarm_mutex=0;
+volatile task_t *kernel_task=0;
 volatile unsigned next_pid=0;
 struct llist *kill_queue=0;
 tqueue_t *primary_queue=0;
+kmem_cache_t *task_cache=0;
 
 /* create the bare task structure. This needs to be then populated with all the data
  * required for an actual process */
 task_t *task_create()
 {
-	task_t *task = (task_t *)kmalloc(sizeof(task_t));
+	task_t *task = (task_t *)kmem_cache_alloc(task_cache);
 	task->kernel_stack = (addr_t)kmalloc(KERN_STACK_SIZE);
 	task->magic = TASK_MAGIC;
+#if CONFIG_SMP
+	memset((void *)task->cpu_mask, ~0, sizeof(task->cpu_mask));
+#endif
 	/* allocate all of the list nodes... */
-	task->listnode   = (void *)kmalloc(sizeof(struct llistnode));
-	task->activenode = (void *)kmalloc(sizeof(struct llistnode));
-	task->blocknode  = (void *)kmalloc(sizeof(struct llistnode));
+	task->listnode   = (void *)kmem_cache_alloc(llistnode_cache);
+	task->blocknode  = (void *)kmem_cache_alloc(llistnode_cache);
 	return task;
 }
 
@@ -39,6 +41,7 @@ struct thread_shared_data *thread_data_create()
 void init_multitasking()
 {
 	printk(KERN_DEBUG, "[sched]: Starting multitasking system...\n");
+	task_cache = kmem_cache_create("task", sizeof(task_t), 16, 0);
 	/* make the kernel task */
 	task_t *task = task_create();
 	task->pid = next_pid++;
@@ -47,15 +50,16 @@ void init_multitasking()
 	task->priority = 1;
 	task->cpu = primary_cpu;
 	task->thread = thread_data_create();
-	/* alarm_mutex is aquired inside a kernel tick, so we may not schedule. */
-	alarm_mutex = mutex_create(0, MT_NOSCHED);
+	init_timers();
 	
 	kill_queue = ll_create(0);
 	primary_queue = tqueue_create(0, 0);
-	primary_cpu->active_queue = tqueue_create(0, 0);
+	init_tasklist();
+	primary_cpu->active_queue = runqueue_create(0, primary_cpu, 0);
 
 	tqueue_insert(primary_queue, (void *)task, task->listnode);
-	tqueue_insert(primary_cpu->active_queue, (void *)task, task->activenode);
+	task_index_add(task);
+	runqueue_insert(primary_cpu->active_queue, task);
 	
 	primary_cpu->cur = task;
 	primary_cpu->ktask = task;
@@ -77,6 +81,7 @@ void init_multitasking()
 	add_kernel_symbol(exit);
 	add_kernel_symbol(sys_setsid);
 	add_kernel_symbol(do_fork);
+	add_kernel_symbol(sys_waitpid);
 	add_kernel_symbol(kill_task);
 	add_kernel_symbol(do_send_signal);
 	add_kernel_symbol(dosyscall);
@@ -97,11 +102,6 @@ void switch_to_user_mode()
 	do_switch_to_user_mode();
 }
 
-task_t *get_task_pid(int pid)
-{
-	return search_tqueue(primary_queue, TSEARCH_PID, pid, 0, 0, 0);
-}
-
 int times(struct tms *buf)
 {
 	if(buf) {
@@ -125,6 +125,33 @@ void task_pause(task_t *t)
 void task_resume(task_t *t)
 {
 	t->state = TASK_RUNNING;
+	task_poke(t);
+}
+
+/* put a task back on its cpu's run queue if it has become runable while
+ * it was off of it (for example, it was sent a signal while sleeping).
+ * Blocked tasks are left alone, they get requeued when unblocked. */
+void task_poke(task_t *t)
+{
+	if(!t->cpu || t->blocklist || !task_is_runable(t))
+		return;
+	/* whoever is moving the task will poke it once it's on its new cpu */
+	if(t->flags & (TF_MUTEX | TF_MOVECPU | TF_MIGRATE))
+		return;
+	/* the task may get moved to another cpu while we're doing this */
+	while(runqueue_insert(((cpu_t *)t->cpu)->active_queue, t) == -EAGAIN);
+	sched_wakeup(t);
+}
+
+/* we can only sleep on a lock if schedule() is going to switch away
+ * from us, and if the task isn't already asleep (or dying) for some
+ * other reason */
+int task_can_sleep()
+{
+	if(!current_task || !kernel_task || current_task->state != TASK_RUNNING)
+		return 0;
+	cpu_t *cpu = current_task->cpu;
+	return cpu && (cpu->flags & CPU_TASK) && !(cpu->flags & CPU_LOCK);
 }
 
 /* we set interrupts to zero here so that we may use rwlocks in
@@ -134,7 +161,7 @@ void task_block(struct llist *list, task_t *task)
 	int old = set_int(0);
 	task->blocklist = list;
 	ll_do_insert(list, task->blocknode, (void *)task);
-	tqueue_remove(((cpu_t *)task->cpu)->active_queue, task->activenode);
+	runqueue_remove(((cpu_t *)task->cpu)->active_queue, task);
 	task_pause(task);
 	assert(!set_int(old));
 }
@@ -144,7 +171,7 @@ void task_almost_block(struct llist *list, task_t *task)
 	int old = set_int(0);
 	task->blocklist = list;
 	ll_do_insert(list, task->blocknode, (void *)task);
-	tqueue_remove(((cpu_t *)task->cpu)->active_queue, task->activenode);
+	runqueue_remove(((cpu_t *)task->cpu)->active_queue, task);
 	task->state = TASK_ISLEEP;
 	assert(!set_int(old));
 }
@@ -152,7 +179,6 @@ void task_almost_block(struct llist *list, task_t *task)
 void task_unblock(struct llist *list, task_t *t)
 {
 	int old = set_int(0);
-	tqueue_insert(((cpu_t *)t->cpu)->active_queue, (void *)t, t->activenode);
 	struct llistnode *bn = t->blocknode;
 	t->blocklist = 0;
 	ll_do_remove(list, bn, 0);
@@ -171,7 +197,6 @@ void task_unblock_all(struct llist *list)
 		entry->blocklist = 0;
 		assert(entry->blocknode == cur);
 		ll_do_remove(list, cur, 1);
-		tqueue_insert(((cpu_t *)entry->cpu)->active_queue, (void *)entry, entry->activenode);
 		task_resume(entry);
 	}
 	assert(!list->num);
@@ -179,35 +204,62 @@ void task_unblock_all(struct llist *list)
 	assert(!set_int(old));
 }
 
-void move_task_cpu(task_t *t, cpu_t *cpu)
+#if CONFIG_SMP
+/* move a task that isn't running onto another cpu's run queue. Returns
+ * -EBUSY if it's running (or already being moved), in which case it
+ * will move itself the next time it's switched out if its affinity
+ * says it should */
+int move_task_cpu(task_t *t, cpu_t *cpu)
 {
-	panic(0, "NO!");
 	assert(t && cpu);
-	if(t->cpu == cpu) panic(0, "trying to move task to it's own cpu");
-	assert(t != current_task);
-	/* have to try to get the lock on the CPU when the task t isn't 
-	 * running on it... */
-	if(t->flags & TF_MOVECPU)
-		panic(0, "trying to move task twice");
-	if(t == cpu->ktask || t == kernel_task)
-		panic(0, "trying to move idle task");
-	printk(0, "moving task %d to cpu %d\n", t->pid, cpu->apicid);
-	raise_task_flag(t, TF_MOVECPU);
 	cpu_t *oldcpu = t->cpu;
-	while(1)
-	{
-		mutex_acquire(&oldcpu->lock);
-		if(oldcpu->cur != t)
-			break;
+	if(!oldcpu)
+		return -EBUSY;
+	if(t == kernel_task || t == oldcpu->ktask)
+		return -EINVAL;
+	if(!(cpu->flags & CPU_TASK) || !cpu->active_queue)
+		return -EINVAL;
+	if(t->flags & (TF_EXITING | TF_DYING))
+		return -ESRCH;
+	if(oldcpu == cpu)
+		return 0;
+	int old = set_int(0);
+	/* holding the cpu lock keeps oldcpu from switching to t while we
+	 * take it off of the run queue */
+	mutex_acquire(&oldcpu->lock);
+	if(oldcpu->cur == t || t->cpu != oldcpu || (t->flags & TF_MOVECPU)) {
 		mutex_release(&oldcpu->lock);
-		asm("pause");
+		set_int(old);
+		return -EBUSY;
 	}
-	/* ok, we have the lock and the task */
+	raise_task_flag(t, TF_MOVECPU);
+	runqueue_remove(oldcpu->active_queue, t);
 	t->cpu = cpu;
-	tqueue_remove(oldcpu->active_queue, t->activenode);
-	if(!t->blocklist)
-		tqueue_insert(cpu->active_queue, (void *)t, t->activenode);
-	
 	mutex_release(&oldcpu->lock);
-	lower_task_flag(t, TF_MOVECPU);
+	/* oldcpu may still be on t's stack, finishing the switch away from
+	 * it. It can't run on cpu until it's done */
+	while(oldcpu->prev_task == t) {
+		asm("pause");
+	}
+	sub_atomic(&oldcpu->numtasks, 1);
+	add_atomic(&cpu->numtasks, 1);
+	add_atomic(&oldcpu->migrations_out, 1);
+	add_atomic(&cpu->migrations_in, 1);
+	lower_task_flag(t, (TF_MOVECPU | TF_MIGRATE));
+	task_poke(t);
+	set_int(old);
+	return 0;
 }
+
+/* called by a cpu once it has switched away from a task that isn't
+ * allowed to run on it anymore (see schedule) */
+void finish_migration(task_t *t)
+{
+	cpu_t *cpu = sched_pick_cpu(t, 0);
+	if(cpu && cpu != t->cpu && !move_task_cpu(t, cpu))
+		return;
+	/* nowhere to go. Leave it here, and try again next time */
+	lower_task_flag(t, TF_MIGRATE);
+	task_poke(t);
+}
+#endif
@@ -0,0 +1,359 @@
+/* tasklist.c - indexes for finding tasks
+ * Tasks are kept in a hash table by pid, and are linked into lists of
+ * their parent's children, of the tasks waiting on them, of their
+ * process group and of the tasks on each tty. This way looking up a
+ * task, or signaling a group of them, doesn't need to go through every
+ * task in primary_queue. Children also post their state changes (exit,
+ * stop and continue) to their parent's list of events, which is where
+ * waitpid finds them. Everything here is guarded by tasklist_lock, which
+ * is held with interrupts off.
+ */
+#include <kernel.h>
+#include <task.h>
+#include <tqueue.h>
+#include <mutex.h>
+#include <config.h>
+
+#define PID_HASH_SIZE  256
+#define PGRP_HASH_SIZE 64
+
+static mutex_t tasklist_lock;
+static task_t *pid_hash[PID_HASH_SIZE];
+static task_t *pgrp_hash[PGRP_HASH_SIZE];
+static task_t *tty_tasks[MAX_CONSOLES];
+
+/* each list links its tasks through a different task_link in the task */
+#define LINK(f) __builtin_offsetof(struct task_struct, f)
+#define __tl(t, off) ((struct task_link *)((addr_t)(t) + (off)))
+
+static void tl_add(task_t *volatile *head, task_t *t, unsigned long off)
+{
+	struct task_link *l = __tl(t, off);
+	l->prev = 0;
+	l->next = *head;
+	if(*head)
+		__tl(*head, off)->prev = t;
+	*head = t;
+}
+
+static void tl_del(task_t *volatile *head, task_t *t, unsigned long off)
+{
+	struct task_link *l = __tl(t, off);
+	if(l->prev)
+		__tl(l->prev, off)->next = l->next;
+	else
+		*head = (task_t *)l->next;
+	if(l->next)
+		__tl(l->next, off)->prev = l->prev;
+	l->next = l->prev = 0;
+}
+
+static int tasklist_lock_irq()
+{
+	int old = set_int(0);
+	mutex_acquire(&tasklist_lock);
+	return old;
+}
+
+static void tasklist_unlock_irq(int old)
+{
+	mutex_release(&tasklist_lock);
+	set_int(old);
+}
+
+#define pid_bucket(pid) (&pid_hash[(unsigned)(pid) % PID_HASH_SIZE])
+#define pgrp_bucket(pgid) (&pgrp_hash[(unsigned)(pgid) % PGRP_HASH_SIZE])
+#define tty_indexed(tty) ((unsigned)(tty) < MAX_CONSOLES)
+
+void init_tasklist()
+{
+	mutex_create(&tasklist_lock, MT_NOSCHED);
+}
+
+static task_t *__get_task_pid(int pid)
+{
+	task_t *t = *pid_bucket(pid);
+	while(t && t->pid != (unsigned)pid)
+		t = (task_t *)t->pid_link.next;
+	return t;
+}
+
+task_t *get_task_pid(int pid)
+{
+	int old = tasklist_lock_irq();
+	task_t *t = __get_task_pid(pid);
+	tasklist_unlock_irq(old);
+	return t;
+}
+
+static void __task_clear_event(task_t *t)
+{
+	if(t->wait_event && t->parent)
+		tl_del(&t->parent->child_events, t, LINK(event_link));
+	t->wait_event = 0;
+}
+
+/* add a task to the indexes. Called once it's in primary_queue */
+void task_index_add(task_t *t)
+{
+	int old = tasklist_lock_irq();
+	tl_add(pid_bucket(t->pid), t, LINK(pid_link));
+	if(t->parent)
+		tl_add(&t->parent->children, t, LINK(sibling));
+	tl_add(pgrp_bucket(t->pgid), t, LINK(pgrp_link));
+	if(tty_indexed(t->tty))
+		tl_add(&tty_tasks[t->tty], t, LINK(tty_link));
+	tasklist_unlock_irq(old);
+}
+
+/* take a task that is being reaped out of the indexes. Returns 0 if
+ * that has already happened. Called with tasklist_lock held */
+int __task_index_remove(task_t *t)
+{
+	task_t *volatile *bucket = pid_bucket(t->pid);
+	if(!t->pid_link.prev && *bucket != t)
+		return 0;
+	tl_del(bucket, t, LINK(pid_link));
+	__task_clear_event(t);
+	if(t->parent)
+		tl_del(&t->parent->children, t, LINK(sibling));
+	tl_del(pgrp_bucket(t->pgid), t, LINK(pgrp_link));
+	if(tty_indexed(t->tty))
+		tl_del(&tty_tasks[t->tty], t, LINK(tty_link));
+	return 1;
+}
+
+int task_index_remove(task_t *t)
+{
+	int old = tasklist_lock_irq();
+	int ret = __task_index_remove(t);
+	tasklist_unlock_irq(old);
+	return ret;
+}
+
+/* called by an exiting task: wakes up the tasks waiting on it, and
+ * orphans its children, reaping the ones that have already exited */
+void task_index_exit(task_t *t)
+{
+	int old = tasklist_lock_irq();
+	task_t *w;
+	while((w = (task_t *)t->waiters)) {
+		tl_del(&t->waiters, w, LINK(wait_link));
+		w->sigd = SIGWAIT;
+		w->waiting = 0;
+		w->waiting_ret = 0;
+		memcpy((void *)&w->we_res, (void *)&t->exit_reason, sizeof(t->exit_reason));
+		w->we_res.pid = t->pid;
+		task_resume(w);
+	}
+	if(t->waiting) {
+		tl_del(&t->waiting->waiters, t, LINK(wait_link));
+		t->waiting = 0;
+	}
+	task_t *c;
+	while((c = (task_t *)t->children)) {
+		__task_clear_event(c);
+		tl_del(&t->children, c, LINK(sibling));
+		c->parent = 0;
+		if(c->state == TASK_DEAD)
+			move_task_to_kill_queue(c, 1);
+	}
+	/* if we have no parent, or will soon have no parent, no one will
+	 * reap us, so we do it now */
+	if(!t->parent || (t->parent->flags & TF_EXITING))
+		move_task_to_kill_queue(t, 1);
+	tasklist_unlock_irq(old);
+}
+
+/* have the current task wait for target to exit. Returns -ESRCH if it
+ * already is */
+int task_wait_on(task_t *target)
+{
+	int ret = 0;
+	int old = tasklist_lock_irq();
+	if(target->flags & TF_EXITING)
+		ret = -ESRCH;
+	else {
+		current_task->waiting = target;
+		tl_add(&target->waiters, (task_t *)current_task, LINK(wait_link));
+	}
+	tasklist_unlock_irq(old);
+	return ret;
+}
+
+void task_stop_waiting(task_t *t)
+{
+	int old = tasklist_lock_irq();
+	if(t->waiting) {
+		tl_del(&t->waiting->waiters, t, LINK(wait_link));
+		t->waiting = 0;
+	}
+	tasklist_unlock_irq(old);
+}
+
+static void __task_wake_waiter(task_t *t)
+{
+	if(t->flags & TF_WAITCHILD) {
+		lower_task_flag(t, TF_WAITCHILD);
+		task_resume(t);
+	}
+}
+
+/* post a state change of t for its parent's waitpid. A later change
+ * replaces one that hasn't been reported yet. Tasks waiting on t with
+ * wait_task are woken up too, so that they can look at its state */
+void task_child_event(task_t *t, unsigned event)
+{
+	int old = tasklist_lock_irq();
+	task_t *p = (task_t *)t->parent;
+	if(p) {
+		if(!t->wait_event)
+			tl_add(&p->child_events, t, LINK(event_link));
+		t->wait_event = event;
+		__task_wake_waiter(p);
+	}
+	task_t *w;
+	for(w = (task_t *)t->waiters;w;w = (task_t *)w->wait_link.next)
+		__task_wake_waiter(w);
+	tasklist_unlock_irq(old);
+}
+
+static int __event_wanted(unsigned event, int opt)
+{
+	if(event == WEV_STOP)
+		return opt & WUNTRACED;
+	if(event == WEV_CONT)
+		return opt & WCONTINUED;
+	return event == WEV_EXIT;
+}
+
+/* take a state change of one of the current task's children (or of
+ * child pid, if it isn't -1) that waitpid was asked to report. If there
+ * isn't one, *err is set to -ECHILD if there's nothing to wait for, 0
+ * for WNOHANG, and otherwise -EAGAIN, with the current task set up to
+ * sleep until a child posts something */
+task_t *task_take_child_event(int pid, int opt, unsigned *event, int *err)
+{
+	int old = tasklist_lock_irq();
+	task_t *t;
+	*err = 0;
+	if(pid == -1) {
+		t = (task_t *)current_task->child_events;
+		while(t && !__event_wanted(t->wait_event, opt))
+			t = (task_t *)t->event_link.next;
+		if(!current_task->children)
+			*err = -ECHILD;
+	} else {
+		t = __get_task_pid(pid);
+		if(!t || t->parent != current_task) {
+			t = 0;
+			*err = -ECHILD;
+		} else if(!__event_wanted(t->wait_event, opt))
+			t = 0;
+	}
+	if(t) {
+		*event = t->wait_event;
+		__task_clear_event(t);
+	} else if(!*err && !(opt & WNOHANG)) {
+		raise_flag(TF_WAITCHILD);
+		current_task->state = TASK_ISLEEP;
+		*err = -EAGAIN;
+	}
+	tasklist_unlock_irq(old);
+	return t;
+}
+
+void task_set_tty(task_t *t, int tty)
+{
+	int old = tasklist_lock_irq();
+	if(t->tty != tty) {
+		if(tty_indexed(t->tty))
+			tl_del(&tty_tasks[t->tty], t, LINK(tty_link));
+		t->tty = tty;
+		if(tty_indexed(tty))
+			tl_add(&tty_tasks[tty], t, LINK(tty_link));
+	}
+	tasklist_unlock_irq(old);
+}
+
+static void __task_move_pgrp(task_t *t, unsigned pgid)
+{
+	tl_del(pgrp_bucket(t->pgid), t, LINK(pgrp_link));
+	t->pgid = pgid;
+	tl_add(pgrp_bucket(pgid), t, LINK(pgrp_link));
+}
+
+/* put t in process group pgid, which must either be t's own pid or a
+ * group that already exists in t's session */
+int task_set_pgid(task_t *t, unsigned pgid)
+{
+	int ret = 0;
+	int old = tasklist_lock_irq();
+	if(t->pid == t->sid)
+		ret = -EPERM;
+	else if(pgid != t->pid) {
+		task_t *m = *pgrp_bucket(pgid);
+		while(m && m->pgid != pgid)
+			m = (task_t *)m->pgrp_link.next;
+		if(!m || m->sid != t->sid)
+			ret = -EPERM;
+	}
+	if(!ret)
+		__task_move_pgrp(t, pgid);
+	tasklist_unlock_irq(old);
+	return ret;
+}
+
+/* make t the leader of a new session and process group, without a tty */
+int task_set_session(task_t *t)
+{
+	int ret = 0;
+	int old = tasklist_lock_irq();
+	if(t->pgid == t->pid && t->pid)
+		ret = -EPERM;
+	else {
+		t->sid = t->pid;
+		__task_move_pgrp(t, t->pid);
+		if(tty_indexed(t->tty))
+			tl_del(&tty_tasks[t->tty], t, LINK(tty_link));
+		t->tty = 0;
+		tl_add(&tty_tasks[0], t, LINK(tty_link));
+	}
+	tasklist_unlock_irq(old);
+	return ret;
+}
+
+/* the actions are called with tasklist_lock held and interrupts off, so
+ * they mustn't look up tasks themselves. Both return the number of
+ * tasks found */
+int task_for_each_in_pgrp(unsigned pgid, void (*action)(task_t *, void *), void *data)
+{
+	int count = 0;
+	int old = tasklist_lock_irq();
+	task_t *t = *pgrp_bucket(pgid), *next;
+	for(;t;t = next) {
+		next = (task_t *)t->pgrp_link.next;
+		if(t->pgid != pgid)
+			continue;
+		action(t, data);
+		count++;
+	}
+	tasklist_unlock_irq(old);
+	return count;
+}
+
+int task_for_each_on_tty(int tty, void (*action)(task_t *, void *), void *data)
+{
+	if(!tty_indexed(tty))
+		return 0;
+	int count = 0;
+	int old = tasklist_lock_irq();
+	task_t *t = tty_tasks[tty], *next;
+	for(;t;t = next) {
+		next = (task_t *)t->tty_link.next;
+		action(t, data);
+		count++;
+	}
+	tasklist_unlock_irq(old);
+	return count;
+}
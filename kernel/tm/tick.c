@@ -3,8 +3,177 @@
 #include <task.h>
 #include <cpu.h>
 #include <atomic.h>
+#include <timer.h>
 int current_hz=1000;
 volatile long ticks=0;
+
+/* Timer wheel. The root wheel has a slot for each of the next 256 ticks,
+ * and each outer level covers 64 times the range of the one below it.
+ * Timers in outer levels are cascaded down as the wheel turns, so adding,
+ * cancelling and expiring a timer are all O(1). Timers further out than
+ * the wheel covers sit in the last slot and get re-cascaded. */
+#define TW_ROOT_BITS 8
+#define TW_BITS      6
+#define TW_LEVELS    3
+#define TW_ROOT_SIZE (1 << TW_ROOT_BITS)
+#define TW_SIZE      (1 << TW_BITS)
+#define TW_ROOT_MASK (TW_ROOT_SIZE - 1)
+#define TW_MASK      (TW_SIZE - 1)
+#define TW_MAX_RANGE ((1L << (TW_ROOT_BITS + TW_LEVELS * TW_BITS)) - 1)
+#define TW_INDEX(n)  ((tw_ticks >> (TW_ROOT_BITS + (n) * TW_BITS)) & TW_MASK)
+
+static struct timer *tw_root[TW_ROOT_SIZE];
+static struct timer *tw_levels[TW_LEVELS][TW_SIZE];
+/* the next tick that the wheel will process */
+static long tw_ticks=0;
+static unsigned tw_num=0;
+static mutex_t tw_lock;
+static int tw_ready=0;
+
+struct timer *timer_create(struct timer *t, void (*func)(struct timer *), void *data)
+{
+	if(!t) {
+		t = (void *)kmalloc(sizeof(struct timer));
+		t->flags = TIMER_ALLOC;
+	} else
+		t->flags = 0;
+	t->func = func;
+	t->data = data;
+	t->expires = 0;
+	t->next = 0;
+	t->pprev = 0;
+	return t;
+}
+
+void timer_destroy(struct timer *t)
+{
+	timer_cancel(t);
+	if(t->flags & TIMER_ALLOC)
+		kfree(t);
+}
+
+static void __timer_link(struct timer *t)
+{
+	long expires = t->expires;
+	long idx = expires - tw_ticks;
+	struct timer **slot;
+	if(idx < 0)
+		slot = &tw_root[tw_ticks & TW_ROOT_MASK];
+	else if(idx < TW_ROOT_SIZE)
+		slot = &tw_root[expires & TW_ROOT_MASK];
+	else {
+		if(idx > TW_MAX_RANGE) {
+			idx = TW_MAX_RANGE;
+			expires = tw_ticks + idx;
+		}
+		int i;
+		for(i=0;i<TW_LEVELS-1;i++) {
+			if(idx < (1L << (TW_ROOT_BITS + (i+1) * TW_BITS)))
+				break;
+		}
+		slot = &tw_levels[i][(expires >> (TW_ROOT_BITS + i * TW_BITS)) & TW_MASK];
+	}
+	t->next = *slot;
+	if(t->next)
+		t->next->pprev = &t->next;
+	t->pprev = slot;
+	*slot = t;
+}
+
+static void __timer_unlink(struct timer *t)
+{
+	*t->pprev = t->next;
+	if(t->next)
+		t->next->pprev = t->pprev;
+	t->next = 0;
+	t->pprev = 0;
+}
+
+void timer_add(struct timer *t, long expires)
+{
+	int old = set_int(0);
+	mutex_acquire(&tw_lock);
+	if(timer_pending(t))
+		__timer_unlink(t);
+	else
+		tw_num++;
+	t->expires = expires;
+	__timer_link(t);
+	mutex_release(&tw_lock);
+	set_int(old);
+}
+
+/* returns 1 if the timer was pending. Once this returns, the timer's
+ * callback is not running on any cpu */
+int timer_cancel(struct timer *t)
+{
+	int ret = 0;
+	int old = set_int(0);
+	mutex_acquire(&tw_lock);
+	if(timer_pending(t)) {
+		__timer_unlink(t);
+		tw_num--;
+		ret = 1;
+	}
+	mutex_release(&tw_lock);
+	set_int(old);
+	return ret;
+}
+
+/* move all the timers in a slot of an outer level down the wheel */
+static int __timer_cascade(int level, int index)
+{
+	struct timer *t = tw_levels[level][index], *next;
+	tw_levels[level][index] = 0;
+	while(t) {
+		next = t->next;
+		t->pprev = 0;
+		__timer_link(t);
+		t = next;
+	}
+	return index;
+}
+
+void init_timers()
+{
+	mutex_create(&tw_lock, MT_NOSCHED);
+	tw_ticks = ticks;
+	tw_ready = 1;
+}
+
+/* called once per tick (on the cpu that updates ticks) to fire any
+ * timers that have expired since the last call */
+void run_timers()
+{
+	if(!tw_ready)
+		return;
+	mutex_acquire(&tw_lock);
+	while(tw_ticks <= ticks) {
+		if(!tw_num) {
+			tw_ticks = ticks + 1;
+			break;
+		}
+		int index = tw_ticks & TW_ROOT_MASK;
+		if(!index) {
+			for(int i=0;i<TW_LEVELS;i++) {
+				if(__timer_cascade(i, TW_INDEX(i)))
+					break;
+			}
+		}
+		struct timer *t = tw_root[index];
+		tw_root[index] = 0;
+		tw_ticks++;
+		while(t) {
+			struct timer *next = t->next;
+			t->next = 0;
+			t->pprev = 0;
+			tw_num--;
+			t->func(t);
+			t = next;
+		}
+	}
+	mutex_release(&tw_lock);
+}
 int get_timer_th(int *t)
 {
 	if(t)
@@ -22,6 +191,64 @@ void inc_parent_times(task_t *t, int u, int s)
 	}
 }
 
+#if CONFIG_SMP && CONFIG_NOHZ
+/* the longest an idle cpu will go without a tick */
+#define NOHZ_MAX_TICKS 1000
+
+/* called by a cpu's idle task. If there's nothing else to run, stop the
+ * periodic tick and halt until the next thing this cpu needs to do (its
+ * next load balance), or until another cpu gives it a task. The primary
+ * cpu keeps ticking, since it updates ticks and runs the timer wheel */
+void nohz_idle(cpu_t *cpu)
+{
+	if(cpu == primary_cpu || !(kernel_state_flags & KSF_CPUS_RUNNING))
+		return;
+	int old = set_int(0);
+	if(cpu->active_queue->num > 1) {
+		set_int(old);
+		return;
+	}
+	long sleep = (long)cpu->next_balance - ticks;
+	if(sleep < 1)
+		sleep = 1;
+	if(sleep > NOHZ_MAX_TICKS)
+		sleep = NOHZ_MAX_TICKS;
+	cpu->nohz_count = set_lapic_timer_oneshot(sleep);
+	or_atomic(&cpu->flags, CPU_NOHZ);
+	/* check again now that other cpus can see the flag, in case a task
+	 * was queued for us in the meantime */
+	if(cpu->active_queue->num <= 1)
+		asm("sti; hlt; cli");
+	nohz_exit(cpu);
+	set_int(old);
+}
+
+/* restart the periodic tick. Called with interrupts disabled, both when
+ * the idle task wakes up and when we schedule away from it */
+void nohz_exit(cpu_t *cpu)
+{
+	if(!(cpu->flags & CPU_NOHZ))
+		return;
+	and_atomic(&cpu->flags, ~CPU_NOHZ);
+	unsigned left = read_lapic_timer();
+	restore_lapic_timer();
+	/* give the idle task the time it slept through. If the timer went
+	 * off, do_tick has already counted the last tick */
+	unsigned slept = (cpu->nohz_count - left) / lapic_timer_start;
+	if(!left && slept)
+		slept--;
+	cpu->ktask->stime += slept;
+}
+
+/* wake up a cpu that may be halted in nohz_idle */
+void nohz_kick(cpu_t *cpu)
+{
+	if(cpu->flags & CPU_NOHZ)
+		send_ipi(LAPIC_ICR_SHORT_DEST, cpu->apicid, 
+			LAPIC_ICR_LEVELASSERT | LAPIC_ICR_TM_LEVEL | IPI_SCHED);
+}
+#endif
+
 static void do_run_scheduler()
 {
 	if(!current_task ||
@@ -51,10 +278,22 @@ void do_tick()
 		inc_parent_times(current_task->parent, 
 			current_task->system ? __SYS : __USR);
 	}
-	check_alarms();
+#if CONFIG_SMP
+	balance_tick((cpu_t *)current_task->cpu);
+#endif
+	cpu_t *cpu = current_task->cpu;
+	if(cpu->active_queue && runqueue_rt_tick(cpu->active_queue, (task_t *)current_task)) {
+		do_run_scheduler();
+		return;
+	}
 	if(current_task != kernel_task) {
+		/* FIFO tasks don't have a timeslice */
+		if(current_task->policy == SCHED_FIFO && task_is_runable(current_task)
+				&& !(cpu->flags & CPU_RESCHED))
+			return;
 		if(task_is_runable(current_task) && current_task->cur_ts>0 
-				&& --current_task->cur_ts)
+				&& --current_task->cur_ts
+				&& !(cpu->flags & CPU_RESCHED))
 			return;
 		else if(current_task->cur_ts <= 0)
 			current_task->cur_ts = GET_MAX_TS(current_task);
@@ -65,14 +304,25 @@ void do_tick()
 void timer_handler(registers_t r)
 {
 	/* prevent multiple cpus from adding to ticks */
-	if(!current_task || !current_task->cpu || ((cpu_t *)current_task->cpu) == primary_cpu)
+	if(!current_task || !current_task->cpu || ((cpu_t *)current_task->cpu) == primary_cpu) {
 		add_atomic(&ticks, 1);
+		run_timers();
+	}
 	/* engage the idle task occasionally */
 	if((ticks % current_hz*10) == 0)
 		__engage_idle();
 	do_tick();
 }
 
+static void __delay_timeout(struct timer *timer)
+{
+	task_t *t = timer->data;
+	if(t->state == TASK_ISLEEP || t->state == TASK_USLEEP) {
+		t->state = TASK_RUNNING;
+		task_poke(t);
+	}
+}
+
 void delay(int t)
 {
 	if((kernel_state_flags & KSF_SHUTDOWN))
@@ -85,9 +335,13 @@ void delay(int t)
 			schedule();
 		return;
 	}
-	current_task->tick=end;
+	if(!current_task->sleep_timer)
+		current_task->sleep_timer = timer_create(0, __delay_timeout, (void *)current_task);
 	current_task->state=TASK_ISLEEP;
+	timer_add(current_task->sleep_timer, end);
 	while(!schedule());
+	/* we may have been woken up early by a signal */
+	timer_cancel(current_task->sleep_timer);
 }
 
 void delay_sleep(int t)
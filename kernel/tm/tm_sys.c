@@ -2,6 +2,7 @@
 #include <memory.h>
 #include <task.h>
 #include <tqueue.h>
+#include <cpu.h>
 
 /* Low-level memory allocator implementation */
 int sys_sbrk(long inc)
@@ -13,13 +14,7 @@ int sys_sbrk(long inc)
 		if(new_end < current_task->heap_start)
 			new_end = current_task->heap_start;
 		addr_t old_end = current_task->heap_end;
-		addr_t free_start = (new_end&PAGE_MASK) + PAGE_SIZE;
-		addr_t free_end = old_end&PAGE_MASK;
-		while(free_start <= free_end) {
-			if(vm_getmap(free_start, 0))
-				vm_unmap(free_start);
-			free_start += PAGE_SIZE;
-		}
+		vm_unmap_range((new_end&PAGE_MASK) + PAGE_SIZE, (old_end&PAGE_MASK) + PAGE_SIZE);
 		current_task->heap_end = new_end;
 		assert(new_end + dec == old_end);
 		return old_end;
@@ -33,8 +28,15 @@ int sys_sbrk(long inc)
 	current_task->heap_end += inc;
 	current_task->he_red = end + inc;
 	addr_t page = end & PAGE_MASK;
-	for(;page <=(current_task->heap_end&PAGE_MASK);page += PAGE_SIZE)
-		user_map_if_not_mapped(page);
+	addr_t top = (current_task->heap_end&PAGE_MASK) + PAGE_SIZE;
+	for(;page < top;page += PAGE_SIZE) {
+		/* big increments are backed by large pages where possible */
+		addr_t sz = vm_try_map_large(page, page, top, PAGE_PRESENT | PAGE_WRITE | PAGE_USER);
+		if(sz)
+			page += sz - PAGE_SIZE;
+		else
+			user_map_if_not_mapped(page);
+	}
 	return end;
 }
 
@@ -52,6 +54,108 @@ int sys_gsetpriority(int set, int which, int id, int val)
 	return current_task->priority;
 }
 
+/* masks are arrays of unsigned longs, with bit n meaning cpu_array[n].
+ * Without SMP, the only cpu is 0 */
+int sys_sched_setaffinity(int pid, size_t size, unsigned long *mask)
+{
+	task_t *t = pid ? get_task_pid(pid) : (task_t *)current_task;
+	if(!t)
+		return -ESRCH;
+	if(current_task->thread->uid && current_task->thread->uid != t->thread->uid)
+		return -EPERM;
+	if(!size)
+		return -EINVAL;
+#if CONFIG_SMP
+	unsigned long new[CPU_MASK_WORDS];
+	memset(new, 0, sizeof(new));
+	memcpy(new, mask, size < sizeof(new) ? size : sizeof(new));
+	unsigned i;
+	for(i=0;i<num_cpus;i++) {
+		if(cpu_mask_test(new, i) && (cpu_array[i].flags & CPU_TASK))
+			break;
+	}
+	if(i == num_cpus)
+		return -EINVAL;
+	if(t == kernel_task || (t->cpu && t == ((cpu_t *)t->cpu)->ktask))
+		return -EINVAL;
+	memcpy((void *)t->cpu_mask, new, sizeof(new));
+	cpu_t *cpu = t->cpu;
+	if(!cpu || task_cpu_allowed(t, cpu))
+		return 0;
+	/* a running task moves itself when it next gets switched out */
+	if(t == current_task)
+		schedule();
+	else
+		move_task_cpu(t, sched_pick_cpu(t, 0));
+	return 0;
+#else
+	return (*(unsigned char *)mask & 1) ? 0 : -EINVAL;
+#endif
+}
+
+int sys_sched_getaffinity(int pid, size_t size, unsigned long *mask)
+{
+	task_t *t = pid ? get_task_pid(pid) : (task_t *)current_task;
+	if(!t)
+		return -ESRCH;
+	if(!size)
+		return -EINVAL;
+#if CONFIG_SMP
+	if(size > sizeof(t->cpu_mask))
+		size = sizeof(t->cpu_mask);
+	memcpy(mask, (void *)t->cpu_mask, size);
+#else
+	if(size > sizeof(unsigned long))
+		size = sizeof(unsigned long);
+	memset(mask, 0, size);
+	*(unsigned char *)mask = 1;
+#endif
+	return size;
+}
+
+int sys_sched_setscheduler(int pid, int policy, struct sched_param *param)
+{
+	task_t *t = pid ? get_task_pid(pid) : (task_t *)current_task;
+	if(!t)
+		return -ESRCH;
+	int prio = param->sched_priority;
+	if(policy == SCHED_FIFO || policy == SCHED_RR) {
+		if(prio < SCHED_RT_PRIO_MIN || prio > SCHED_RT_PRIO_MAX)
+			return -EINVAL;
+		if(current_task->thread->uid)
+			return -EPERM;
+	} else if(policy != SCHED_OTHER || prio)
+		return -EINVAL;
+	if(current_task->thread->uid && current_task->thread->uid != t->thread->uid)
+		return -EPERM;
+	if(t == kernel_task || (t->cpu && t == ((cpu_t *)t->cpu)->ktask))
+		return -EINVAL;
+	cpu_t *cpu;
+	/* the task may get moved to another cpu while we're doing this */
+	while((cpu = t->cpu) && runqueue_set_policy(cpu->active_queue, t, policy, prio) == -EAGAIN);
+	if(!cpu) {
+		t->policy = policy;
+		t->rt_priority = prio;
+	}
+	/* let anything that should run before us now have the cpu */
+	if(t == current_task) {
+		if(policy == SCHED_OTHER)
+			schedule();
+	} else
+		task_poke(t);
+	return 0;
+}
+
+int sys_sched_getscheduler(int pid, struct sched_param *param)
+{
+	task_t *t = pid ? get_task_pid(pid) : (task_t *)current_task;
+	if(!t)
+		return -ESRCH;
+	if(param)
+		param->sched_priority = t->rt_priority;
+	return t->policy;
+}
+
 void __sys_nice_search_action(task_t *t, int val)
 {
 	t->priority = val;
@@ -86,13 +190,19 @@ int sys_setsid(int ex, int cmd)
 	if(cmd) {
 		return -ENOTSUP;
 	}
-	current_task->tty=0;
-	return 0;
+	return task_set_session((task_t *)current_task);
 }
 
-int sys_setpgid(int a, int b)
+int sys_setpgid(int pid, int pgid)
 {
-	return -ENOSYS;
+	task_t *t = pid ? get_task_pid(pid) : (task_t *)current_task;
+	if(!t || (t != current_task && t->parent != current_task))
+		return -ESRCH;
+	if(pgid < 0)
+		return -EINVAL;
+	if(t->sid != current_task->sid)
+		return -EPERM;
+	return task_set_pgid(t, pgid ? (unsigned)pgid : t->pid);
 }
 
 int get_pid()
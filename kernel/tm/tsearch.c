@@ -51,35 +51,11 @@ task_t *search_tqueue(tqueue_t *tq, unsigned flags, unsigned long value, void (*
 			t = tmp;
 			break;
 		}
-		/* special actions required by exit */
-		if(flags & TSEARCH_EXIT_WAITING && tmp->waiting == current_task)
-		{
-			tmp->sigd = SIGWAIT;
-			tmp->waiting=0;
-			tmp->waiting_ret = 0;
-			memcpy((void *)&tmp->we_res, (void *)&current_task->exit_reason, 
-				   sizeof(current_task->exit_reason));
-			tmp->we_res.pid = current_task->pid;
-			task_resume(tmp);	
-		}
-		if(flags & TSEARCH_EXIT_PARENT && tmp->parent == current_task)
-		{
-			tmp->parent = 0;
-			if(tmp->state == TASK_DEAD)
-				move_task_to_kill_queue(tmp, 1);
-		}
 		next:
 		/* have we found something and are only looking for one thing? */
 		if(t && !(flags & TSEARCH_FINDALL))
 			break;
 	}
-	/* TSEARCH_EXIT_PARENT is specified only during a process's exit. If this task has no parent, or 
-	 * will soon have no parent, we just move ourselves to the kill queue immediately, saving time later */
-	if(flags & TSEARCH_EXIT_PARENT && (current_task->parent == 0 || (current_task->parent->flags & TF_EXITING)) && (current_task->flags & TF_EXITING))
-	{
-		/* some more housekeeping... */
-		move_task_to_kill_queue(current_task, 1);
-	}
 	mutex_release(&tq->lock);
 	set_int(old);
 	return t;
@@ -3,6 +3,8 @@
 #include <task.h>
 #include <cpu.h>
 
+#define WAIT_POLL_TICKS (current_hz / 10 + 1)
+
 int wait_task(unsigned pid, int state)
 {
 	if(!state) return 0;
@@ -10,22 +12,30 @@ int wait_task(unsigned pid, int state)
 	if(current_task->pid) current_task->system=0;
 	task_t *task = get_task_pid(pid);
 	if(!task) return -ESRCH;
-	current_task->waiting = task;
+	if(task_wait_on(task))
+		return -ESRCH;
 	if(state == -1)
 		/* We wait for it to be dead. When it is, we recieve a signal, 
 		 * so why loop? */
 		task_pause(current_task);
 	else {
-		/* So, here we just wait until either the task exits or the 
-		 * state becomes equal. Unfortunately we are forced to check 
-		 * the state whenever we can */
+		/* wait until either the task exits or its state becomes
+		 * equal. Its state changes wake us up, but not all of them
+		 * post an event, so we still take a look every so often */
 		while(1) {
+			raise_flag(TF_WAITCHILD);
+			if(!current_task->waiting)
+				break;
 			task = get_task_pid(pid);
 			if(!task || task->state == state)
 				break;
-			schedule();
+			if(current_task->sigd && current_task->sigd != SIGWAIT)
+				break;
+			delay(WAIT_POLL_TICKS);
 		}
+		lower_flag(TF_WAITCHILD);
 	}
+	task_stop_waiting((task_t *)current_task);
 	if(current_task->sigd != SIGWAIT && current_task->sigd)
 		return -EINTR;
 	return current_task->waiting_ret;
@@ -57,43 +67,44 @@ void get_status_int(task_t *t, int *st, int *__pid)
 		*st = code << 16 | info;
 }
 
+static int waitpid_interrupted()
+{
+	return current_task->sigd && 
+		((struct sigaction *)&(current_task->thread->signal_act
+		[current_task->sigd]))->_sa_func._sa_handler && !(current_task->thread->signal_act
+	[current_task->sigd].sa_flags & SA_RESTART);
+}
+
+/* children post their exits, stops and continues to us, so we sleep
+ * until one of them does instead of checking on them */
 int sys_waitpid(int pid, int *st, int opt)
 {
 	if(!pid || pid < -1)
 		return -ENOSYS;
 	raise_flag(TF_BGROUND);
-	task_t *t=0;
-	if(pid == -1) {
-		/* find first child */
-		t = search_tqueue(primary_queue, TSEARCH_PARENT, (addr_t)current_task, (void (*)(task_t *, int))0, 0, 0);
-	} else
-		t = get_task_pid(pid);
-	top:
-	
-	if(!t || t->parent != current_task) {
-		lower_flag(TF_BGROUND);
-		return -ECHILD;
-	}
-	
-	if(current_task->sigd && 
-		((struct sigaction *)&(current_task->thread->signal_act
-		[current_task->sigd]))->_sa_func._sa_handler && !(current_task->thread->signal_act
-	[current_task->sigd].sa_flags & SA_RESTART)) {
-		lower_flag(TF_BGROUND);
-		return -EINTR;
-	}
-	
-	if(t->state != TASK_DEAD) {
-		if(!(opt & WNOHANG)) {
-			schedule();
-			goto top;
+	task_t *t;
+	unsigned event;
+	int err;
+	while(!(t = task_take_child_event(pid, opt, &event, &err))) {
+		if(err != -EAGAIN) {
+			lower_flag(TF_BGROUND);
+			return err;
+		}
+		while(!schedule());
+		lower_flag(TF_WAITCHILD);
+		current_task->state = TASK_RUNNING;
+		if(waitpid_interrupted()) {
+			lower_flag(TF_BGROUND);
+			return -EINTR;
 		}
-		lower_flag(TF_BGROUND);
-		return 0;
 	}
-	int code, gotpid;
-	get_status_int(t, &code, &gotpid);
-	if(pid == -1) move_task_to_kill_queue(t, 0);
+	int code, gotpid = t->pid;
+	if(event == WEV_CONT)
+		code = 0xffff;
+	else
+		get_status_int(t, &code, event == WEV_EXIT ? &gotpid : 0);
+	if(event == WEV_EXIT)
+		move_task_to_kill_queue(t, 0);
 	if(st)
 		*st = code;
 	lower_flag(TF_BGROUND);
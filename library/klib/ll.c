@@ -10,6 +10,22 @@
 #include <mutex.h>
 #include <task.h>
 
+kmem_cache_t *llistnode_cache=0;
+
+/* ll_do_insert sets up the rest of the node */
+static void ll_node_ctor(void *obj)
+{
+	struct llistnode *n = obj;
+	n->magic = 0;
+	n->memberof = 0;
+}
+
+void ll_init_cache()
+{
+	llistnode_cache = kmem_cache_create("llistnode", sizeof(struct llistnode), 
+			0, ll_node_ctor);
+}
+
 struct llistnode *ll_do_insert(struct llist *list, struct llistnode *n, void *entry)
 {
 	if(!(list->flags & LL_LOCKLESS)) 
@@ -36,7 +52,7 @@ struct llistnode *ll_do_insert(struct llist *list, struct llistnode *n, void *en
 struct llistnode *ll_insert(struct llist *list, void *entry)
 {
 	assert(list && ll_is_active(list));
-	struct llistnode *n = (struct llistnode *)kmalloc(sizeof(struct llistnode));
+	struct llistnode *n = (struct llistnode *)kmem_cache_alloc(llistnode_cache);
 	return ll_do_insert(list, n, entry);
 }
 